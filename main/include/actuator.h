@@ -0,0 +1,130 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+#include "tap_trace.h"
+#include "logging.h"
+
+/**
+ * Single consumer for every output: lock GPIO, NFC status pins, NeoPixel and alt action.
+ * Commands go through one queue, what they do is up to hooks_t::command on the actuator task.
+ * Pulses never block there, their end is scheduled on an esp_timer that sets the pulse's
+ * notification bit, so a command arriving mid-pulse is handled right away. A bit can't be lost
+ * to a full queue, the end of a pulse always reaches the task.
+ */
+namespace actuator {
+  struct cmd_t
+  {
+    enum target_t : uint8_t
+    {
+      LOCK,      // arg = gpioLockAction source
+      NFC_GPIO,  // arg = 0 fail, 1 success, 2 alt action
+      NEOPIXEL   // arg = 0 fail, 1 success
+    };
+    target_t target;
+    uint8_t arg;
+    uint32_t queuedAt;
+  };
+  enum pulse_t : uint8_t
+  {
+    P_MOMENTARY,
+    P_NFC_SUCCESS,
+    P_NFC_FAIL,
+    P_NEOPIXEL,
+    P_ALT_ACTION,
+    P_MAX
+  };
+
+  struct hooks_t {
+    std::function<void(const cmd_t&)> command;
+    std::function<void(pulse_t)> pulseEnd; // only for a pulse that wasn't restarted since its timer ran out
+  };
+
+  class Engine
+  {
+  public:
+    static constexpr UBaseType_t QUEUE_DEPTH = 8;
+
+    /// Queue and pulse timers, commands sent before start() wait in the queue
+    void begin(hooks_t hooks) {
+      if (queue) return;
+      this->hooks = std::move(hooks);
+      queue = xQueueCreate(QUEUE_DEPTH, sizeof(cmd_t));
+      for (uint8_t i = 0; i < P_MAX; i++) {
+        timerArgs[i] = { this, pulse_t(i) };
+        const esp_timer_create_args_t args = { .callback = pulseTimer, .arg = &timerArgs[i], .dispatch_method = ESP_TIMER_TASK, .name = "actuator_pulse", .skip_unhandled_events = true };
+        esp_timer_create(&args, &timers[i]);
+      }
+    }
+
+    void start(uint32_t stack, UBaseType_t priority) {
+      if (!taskHandle) xTaskCreate(task, "actuator_task", stack, this, priority, &taskHandle);
+    }
+
+    bool send(cmd_t::target_t target, uint8_t arg) {
+      const cmd_t cmd{ .target = target, .arg = arg, .queuedAt = tapTrace::now() };
+      if (xQueueSend(queue, &cmd, 0) != pdTRUE) {
+        return false;
+      }
+      // before the task exists it drains the queue on its own once started
+      if (taskHandle) {
+        xTaskNotify(taskHandle, QUEUED_BIT, eSetBits);
+      }
+      return true;
+    }
+
+    /// (Re)starts the pulse's timer, from the actuator task
+    void pulseStart(pulse_t pulse, uint16_t timeoutMs) {
+      esp_timer_stop(timers[pulse]);
+      esp_timer_start_once(timers[pulse], timeoutMs * 1000ULL);
+    }
+
+    /// Returns true if the pulse was still running
+    bool pulseCancel(pulse_t pulse) { return esp_timer_stop(timers[pulse]) == ESP_OK; }
+
+  private:
+    static constexpr const char* TAG = "Actuator";
+    // notification bits of the task: one per pulse, set by its timer, and one for commands in the queue
+    static constexpr uint32_t QUEUED_BIT = 1UL << P_MAX;
+
+    struct timerArg_t {
+      Engine* engine;
+      pulse_t pulse;
+    };
+
+    static void pulseTimer(void* arg) {
+      timerArg_t* timer = static_cast<timerArg_t*>(arg);
+      xTaskNotify(timer->engine->taskHandle, 1UL << timer->pulse, eSetBits);
+    }
+
+    static void task(void* arg) {
+      Engine* self = static_cast<Engine*>(arg);
+      cmd_t cmd;
+      uint32_t bits = 0;
+      while (1) {
+        // commands first, one restarting a pulse that just ended keeps the output
+        while (xQueueReceive(self->queue, &cmd, 0) == pdTRUE) {
+          LOG(D, "Got something in queue - target = %d arg = %d", cmd.target, cmd.arg);
+          self->hooks.command(cmd);
+        }
+        for (uint8_t pulse = 0; pulse < P_MAX; pulse++) {
+          // a pulse restarted after its expiry was signalled keeps the output
+          if (bits & (1UL << pulse) && !esp_timer_is_active(self->timers[pulse])) {
+            self->hooks.pulseEnd(pulse_t(pulse));
+          }
+        }
+        xTaskNotifyWait(0, UINT32_MAX, &bits, portMAX_DELAY);
+      }
+    }
+
+    hooks_t hooks;
+    QueueHandle_t queue = nullptr;
+    TaskHandle_t taskHandle = nullptr;
+    std::array<esp_timer_handle_t, P_MAX> timers = {};
+    std::array<timerArg_t, P_MAX> timerArgs = {};
+  };
+}
@@ -0,0 +1,265 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cinttypes>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <mbedtls/platform_util.h>
+#include <nvs.h>
+#include "HomeKey.h"
+#include "hkAuthContext.h"
+#include "reader_state.h"
+#include "tap_arena.h"
+#include "tap_trace.h"
+#include "logging.h"
+
+typedef std::function<bool(uint8_t*, uint8_t, uint8_t*, uint16_t*, bool)> nfcExchange_t;
+
+/**
+ * HKAuthenticationContexts built ahead of the taps that will use them. Constructing one generates
+ * the reader ephemeral key pair and loads the reader identity from readerData, that's the part of
+ * a tap that doesn't depend on the device in the field. A low priority task keeps up to N of them
+ * ready, refilling between taps, and a tap takes one in O(1). Every context is single use and
+ * tagged with the generation it was built for. Anything that changes the reader keys or the
+ * issuers calls invalidate(), and stale contexts are thrown away instead of handed out.
+ * The library changes the readerData it was given during a tap, so each context comes with its
+ * own working copy. Every tap publishes a new version, the refill task brings the ready copies up
+ * to it once the tap is over so take() only has to copy if another version came in since.
+ * Contexts live in a SlotPool and a tap hands its lease back through recycle(), which keeps the
+ * working copy for the next build, so after the first taps its buffers are reused instead of
+ * allocated again. Working copies hold the reader private key and the endpoints' persistent keys,
+ * those are wiped as soon as a copy goes back to the spares or is freed.
+ */
+template <size_t N>
+class AuthContextPool
+{
+public:
+  struct stats_t {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t buildUs; // last build time, what a miss adds to the tap
+    uint64_t savedUs; // build time of every context a tap took from the pool
+    uint32_t refreshes; // working copies brought up to a new version by the refill task
+    uint32_t tapCopies; // takes that had to copy readerData themselves
+    size_t ready;
+    uint32_t heapContexts; // contexts that didn't fit the slots
+  };
+
+  // N ready, one in a tap and one being built by the refill task
+  typedef tapArena::SlotPool<HKAuthenticationContext, N + 2> contextSlots_t;
+
+  /// A context and the working copy of readerData it authenticates against, declared so the context is destroyed first
+  struct lease_t {
+    std::unique_ptr<readerData_t> data;
+    typename contextSlots_t::ptr_t ctx;
+    uint32_t version = 0;
+  };
+
+  AuthContextPool(readerState::ReaderState& state, nvs_handle& handle) : state(state), handle(handle) {}
+
+  // Starts the refill task, pinned to `core` if the chip has it
+  void begin(BaseType_t core) {
+    if (taskHandle) return;
+    xTaskCreatePinnedToCore(task, "auth_ctx_pool", 8192, this, tskIDLE_PRIORITY + 1, &taskHandle, core < portNUM_PROCESSORS ? core : tskNO_AFFINITY);
+  }
+
+  void invalidate() {
+    generation.fetch_add(1, std::memory_order_release);
+    refill();
+  }
+  // Wakes the refill task, called once a tap is over so building doesn't compete with it for the crypto hardware
+  void refill() {
+    if (taskHandle) xTaskNotifyGive(taskHandle);
+  }
+
+  /// Context for a tap on `snapshot` whose frames go through `exchange`, which must outlive the returned context
+  lease_t take(const nfcExchange_t& exchange, const readerState::pin_t& snapshot) {
+    current = &exchange;
+    entry_t entry;
+    bool hit = pop(entry);
+    if (!hit) entry = build();
+    // a version the refill task didn't get to yet, or one published during the build
+    bool copy = entry.lease.version != snapshot->version;
+    if (copy) {
+      *entry.lease.data = snapshot->data;
+      entry.lease.version = snapshot->version;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      tapCopies += copy;
+      if (hit) {
+        hits++;
+        savedUs += entry.buildUs;
+      } else {
+        misses++;
+      }
+    }
+    return std::move(entry.lease);
+  }
+  /// Frees the context of a finished tap and keeps its working copy for the next build
+  void recycle(lease_t&& lease) {
+    lease.ctx.reset();
+    if (lease.data) wipe(*lease.data);
+    std::lock_guard<std::mutex> lock(mutex);
+    if (lease.data && spareCount < spares.size()) spares[spareCount++] = std::move(lease.data);
+  }
+
+  stats_t stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return { hits, misses, lastBuildUs, savedUs, refreshes, tapCopies, count, contexts.fallbackCount() };
+  }
+
+private:
+  static constexpr const char* TAG = "AuthContextPool";
+
+  struct entry_t {
+    lease_t lease;
+    uint32_t generation = 0;
+    uint32_t buildUs = 0;
+  };
+
+  static void task(void* arg) {
+    AuthContextPool* self = static_cast<AuthContextPool*>(arg);
+    while (1) {
+      self->fill();
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+  }
+
+  void fill() {
+    refresh();
+    while (1) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        dropStale();
+        if (count == N) return;
+      }
+      entry_t entry = build();
+      LOG(D, "Auth context built in %" PRIu32 " us (generation %" PRIu32 ")", entry.buildUs, entry.generation);
+      push(std::move(entry));
+    }
+  }
+
+  // Copies the latest version into the ready contexts' working copies. One at a time is taken out
+  // of the ring, so the copy doesn't hold the mutex, and put back at the end. Versions only grow
+  // from the front to the back, the first one already up to date means the rest are too.
+  void refresh() {
+    readerState::pin_t snapshot = state.pin();
+    for (size_t i = 0; i < N; i++) {
+      entry_t entry;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        dropStale();
+        if (count == 0 || slots[head].lease.version == snapshot->version) return;
+        entry = std::move(slots[head]);
+        head = (head + 1) % N;
+        count--;
+      }
+      *entry.lease.data = snapshot->data;
+      entry.lease.version = snapshot->version;
+      if (push(std::move(entry))) {
+        std::lock_guard<std::mutex> lock(mutex);
+        refreshes++;
+      }
+    }
+  }
+
+  // Back of the ring, unless it's full or the entry went stale in the meantime
+  bool push(entry_t&& entry) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (entry.generation != generation.load(std::memory_order_acquire) || count == N) {
+      discard(entry.lease);
+      return false;
+    }
+    slots[(head + count) % N] = std::move(entry);
+    count++;
+    return true;
+  }
+
+  entry_t build() {
+    entry_t entry;
+    entry.generation = generation.load(std::memory_order_acquire);
+    uint32_t start = tapTrace::now();
+    readerState::pin_t snapshot = state.pin();
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (spareCount) entry.lease.data = std::move(spares[--spareCount]);
+    }
+    if (entry.lease.data) {
+      *entry.lease.data = snapshot->data;
+    } else {
+      entry.lease.data.reset(new readerData_t(snapshot->data));
+    }
+    entry.lease.version = snapshot->version;
+    entry.lease.ctx = contexts.create(forward, *entry.lease.data, handle);
+    entry.buildUs = tapTrace::now() - start;
+    lastBuildUs = entry.buildUs;
+    return entry;
+  }
+
+  bool pop(entry_t& out) {
+    std::lock_guard<std::mutex> lock(mutex);
+    dropStale();
+    if (count == 0) return false;
+    out = std::move(slots[head]);
+    head = (head + 1) % N;
+    count--;
+    return true;
+  }
+
+  // Zeroes the keys in place, sizes are kept so the next build reuses the buffers
+  static void wipe(readerData_t& data) {
+    mbedtls_platform_zeroize(data.reader_sk.data(), data.reader_sk.size());
+    for (auto&& issuer : data.issuers) {
+      for (auto&& endpoint : issuer.endpoints) {
+        mbedtls_platform_zeroize(endpoint.endpoint_prst_k.data(), endpoint.endpoint_prst_k.size());
+      }
+    }
+  }
+
+  // Caller holds the mutex, frees the context and keeps the wiped working copy as a spare if there's room
+  void discard(lease_t& lease) {
+    lease.ctx.reset();
+    if (lease.data) wipe(*lease.data);
+    if (lease.data && spareCount < spares.size()) spares[spareCount++] = std::move(lease.data);
+    else lease.data.reset();
+  }
+
+  // Caller holds the mutex, contexts are built in order so stale ones are always at the front
+  void dropStale() {
+    uint32_t gen = generation.load(std::memory_order_acquire);
+    while (count && slots[head].generation != gen) {
+      discard(slots[head].lease);
+      head = (head + 1) % N;
+      count--;
+    }
+  }
+
+  readerState::ReaderState& state;
+  nvs_handle& handle;
+  // A context keeps a reference to the callable it was built with, this one stays put and
+  // forwards to whatever exchange the current tap uses
+  nfcExchange_t forward = [this](uint8_t* send, uint8_t sendLen, uint8_t* recv, uint16_t* recvLen, bool large) {
+    return (*current)(send, sendLen, recv, recvLen, large);
+  };
+  const nfcExchange_t* current = nullptr;
+  TaskHandle_t taskHandle = nullptr;
+  std::mutex mutex;
+  contextSlots_t contexts;
+  std::array<entry_t, N> slots;
+  std::array<std::unique_ptr<readerData_t>, N + 1> spares;
+  size_t spareCount = 0;
+  size_t head = 0;
+  size_t count = 0;
+  std::atomic<uint32_t> generation{ 1 };
+  std::atomic<uint32_t> lastBuildUs{ 0 };
+  uint32_t hits = 0;
+  uint32_t misses = 0;
+  uint64_t savedUs = 0;
+  uint32_t refreshes = 0;
+  uint32_t tapCopies = 0;
+};
@@ -0,0 +1,66 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <nlohmann/json.hpp>
+
+/**
+ * Collects a request body that arrives over several onBody chunks into a buffer reserved once,
+ * so a body of any split costs no heap until it's parsed. One request owns the buffer at a time,
+ * from its first chunk until take() or release(), the latter also runs when its client disconnects.
+ */
+template <size_t N>
+class BodyArena
+{
+public:
+  enum status_t
+  {
+    READY,
+    NO_BODY,
+    TOO_LARGE,
+    BUSY,
+    MALFORMED
+  };
+
+  // First chunk of a body, returns false if another request holds the buffer
+  bool begin(const void* request, size_t total) {
+    if (owner && owner != request) return false;
+    owner = request;
+    length = 0;
+    overflow = total > N;
+    return true;
+  }
+  void append(const void* request, const uint8_t* data, size_t len, size_t index) {
+    if (owner != request || overflow) return;
+    if (index + len > N) {
+      overflow = true;
+      return;
+    }
+    memcpy(buf.data() + index, data, len);
+    length = std::max(length, index + len);
+  }
+  /// Parses the collected body in one go and frees the buffer for the next request
+  status_t take(const void* request, nlohmann::json& out) {
+    if (owner != request) return owner ? BUSY : NO_BODY;
+    status_t status = overflow ? TOO_LARGE : READY;
+    if (status == READY) {
+      out = nlohmann::json::parse(buf.data(), buf.data() + length, nullptr, false);
+      if (out.is_discarded()) status = MALFORMED;
+    }
+    release(request);
+    return status;
+  }
+  void release(const void* request) {
+    if (owner != request) return;
+    owner = nullptr;
+    length = 0;
+    overflow = false;
+  }
+
+private:
+  std::array<uint8_t, N> buf;
+  const void* owner = nullptr;
+  size_t length = 0;
+  bool overflow = false;
+};
@@ -50,6 +50,16 @@ enum class gpioMomentaryStateStatus : uint8_t
 #define HS_STATUS_LED 255 // HomeSpan Status LED GPIO pin
 #define HS_PIN 255 // GPIO Pin for a Configuration Mode button (more info on https://github.com/HomeSpan/HomeSpan/blob/master/docs/UserGuide.md#device-configuration-mode)
 
+// NFC
+#define NFC_IRQ_PIN 255 // PN532 IRQ GPIO Pin, polling becomes interrupt-driven when set
+#define NFC_IRQ_ECP_INTERVAL 150 // Max time in ms to wait on the IRQ before aborting the search and broadcasting the ECP frame again
+#define NFC_RETRY_BUDGET 500 // Time in ms from the start of a tap during which frame errors are retried instead of failing the tap
+#define NFC_FRAME_RETRIES 1 // How many times a failed APDU is sent again before the flow is restarted from SELECT
+#define AUTH_POOL_DEPTH 2 // Authentication contexts (each with its own ephemeral key) kept ready for the next taps
+#define NFC_TASK_CORE 1 // Core the NFC task is pinned to, ignored on single-core chips
+#define AUTH_POOL_CORE 0 // Core the pool refill task is pinned to, keep it off NFC_TASK_CORE so key generation never delays a tap. Ignored on single-core chips
+#define READER_FLUSH_DELAY 500 // Milliseconds without a tap before reader data changed by taps is written to NVS
+
 // Actions
 #define NFC_NEOPIXEL_PIN 255 // GPIO Pin used for NeoPixel
 #define NEOPIXEL_SUCCESS_R 0 // Color value for Red - Success HK Auth
@@ -78,7 +88,21 @@ enum class gpioMomentaryStateStatus : uint8_t
 #define GPIO_HK_ALT_ACTION_TIMEOUT 5000
 #define GPIO_HK_ALT_ACTION_GPIO_STATE HIGH
 
+// MQTT
+#define MQTT_HOST "" // Broker address, MQTT stays off while empty
+#define MQTT_PORT 1883
+#define MQTT_USERNAME ""
+#define MQTT_PASSWORD ""
+#define MQTT_QUEUE_DEPTH 32 // Messages held in RAM while the broker is slow or unreachable, the oldest are dropped first
+
 // WebUI
 #define WEB_AUTH_ENABLED false
 #define WEB_AUTH_USERNAME "admin"
-#define WEB_AUTH_PASSWORD "password"
\ No newline at end of file
+#define WEB_AUTH_PASSWORD "password"
+#define WEB_BODY_MAX_SIZE 4096 // Largest /config/save body accepted, the buffer is reserved at boot
+#define EVENT_QUEUE_DEPTH 16 // Events kept for /events while browsers catch up, the oldest are dropped first
+#define EVENT_MAX_WAITING 4 // Average packets queued per SSE client above which the dispatcher holds back
+#define EVENT_HEALTH_INTERVAL 5000 // Milliseconds between RSSI/battery/heap events
+
+// Diagnostics
+#define TAP_TRACE_DEPTH 32 // Number of taps kept in the per-stage timing buffer (/tap_trace and the T command)
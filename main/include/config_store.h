@@ -0,0 +1,349 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <map>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <nvs.h>
+#include <nlohmann/json.hpp>
+#include "logging.h"
+
+/**
+ * Typed binary storage for config structs.
+ * A config type lists its fields once through a static `fields(self, visitor)` template, each with
+ * a numeric id that is never reused and its JSON name. The NVS blob is a magic byte, the schema
+ * version and one [id][length][value] record per field with integers little-endian, so a load is a
+ * single nvs_get_blob and a walk over the records. Records that are missing or don't have the size
+ * their field expects keep the default, which is how fields added or retyped by a newer schema come
+ * up after an update. A schema bump that changes what a field means registers a migration with the
+ * Store for the version it moves away from.
+ */
+namespace configStore {
+  using json = nlohmann::json;
+  constexpr uint8_t MAGIC = 0xC5;
+
+  class Encoder
+  {
+  public:
+    explicit Encoder(uint8_t version) : buf{ MAGIC, version } {}
+    template <typename T>
+    void operator()(uint8_t id, const char*, const T& field) {
+      buf.push_back(id);
+      size_t lenAt = buf.size();
+      buf.push_back(0);
+      put(field);
+      buf[lenAt] = buf.size() - lenAt - 1;
+    }
+    std::vector<uint8_t> buf;
+
+  private:
+    template <typename T>
+    std::enable_if_t<std::is_integral_v<T>> put(T v) {
+      for (size_t i = 0; i < sizeof(T); i++) buf.push_back(static_cast<uint8_t>(static_cast<uint64_t>(v) >> (i * 8)));
+    }
+    void put(const std::string& v) { buf.insert(buf.end(), v.begin(), v.begin() + std::min<size_t>(v.size(), UINT8_MAX)); }
+    template <typename T, size_t N>
+    void put(const std::array<T, N>& v) {
+      for (auto&& e : v) put(e);
+    }
+    template <typename K>
+    void put(const std::map<K, int>& v) {
+      for (auto&& e : v) put(static_cast<int32_t>(e.second));
+    }
+  };
+
+  /// Walks the records of a blob in place, nothing is copied or indexed
+  class Records
+  {
+  public:
+    struct record_t {
+      const uint8_t* data = nullptr;
+      uint8_t len = 0;
+      bool operator==(const record_t& o) const { return len == o.len && (data == o.data || (data && o.data && !memcmp(data, o.data, len))); }
+    };
+
+    /// The schema version, 0 if the blob isn't in this format
+    static uint8_t version(const std::vector<uint8_t>& blob) { return blob.size() >= 2 && blob[0] == MAGIC ? blob[1] : 0; }
+    /// Calls `f(id, record)` for each record of the blob, in order
+    template <typename F>
+    static void walk(const std::vector<uint8_t>& blob, F&& f) {
+      if (!version(blob)) return;
+      size_t p = 2;
+      while (p + 2 <= blob.size() && p + 2 + blob[p + 1] <= blob.size()) {
+        f(blob[p], record_t{ &blob[p + 2], blob[p + 1] });
+        p += 2 + blob[p + 1];
+      }
+    }
+    /// The last record of `id` in the blob, the one a load ends up with
+    static record_t find(const std::vector<uint8_t>& blob, uint8_t id) {
+      record_t found;
+      walk(blob, [&](uint8_t rid, const record_t& r) {
+        if (rid == id) found = r;
+      });
+      return found;
+    }
+  };
+
+  /// Decodes one record into the field with its id, run over fields() for each record of a blob
+  class Decoder
+  {
+  public:
+    Decoder(uint8_t id, const Records::record_t& record) : id(id), r(record) {}
+    void operator()(uint8_t fieldId, const char*, std::string& field) {
+      if (fieldId != id) return;
+      field.assign(reinterpret_cast<const char*>(r.data), r.len);
+      decoded++;
+    }
+    template <typename T>
+    void operator()(uint8_t fieldId, const char*, T& field) {
+      if (fieldId != id || r.len != size(field)) return;
+      const uint8_t* p = r.data;
+      get(p, field);
+      decoded++;
+    }
+    size_t decoded = 0;
+
+  private:
+    template <typename T>
+    static std::enable_if_t<std::is_integral_v<T>, size_t> size(const T&) { return sizeof(T); }
+    template <typename T, size_t N>
+    static size_t size(const std::array<T, N>&) { return sizeof(T) * N; }
+    template <typename K>
+    static size_t size(const std::map<K, int>& v) { return v.size() * sizeof(int32_t); }
+
+    template <typename T>
+    static std::enable_if_t<std::is_integral_v<T>> get(const uint8_t*& p, T& v) {
+      uint64_t raw = 0;
+      for (size_t i = 0; i < sizeof(T); i++) raw |= static_cast<uint64_t>(p[i]) << (i * 8);
+      v = static_cast<T>(raw);
+      p += sizeof(T);
+    }
+    template <typename T, size_t N>
+    static void get(const uint8_t*& p, std::array<T, N>& v) {
+      for (auto&& e : v) get(p, e);
+    }
+    template <typename K>
+    static void get(const uint8_t*& p, std::map<K, int>& v) {
+      for (auto&& e : v) {
+        int32_t i;
+        get(p, i);
+        e.second = i;
+      }
+    }
+    uint8_t id;
+    const Records::record_t& r;
+  };
+
+  enum assign_t
+  {
+    NOT_FOUND,
+    BAD_TYPE,
+    ASSIGNED
+  };
+
+  /**
+   * Sets the field named `key` from a JSON value, checking the value's shape first since the json
+   * library is built without exceptions. Booleans also take numbers, like the web UI sends them.
+   */
+  class JsonAssign
+  {
+  public:
+    JsonAssign(const std::string& key, const json& value, bool dryRun) : key(key), value(value), dryRun(dryRun) {}
+    template <typename T>
+    void operator()(uint8_t, const char* name, T& field) {
+      if (result != NOT_FOUND || key != name) return;
+      if (!accepts(field, value)) {
+        result = BAD_TYPE;
+        return;
+      }
+      if (!dryRun) set(field, value);
+      result = ASSIGNED;
+    }
+    assign_t result = NOT_FOUND;
+
+  private:
+    static bool accepts(const bool&, const json& v) { return v.is_boolean() || v.is_number_integer(); }
+    template <typename T>
+    static std::enable_if_t<std::is_integral_v<T>, bool> accepts(const T&, const json& v) { return v.is_number_integer(); }
+    static bool accepts(const std::string&, const json& v) { return v.is_string(); }
+    template <typename T, size_t N>
+    static bool accepts(const std::array<T, N>& field, const json& v) {
+      return v.is_array() && v.size() == N && std::all_of(v.begin(), v.end(), [&](const json& e) { return accepts(field[0], e); });
+    }
+    template <typename K>
+    static bool accepts(const std::map<K, int>& field, const json& v) {
+      return v.is_array() && std::all_of(v.begin(), v.end(), [&](const json& e) {
+        return e.is_array() && e.size() == 2 && e[0].is_number_integer() && e[1].is_number_integer() && field.count(static_cast<K>(e[0].get<int>()));
+      });
+    }
+
+    static void set(bool& field, const json& v) { field = v.is_boolean() ? v.get<bool>() : v.get<int>() != 0; }
+    template <typename T>
+    static std::enable_if_t<std::is_integral_v<T>> set(T& field, const json& v) { field = v.get<T>(); }
+    static void set(std::string& field, const json& v) { field = v.get<std::string>(); }
+    template <typename T, size_t N>
+    static void set(std::array<T, N>& field, const json& v) {
+      for (size_t i = 0; i < N; i++) set(field[i], v[i]);
+    }
+    template <typename K>
+    static void set(std::map<K, int>& field, const json& v) {
+      for (auto&& e : v) field[static_cast<K>(e[0].get<int>())] = e[1].get<int>();
+    }
+
+    const std::string& key;
+    const json& value;
+    bool dryRun;
+  };
+
+  /// Writes every field under its JSON name, in the shapes JsonAssign reads back
+  class JsonWrite
+  {
+  public:
+    explicit JsonWrite(json& out) : out(out) {}
+    template <typename T>
+    void operator()(uint8_t, const char* name, const T& field) { out[name] = field; }
+
+  private:
+    json& out;
+  };
+
+  /// Checks a JSON value against the field named `key` without changing anything
+  template <typename T>
+  assign_t check(T& cfg, const std::string& key, const json& value) {
+    JsonAssign v(key, value, true);
+    T::fields(cfg, v);
+    return v.result;
+  }
+  template <typename T>
+  assign_t assign(T& cfg, const std::string& key, const json& value) {
+    JsonAssign v(key, value, false);
+    T::fields(cfg, v);
+    return v.result;
+  }
+
+  /// For a config type's to_json
+  template <typename T>
+  void toJson(json& j, const T& cfg) {
+    j = json::object();
+    JsonWrite v(j);
+    T::fields(cfg, v);
+  }
+  /// For a config type's from_json: sets the fields named in `j`, unknown keys and values of the wrong shape are skipped
+  template <typename T>
+  void fromJson(const json& j, T& cfg) {
+    static constexpr const char* TAG = "configStore";
+    if (!j.is_object()) return;
+    for (auto it = j.begin(); it != j.end(); ++it) {
+      if (assign(cfg, it.key(), it.value()) == BAD_TYPE) LOG(W, "Skipping %s, the value doesn't fit the field", it.key().c_str());
+    }
+  }
+
+  /**
+   * NVS side of a config struct. The last stored blob is kept so a save can tell which fields
+   * differ and skips the flash write entirely when none do.
+   * A config stored by another schema version is rewritten in this one right after it's loaded.
+   * On the way up, the migration registered for each version in between runs first, with the
+   * stored blob at hand for records whose old layout the decoder skipped.
+   */
+  template <typename T>
+  class Store
+  {
+  public:
+    /// Brings a config decoded from schema `from` to what `from + 1` expects
+    typedef void (*migration_t)(T& cfg, const std::vector<uint8_t>& blob);
+    struct migrationStep_t {
+      uint8_t from;
+      migration_t migrate;
+    };
+
+    Store(nvs_handle& handle, const char* key, uint8_t version, std::initializer_list<migrationStep_t> migrations = {})
+        : handle(handle), key(key), version(version), migrations(migrations) {}
+
+    /// Decodes the stored config into `cfg`, returns the schema version it was written with, 0 if there is none
+    uint8_t load(T& cfg) {
+      size_t len = 0;
+      if (nvs_get_blob(handle, key, NULL, &len) != ESP_OK) return 0;
+      stored.resize(len);
+      if (nvs_get_blob(handle, key, stored.data(), &len) != ESP_OK) {
+        stored.clear();
+        return 0;
+      }
+      uint8_t storedVersion = Records::version(stored);
+      if (storedVersion == 0) {
+        stored.clear();
+        return 0;
+      }
+      size_t decoded = 0;
+      Records::walk(stored, [&](uint8_t id, const Records::record_t& r) {
+        Decoder decoder(id, r);
+        T::fields(cfg, decoder);
+        decoded += decoder.decoded;
+      });
+      LOG(D, "%s: schema v%u, %u fields decoded from %u bytes", key, storedVersion, unsigned(decoded), unsigned(len));
+      if (storedVersion != version) {
+        for (uint8_t from = storedVersion; from < version; from++) {
+          for (auto&& step : migrations) {
+            if (step.from == from) step.migrate(cfg, stored);
+          }
+        }
+        // the next boot loads it without going through this again
+        save(cfg);
+      }
+      return storedVersion;
+    }
+
+    /// Writes `cfg` if any field changed, returns the number of changed fields or -1 if NVS failed
+    int save(const T& cfg) {
+      Encoder encoder(version);
+      T::fields(cfg, encoder);
+      int changed = diff(encoder.buf);
+      if (changed == 0) return 0;
+      esp_err_t err = nvs_set_blob(handle, key, encoder.buf.data(), encoder.buf.size());
+      if (err == ESP_OK) err = nvs_commit(handle);
+      if (err != ESP_OK) {
+        LOG(E, "Could not save %s: %s", key, esp_err_to_name(err));
+        return -1;
+      }
+      stored = std::move(encoder.buf);
+      return changed;
+    }
+
+    void erase() {
+      nvs_erase_key(handle, key);
+      nvs_commit(handle);
+      stored.clear();
+    }
+
+  private:
+    static constexpr const char* TAG = "configStore";
+
+    // Number of field records that differ from the stored blob, every field counts if the version changed
+    int diff(const std::vector<uint8_t>& next) const {
+      if (next == stored) return 0;
+      bool sameVersion = Records::version(stored) == version;
+      int changed = 0;
+      Records::walk(next, [&](uint8_t id, const Records::record_t& r) {
+        if (sameVersion && Records::find(stored, id) == r) return;
+        LOG(D, "%s: field %d changed", key, id);
+        changed++;
+      });
+      if (sameVersion) {
+        // fields this build no longer writes
+        Records::walk(stored, [&](uint8_t id, const Records::record_t&) {
+          if (!Records::find(next, id).data) changed++;
+        });
+      }
+      return changed;
+    }
+
+    nvs_handle& handle;
+    const char* key;
+    uint8_t version;
+    std::vector<migrationStep_t> migrations;
+    std::vector<uint8_t> stored;
+  };
+}
@@ -0,0 +1,158 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <mbedtls/ecdh.h>
+#include <mbedtls/ecdsa.h>
+#include <mbedtls/gcm.h>
+#include <mbedtls/md.h>
+#include <mbedtls/sha256.h>
+#ifdef MBEDTLS_HKDF_C
+#include <mbedtls/hkdf.h>
+#endif
+#include <sodium.h>
+#include "hk_crypto.h"
+
+/**
+ * Timings of the primitives the HomeKey flows are built from, for every backend linked in:
+ * SHA-256 (getHashIdentifier, X9.63 KDF), HMAC/HKDF-SHA256 (FAST cryptogram and session keys),
+ * AES-GCM (secure channel), P-256 key generation/ECDH/ECDSA (STANDARD and ATTESTATION) and
+ * Ed25519/X25519 from libsodium. Plain C++ on top of mbedtls and libsodium, so the same code
+ * runs from the C command on the device and from tools/crypto_bench.cpp on a host.
+ * Each result is one JSON line, the fields never change order so runs can be diffed.
+ * checkSha256() adds the parity line: hkCrypto::Sha256 against its known answer and libsodium.
+ */
+namespace cryptoBench {
+  struct result_t {
+    const char* primitive;
+    const char* backend;
+    size_t bytes; // input size, 0 where it doesn't apply
+    uint32_t iterations;
+    double usPerOp;
+  };
+  typedef std::function<void(const result_t&)> emit_t;
+
+  inline int toJson(char* out, size_t size, const result_t& r) {
+    return snprintf(out, size, "{\"primitive\":\"%s\",\"backend\":\"%s\",\"bytes\":%u,\"iterations\":%u,\"us_per_op\":%.2f}",
+      r.primitive, r.backend, unsigned(r.bytes), unsigned(r.iterations), r.usPerOp);
+  }
+
+  struct check_t {
+    bool knownAnswer;
+    bool parity; // same digest as libsodium for getHashIdentifier's input
+  };
+
+  inline int toJson(char* out, size_t size, const check_t& c) {
+    return snprintf(out, size, "{\"selftest\":\"sha256\",\"backend\":\"mbedtls\",\"known_answer\":%s,\"parity\":%s}",
+      c.knownAnswer ? "true" : "false", c.parity ? "true" : "false");
+  }
+
+  inline check_t checkSha256() {
+    if (sodium_init() < 0) return { hkCrypto::knownAnswer(), false };
+    uint8_t input[46] = "key-identifier";
+    randombytes_buf(input + 14, 32);
+    uint8_t digest[32], reference[32];
+    hkCrypto::Sha256().update(input, sizeof(input)).finish(digest);
+    crypto_hash_sha256(reference, input, sizeof(input));
+    return { hkCrypto::knownAnswer(), !memcmp(digest, reference, sizeof(digest)) };
+  }
+
+  inline int rng(void*, unsigned char* out, size_t len) {
+    randombytes_buf(out, len);
+    return 0;
+  }
+
+  template <typename F>
+  void time(const emit_t& emit, const char* primitive, const char* backend, size_t bytes, uint32_t iterations, F&& op) {
+    op(); // first call pays for table setup and hardware wake-up
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < iterations; i++) op();
+    double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    emit({ primitive, backend, bytes, iterations, us / iterations });
+  }
+
+  /// Runs every primitive, `fast` iterations for hashes and ciphers, `slow` for public key operations
+  inline void run(const emit_t& emit, uint32_t fast = 1000, uint32_t slow = 20) {
+    if (sodium_init() < 0) return;
+    uint8_t key[32], data[256], out[64], tag[16], nonce[12];
+    randombytes_buf(key, sizeof(key));
+    randombytes_buf(data, sizeof(data));
+    randombytes_buf(nonce, sizeof(nonce));
+    // getHashIdentifier hashes "key-identifier" followed by a 32 byte controller key
+    constexpr size_t ID_INPUT = 14 + 32;
+
+    for (size_t len : { ID_INPUT, sizeof(data) }) {
+      const char* name = len == ID_INPUT ? "sha256_hash_identifier" : "sha256";
+      time(emit, name, "mbedtls", len, fast, [&] { mbedtls_sha256(data, len, out, 0); });
+      time(emit, name, "libsodium", len, fast, [&] { crypto_hash_sha256(out, data, len); });
+    }
+
+    const mbedtls_md_info_t* md = mbedtls_md_info_from_type(MBEDTLS_MD_SHA256);
+    time(emit, "hmac_sha256", "mbedtls", 64, fast, [&] { mbedtls_md_hmac(md, key, sizeof(key), data, 64, out); });
+    time(emit, "hmac_sha256", "libsodium", 64, fast, [&] { crypto_auth_hmacsha256(out, data, 64, key); });
+#ifdef MBEDTLS_HKDF_C
+    time(emit, "hkdf_sha256", "mbedtls", 32, fast, [&] { mbedtls_hkdf(md, nonce, sizeof(nonce), key, sizeof(key), data, 64, out, 64); });
+#endif
+#ifdef crypto_kdf_hkdf_sha256_KEYBYTES
+    time(emit, "hkdf_sha256", "libsodium", 32, fast, [&] {
+      uint8_t prk[crypto_kdf_hkdf_sha256_KEYBYTES];
+      crypto_kdf_hkdf_sha256_extract(prk, nonce, sizeof(nonce), key, sizeof(key));
+      crypto_kdf_hkdf_sha256_expand(out, 64, reinterpret_cast<const char*>(data), 64, prk);
+    });
+#endif
+
+    mbedtls_gcm_context gcm;
+    mbedtls_gcm_init(&gcm);
+    mbedtls_gcm_setkey(&gcm, MBEDTLS_CIPHER_ID_AES, key, 256);
+    uint8_t sealed[sizeof(data)];
+    time(emit, "aes256_gcm_encrypt", "mbedtls", 64, fast, [&] { mbedtls_gcm_crypt_and_tag(&gcm, MBEDTLS_GCM_ENCRYPT, 64, nonce, sizeof(nonce), NULL, 0, data, sealed, sizeof(tag), tag); });
+    time(emit, "aes256_gcm_decrypt", "mbedtls", 64, fast, [&] { mbedtls_gcm_auth_decrypt(&gcm, 64, nonce, sizeof(nonce), NULL, 0, tag, sizeof(tag), sealed, data); });
+    mbedtls_gcm_free(&gcm);
+    // libsodium only has AES-GCM where the CPU has AES-NI, never on an ESP32
+    if (crypto_aead_aes256gcm_is_available()) {
+      uint8_t box[64 + crypto_aead_aes256gcm_ABYTES];
+      unsigned long long boxLen;
+      time(emit, "aes256_gcm_encrypt", "libsodium", 64, fast, [&] { crypto_aead_aes256gcm_encrypt(box, &boxLen, data, 64, NULL, 0, NULL, nonce, key); });
+    }
+
+    mbedtls_ecp_group grp;
+    mbedtls_mpi d, peerD, z, r, s;
+    mbedtls_ecp_point q, peerQ;
+    mbedtls_ecp_group_init(&grp);
+    mbedtls_mpi_init(&d);
+    mbedtls_mpi_init(&peerD);
+    mbedtls_mpi_init(&z);
+    mbedtls_mpi_init(&r);
+    mbedtls_mpi_init(&s);
+    mbedtls_ecp_point_init(&q);
+    mbedtls_ecp_point_init(&peerQ);
+    mbedtls_ecp_group_load(&grp, MBEDTLS_ECP_DP_SECP256R1);
+    mbedtls_ecp_gen_keypair(&grp, &peerD, &peerQ, rng, NULL);
+    time(emit, "p256_keygen", "mbedtls", 0, slow, [&] { mbedtls_ecp_gen_keypair(&grp, &d, &q, rng, NULL); });
+    time(emit, "p256_ecdh", "mbedtls", 0, slow, [&] { mbedtls_ecdh_compute_shared(&grp, &z, &peerQ, &d, rng, NULL); });
+    mbedtls_sha256(data, sizeof(data), out, 0);
+    time(emit, "p256_ecdsa_sign", "mbedtls", 32, slow, [&] { mbedtls_ecdsa_sign(&grp, &r, &s, &d, out, 32, rng, NULL); });
+    time(emit, "p256_ecdsa_verify", "mbedtls", 32, slow, [&] { mbedtls_ecdsa_verify(&grp, out, 32, &q, &r, &s); });
+    mbedtls_ecp_point_free(&q);
+    mbedtls_ecp_point_free(&peerQ);
+    mbedtls_mpi_free(&d);
+    mbedtls_mpi_free(&peerD);
+    mbedtls_mpi_free(&z);
+    mbedtls_mpi_free(&r);
+    mbedtls_mpi_free(&s);
+    mbedtls_ecp_group_free(&grp);
+
+    uint8_t signPk[crypto_sign_PUBLICKEYBYTES], signSk[crypto_sign_SECRETKEYBYTES], sig[crypto_sign_BYTES];
+    crypto_sign_keypair(signPk, signSk);
+    time(emit, "ed25519_sign", "libsodium", 64, slow, [&] { crypto_sign_detached(sig, NULL, data, 64, signSk); });
+    time(emit, "ed25519_verify", "libsodium", 64, slow, [&] { crypto_sign_verify_detached(sig, data, 64, signPk); });
+    uint8_t boxPk[crypto_box_PUBLICKEYBYTES], boxSk[crypto_box_SECRETKEYBYTES], shared[crypto_scalarmult_BYTES];
+    crypto_box_keypair(boxPk, boxSk);
+    time(emit, "x25519_ecdh", "libsodium", 0, slow, [&] { (void)crypto_scalarmult(shared, boxSk, boxPk); });
+    sodium_memzero(key, sizeof(key));
+    sodium_memzero(signSk, sizeof(signSk));
+    sodium_memzero(boxSk, sizeof(boxSk));
+  }
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include "tap_event.h"
+
+namespace eventStream {
+  struct event_t {
+    const char* name; // string literal, SSE event type
+    uint32_t id;
+    char data[tapEvent::MAX_SIZE];
+  };
+
+  /**
+   * Events waiting for the web dispatcher. Producers are the NFC, actuator and HomeSpan tasks and a
+   * push is a copy into a fixed slot, when the ring is full the oldest event is overwritten so a slow
+   * or stuck browser only ever costs lost events, never a blocked producer.
+   */
+  template <size_t N>
+  class EventRing
+  {
+  public:
+    void push(const char* name, const char* data) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (count == N) {
+        head = (head + 1) % N;
+        count--;
+        dropped++;
+      }
+      event_t& ev = slots[(head + count) % N];
+      ev.name = name;
+      ev.id = ++lastId;
+      strncpy(ev.data, data, sizeof(ev.data) - 1);
+      ev.data[sizeof(ev.data) - 1] = '\0';
+      count++;
+    }
+    bool pop(event_t& out) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (count == 0) return false;
+      out = slots[head];
+      head = (head + 1) % N;
+      count--;
+      return true;
+    }
+    void clear() {
+      std::lock_guard<std::mutex> lock(mutex);
+      head = count = 0;
+    }
+    uint32_t droppedCount() const { return dropped; }
+
+  private:
+    std::mutex mutex;
+    std::array<event_t, N> slots;
+    size_t head = 0;
+    size_t count = 0;
+    uint32_t lastId = 0;
+    uint32_t dropped = 0;
+  };
+}
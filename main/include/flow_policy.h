@@ -0,0 +1,116 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include "HomeKey.h"
+#include "hk_index.h"
+
+/**
+ * Chooses the flow requested from HKAuthenticationContext for each tap and keeps round trip and
+ * byte counts per flow. The device only identifies itself during authentication, so what is
+ * learned per endpoint can't pick the flow up front. The policy instead asks for the cheapest
+ * flow that can succeed:
+ * - FAST when at least one endpoint holds a persistent key, STANDARD otherwise since FAST
+ *   can't match anything and the library would fall back anyway
+ * - one level higher after a failed tap, for a retry within ESCALATE_WINDOW_MS, back to the
+ *   cheapest flow after a success or once the window passed
+ * Setting a flow through the F command pins it and turns the policy off.
+ * Per endpoint stats are dropped through prune() once the endpoint is no longer in readerData.
+ */
+namespace flowPolicy {
+  constexpr uint32_t ESCALATE_WINDOW_MS = 10000;
+  constexpr std::array<const char*, 3> flowNames = { "fast", "standard", "attestation" };
+
+  struct counters_t {
+    uint32_t taps = 0;
+    uint32_t rounds = 0;
+    uint64_t bytes = 0;
+  };
+  struct endpoint_t {
+    KeyFlow lastFlow = kFlowFailed;
+    std::array<uint32_t, 3> successes = {};
+  };
+
+  class FlowPolicy
+  {
+  public:
+    // The F command runs on the HomeSpan task, choose() on the NFC task
+    void pin(KeyFlow flow) { pinned.store(flow, std::memory_order_relaxed); }
+    void unpin() { pinned.store(kFlowFailed, std::memory_order_relaxed); }
+    bool adaptive() const { return pinned.load(std::memory_order_relaxed) == kFlowFailed; }
+
+    /// `index` is the pinned version's, it knows whether any endpoint holds a persistent key
+    KeyFlow choose(const hkIndex::IssuerIndex& index, uint32_t nowMs) {
+      KeyFlow fixed = pinned.load(std::memory_order_relaxed);
+      if (fixed != kFlowFailed) return requested = fixed;
+      KeyFlow base = index.hasPersistentKey() ? kFlowFAST : kFlowSTANDARD;
+      if (floor != kFlowFAST && nowMs - failedAtMs > ESCALATE_WINDOW_MS) floor = kFlowFAST;
+      requested = std::max(base, floor);
+      return requested;
+    }
+
+    // Per APDU of the current tap, including SELECT
+    void exchanged(uint16_t sent, uint16_t received) {
+      tap.rounds++;
+      tap.bytes += sent + received;
+    }
+
+    void finish(KeyFlow flow, const std::vector<uint8_t>& endpointId, uint32_t nowMs) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (flow == kFlowFailed) {
+        failed.taps++;
+        failed.rounds += tap.rounds;
+        failed.bytes += tap.bytes;
+        if (adaptive()) {
+          floor = KeyFlow(std::min<int>(requested + 1, kFlowATTESTATION));
+          failedAtMs = nowMs;
+        }
+      } else if (flow <= kFlowATTESTATION) {
+        counters_t& c = perFlow[flow];
+        c.taps++;
+        c.rounds += tap.rounds;
+        c.bytes += tap.bytes;
+        endpoint_t& ep = endpoints[hkIndex::idKey(endpointId)];
+        ep.lastFlow = flow;
+        ep.successes[flow]++;
+        floor = kFlowFAST;
+      }
+      tap = {};
+    }
+    // Drops the counters of a tap that turned out not to be a HomeKey
+    void discard() { tap = {}; }
+
+    // Copies for the web server and console, finish() runs on the NFC task
+    counters_t flowCounters(KeyFlow flow) {
+      std::lock_guard<std::mutex> lock(mutex);
+      return perFlow[flow];
+    }
+    counters_t failedCounters() {
+      std::lock_guard<std::mutex> lock(mutex);
+      return failed;
+    }
+    std::map<uint64_t, endpoint_t> endpointStats() {
+      std::lock_guard<std::mutex> lock(mutex);
+      return endpoints;
+    }
+    /// Drops the stats of endpoints `index` doesn't have, after issuers or endpoints were removed
+    void prune(const hkIndex::IssuerIndex& index) {
+      std::lock_guard<std::mutex> lock(mutex);
+      std::erase_if(endpoints, [&](const auto& entry) { return !index.hasEndpoint(entry.first); });
+    }
+
+  private:
+    std::atomic<KeyFlow> pinned{ kFlowFailed };
+    KeyFlow requested = kFlowFAST;
+    KeyFlow floor = kFlowFAST;
+    uint32_t failedAtMs = 0;
+    counters_t tap;
+    std::array<counters_t, 3> perFlow;
+    counters_t failed;
+    std::map<uint64_t, endpoint_t> endpoints;
+    std::mutex mutex;
+  };
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <mbedtls/sha256.h>
+
+/**
+ * SHA-256 for the hashing main.cpp does itself. mbedtls goes to the SHA accelerator when
+ * CONFIG_MBEDTLS_HARDWARE_SHA is set (sdkconfig.defaults, every ESP32 target has one) and is plain
+ * software on a host. The HomeKey flows in HK-HomeKit-Lib call mbedtls directly and get the
+ * accelerators through the same sdkconfig options; the C command compares them with libsodium.
+ */
+namespace hkCrypto {
+  class Sha256
+  {
+  public:
+    Sha256() {
+      mbedtls_sha256_init(&ctx);
+      mbedtls_sha256_starts(&ctx, 0);
+    }
+    ~Sha256() { mbedtls_sha256_free(&ctx); }
+    Sha256& update(const uint8_t* data, size_t len) {
+      mbedtls_sha256_update(&ctx, data, len);
+      return *this;
+    }
+    void finish(uint8_t out[32]) { mbedtls_sha256_finish(&ctx, out); }
+
+  private:
+    mbedtls_sha256_context ctx;
+  };
+
+  /// FIPS 180-2 "abc" through Sha256, a single hash to catch a broken accelerator at boot
+  inline bool knownAnswer() {
+    constexpr std::array<uint8_t, 32> abcDigest = { 0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea, 0x41, 0x41, 0x40, 0xde, 0x5d, 0xae, 0x22, 0x23,
+      0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c, 0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad };
+    uint8_t digest[32];
+    Sha256().update(reinterpret_cast<const uint8_t*>("abc"), 3).finish(digest);
+    return !memcmp(digest, abcDigest.data(), sizeof(digest));
+  }
+}
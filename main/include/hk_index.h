@@ -0,0 +1,151 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "HomeKey.h"
+
+namespace hkIndex {
+  // Issuer and endpoint identifiers are at most 8 bytes, packed into an integer they compare in one go
+  inline uint64_t idKey(const uint8_t* id, size_t len) {
+    uint64_t key = 0;
+    memcpy(&key, id, std::min<size_t>(len, sizeof(key)));
+    return key;
+  }
+  inline uint64_t idKey(const std::vector<uint8_t>& id) { return idKey(id.data(), id.size()); }
+
+  /**
+   * Sorted flat arrays keyed by issuer_id/endpoint_id pointing back into readerData.
+   * Positions are only valid for the data the index was built from, every version in
+   * reader_state.h gets its own.
+   */
+  class IssuerIndex
+  {
+  public:
+    void rebuild(const readerData_t& data) {
+      issuers.clear();
+      endpoints.clear();
+      persistentKeys = 0;
+      issuers.reserve(data.issuers.size());
+      for (uint16_t i = 0; i < data.issuers.size(); i++) {
+        issuers.push_back({ idKey(data.issuers[i].issuer_id), i });
+        for (uint16_t j = 0; j < data.issuers[i].endpoints.size(); j++) {
+          endpoints.push_back({ idKey(data.issuers[i].endpoints[j].endpoint_id), i, j });
+          if (!data.issuers[i].endpoints[j].endpoint_prst_k.empty()) persistentKeys++;
+        }
+      }
+      std::sort(issuers.begin(), issuers.end());
+      std::sort(endpoints.begin(), endpoints.end());
+    }
+    const hkIssuer_t* findIssuer(const readerData_t& data, const uint8_t* id, size_t len) const {
+      int i = issuerPos(data, idKey(id, len));
+      return i < 0 ? nullptr : &data.issuers[i];
+    }
+    hkIssuer_t* findIssuer(readerData_t& data, const uint8_t* id, size_t len) const {
+      int i = issuerPos(data, idKey(id, len));
+      return i < 0 ? nullptr : &data.issuers[i];
+    }
+    /// First endpoint with `id` under any issuer
+    const hkEndpoint_t* findEndpoint(const readerData_t& data, const uint8_t* id, size_t len) const { return at(data, endpointPos(data, idKey(id, len), -1)); }
+    hkEndpoint_t* findEndpoint(readerData_t& data, const uint8_t* id, size_t len) const { return at(data, endpointPos(data, idKey(id, len), -1)); }
+    /// The endpoint with `endpointId` under the issuer with `issuerId`
+    const hkEndpoint_t* findEndpoint(const readerData_t& data, const std::vector<uint8_t>& issuerId, const std::vector<uint8_t>& endpointId) const {
+      return at(data, endpointPos(data, issuerId, endpointId));
+    }
+    hkEndpoint_t* findEndpoint(readerData_t& data, const std::vector<uint8_t>& issuerId, const std::vector<uint8_t>& endpointId) const {
+      return at(data, endpointPos(data, issuerId, endpointId));
+    }
+    /// Whether any issuer has an endpoint with this idKey
+    bool hasEndpoint(uint64_t key) const {
+      auto it = std::lower_bound(endpoints.begin(), endpoints.end(), endpointRef_t{ key, 0, 0 });
+      return it != endpoints.end() && it->id == key;
+    }
+    size_t issuerCount() const { return issuers.size(); }
+    size_t endpointCount() const { return endpoints.size(); }
+    /// Whether any endpoint holds a persistent key, what FAST needs to succeed
+    bool hasPersistentKey() const { return persistentKeys > 0; }
+
+  private:
+    struct issuerRef_t {
+      uint64_t id;
+      uint16_t issuer;
+      bool operator<(const issuerRef_t& o) const { return id < o.id || (id == o.id && issuer < o.issuer); }
+    };
+    struct endpointRef_t {
+      uint64_t id;
+      uint16_t issuer;
+      uint16_t endpoint;
+      bool operator<(const endpointRef_t& o) const { return id < o.id || (id == o.id && (issuer < o.issuer || (issuer == o.issuer && endpoint < o.endpoint))); }
+    };
+    struct ref_t {
+      int issuer;
+      int endpoint;
+    };
+
+    // Position in data.issuers, -1 if there's no such issuer
+    int issuerPos(const readerData_t& data, uint64_t key) const {
+      auto it = std::lower_bound(issuers.begin(), issuers.end(), issuerRef_t{ key, 0 });
+      if (it == issuers.end() || it->id != key || it->issuer >= data.issuers.size()) return -1;
+      return it->issuer;
+    }
+    // Position of the endpoint, under `issuer` unless that's -1, { -1, -1 } if there's none
+    ref_t endpointPos(const readerData_t& data, uint64_t key, int issuer) const {
+      auto it = std::lower_bound(endpoints.begin(), endpoints.end(), endpointRef_t{ key, uint16_t(std::max(issuer, 0)), 0 });
+      if (it == endpoints.end() || it->id != key || (issuer >= 0 && it->issuer != issuer)) return { -1, -1 };
+      if (it->issuer >= data.issuers.size() || it->endpoint >= data.issuers[it->issuer].endpoints.size()) return { -1, -1 };
+      return { it->issuer, it->endpoint };
+    }
+    ref_t endpointPos(const readerData_t& data, const std::vector<uint8_t>& issuerId, const std::vector<uint8_t>& endpointId) const {
+      int issuer = issuerPos(data, idKey(issuerId));
+      return issuer < 0 ? ref_t{ -1, -1 } : endpointPos(data, idKey(endpointId), issuer);
+    }
+    // The endpoint at `r` in data or const data
+    template <typename Data>
+    static auto at(Data& data, ref_t r) -> decltype(&data.issuers[0].endpoints[0]) {
+      return r.issuer < 0 ? nullptr : &data.issuers[r.issuer].endpoints[r.endpoint];
+    }
+
+    std::vector<issuerRef_t> issuers;
+    std::vector<endpointRef_t> endpoints;
+    size_t persistentKeys = 0;
+  };
+
+  /// Remembers the issuer identifier derived from each controller's LTPK so pairing events don't re-hash them.
+  /// Callers walk the whole controller list and sweep() afterwards, which drops the controllers that are
+  /// gone, so the cache never holds more than the paired controllers.
+  class ControllerIdCache
+  {
+  public:
+    template <typename F>
+    const std::array<uint8_t, 8>& get(const uint8_t* ltpk, F&& hash) {
+      for (auto&& entry : entries) {
+        if (!memcmp(entry.ltpk.data(), ltpk, entry.ltpk.size())) {
+          entry.seen = true;
+          return entry.id;
+        }
+      }
+      entry_t entry;
+      memcpy(entry.ltpk.data(), ltpk, entry.ltpk.size());
+      std::vector<uint8_t> id = hash(ltpk, entry.ltpk.size());
+      std::copy_n(id.begin(), entry.id.size(), entry.id.begin());
+      entries.push_back(entry);
+      return entries.back().id;
+    }
+    /// Drops the entries get() wasn't called for since the last sweep, references from get() are invalid afterwards
+    void sweep() {
+      entries.erase(std::remove_if(entries.begin(), entries.end(), [](const entry_t& entry) { return !entry.seen; }), entries.end());
+      for (auto&& entry : entries) entry.seen = false;
+    }
+    void clear() { entries.clear(); }
+    size_t size() const { return entries.size(); }
+
+  private:
+    struct entry_t {
+      std::array<uint8_t, 32> ltpk;
+      std::array<uint8_t, 8> id;
+      bool seen = true;
+    };
+    std::vector<entry_t> entries;
+  };
+}
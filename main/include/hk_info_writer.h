@@ -0,0 +1,117 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include "HomeKey.h"
+#include "tap_event.h"
+
+/**
+ * Writes the hkinfo JSON straight from readerData into whatever buffer the chunked response hands
+ * over, one issuer or endpoint at a time, so memory use doesn't depend on how many are enrolled.
+ * `offset`/`limit` page through the issuers, `issuerCount` always has the total.
+ * `data` must be a pinned readerState version kept alive until the last chunk, published versions
+ * never change, so positions stay valid across chunks. Issuers without endpoints are written with
+ * an empty "endpoints" array.
+ */
+class HkInfoWriter
+{
+public:
+  HkInfoWriter(const readerData_t& data, size_t offset, size_t limit) : data(data), issuer(offset), end(limit ? offset + limit : SIZE_MAX) {}
+
+  size_t fill(uint8_t* buf, size_t maxLen) {
+    size_t written = 0;
+    while (written < maxLen) {
+      if (pendingPos == pendingLen && !next()) break;
+      size_t n = std::min(maxLen - written, pendingLen - pendingPos);
+      memcpy(buf + written, pending + pendingPos, n);
+      pendingPos += n;
+      written += n;
+    }
+    return written;
+  }
+
+private:
+  enum phase_t
+  {
+    HEADER,
+    ISSUER,
+    ENDPOINT,
+    ISSUER_END,
+    FOOTER,
+    DONE
+  };
+
+  // Queues the next piece of the document, false once everything was written
+  bool next() {
+    pendingLen = pendingPos = 0;
+    switch (phase) {
+    case HEADER:
+      put("{\"group_identifier\":\"");
+      hex(data.reader_gid);
+      put("\",\"unique_identifier\":\"");
+      hex(data.reader_id);
+      putf("\",\"issuerCount\":%u,\"offset\":%u,\"issuers\":[", unsigned(data.issuers.size()), unsigned(issuer));
+      phase = ISSUER;
+      return true;
+    case ISSUER:
+      if (issuer >= std::min(end, data.issuers.size())) {
+        phase = FOOTER;
+        return next();
+      }
+      put(issuersWritten++ ? ",{\"issuerId\":\"" : "{\"issuerId\":\"");
+      hex(data.issuers[issuer].issuer_id);
+      put("\",\"endpoints\":[");
+      endpoint = 0;
+      phase = ENDPOINT;
+      return true;
+    case ENDPOINT:
+      if (endpoint >= data.issuers[issuer].endpoints.size()) {
+        phase = ISSUER_END;
+        return next();
+      }
+      put(endpoint ? ",{\"endpointId\":\"" : "{\"endpointId\":\"");
+      hex(data.issuers[issuer].endpoints[endpoint].endpoint_id);
+      put("\"}");
+      endpoint++;
+      return true;
+    case ISSUER_END:
+      put("]}");
+      issuer++;
+      phase = ISSUER;
+      return true;
+    case FOOTER:
+      put("]}");
+      phase = DONE;
+      return true;
+    default:
+      return false;
+    }
+  }
+  void put(const char* s) {
+    size_t n = std::min(strlen(s), sizeof(pending) - pendingLen);
+    memcpy(pending + pendingLen, s, n);
+    pendingLen += n;
+  }
+  template <typename... Args>
+  void putf(const char* fmt, Args... args) {
+    int n = snprintf(pending + pendingLen, sizeof(pending) - pendingLen, fmt, args...);
+    if (n > 0) pendingLen = std::min(sizeof(pending) - 1, pendingLen + n);
+  }
+  // Identifiers are 6-8 bytes, anything that wouldn't fit the piece buffer is cut rather than overflowing
+  void hex(const std::vector<uint8_t>& bytes) {
+    size_t n = std::min(bytes.size(), (sizeof(pending) - pendingLen) / 2);
+    tapEvent::hexEncode(pending + pendingLen, bytes.data(), n);
+    pendingLen += n * 2;
+  }
+
+  const readerData_t& data;
+  size_t issuer;
+  size_t end;
+  size_t endpoint = 0;
+  size_t issuersWritten = 0;
+  phase_t phase = HEADER;
+  char pending[160];
+  size_t pendingLen = 0;
+  size_t pendingPos = 0;
+};
@@ -0,0 +1,27 @@
+#pragma once
+#include <map>
+#include <string>
+#include <nlohmann/json.hpp>
+#include "config.h"
+
+namespace espConfig {
+    struct mqttConfig_t {
+        std::string mqttBroker = MQTT_HOST;
+        uint16_t mqttPort = MQTT_PORT;
+        std::string mqttUsername = MQTT_USERNAME;
+        std::string mqttPassword = MQTT_PASSWORD;
+        std::string mqttClientId = "";
+        // Topics left empty are derived from the client id
+        std::string lwtTopic = "";
+        std::string hkTopic = "";
+        std::string lockStateTopic = "";
+        std::string lockCustomStateTopic = "";
+        std::string hkAltActionTopic = "";
+        bool lockEnableCustomState = false;
+        bool hassMqttDiscoveryEnabled = false;
+        bool nfcTagNoPublish = true;
+        std::map<std::string, int> customLockActions = { {"UNLOCK", ::customLockActions::UNLOCK}, {"LOCK", ::customLockActions::LOCK} };
+        NLOHMANN_DEFINE_TYPE_INTRUSIVE_WITH_DEFAULT(mqttConfig_t, mqttBroker, mqttPort, mqttUsername, mqttPassword, mqttClientId, lwtTopic, hkTopic,
+          lockStateTopic, lockCustomStateTopic, hkAltActionTopic, lockEnableCustomState, hassMqttDiscoveryEnabled, nfcTagNoPublish, customLockActions)
+    } mqttData;
+}
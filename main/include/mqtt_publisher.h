@@ -0,0 +1,225 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <mqtt_client.h>
+#include <nlohmann/json.hpp>
+#include "mqtt_config.h"
+#include "tap_event.h"
+#include "logging.h"
+
+namespace mqttPublisher {
+  enum topic_t : uint8_t
+  {
+    HK_AUTH,
+    LOCK_STATE,
+    LOCK_CUSTOM_STATE,
+    ALT_ACTION,
+    STATUS,
+    HASS_TAG,
+    TOPIC_MAX
+  };
+
+  struct message_t {
+    uint32_t seq;
+    topic_t topic;
+    uint8_t qos;
+    bool retain;
+    char payload[tapEvent::MAX_SIZE];
+  };
+
+  /**
+   * Bounded FIFO of fixed-size messages, every operation is a copy under a short lock.
+   * The consumer copies the front and only pops it once the client took it, pop() goes by sequence
+   * number so it's a no-op if a producer already pushed that message out to make room.
+   */
+  template <size_t N>
+  class Outbox
+  {
+  public:
+    // Returns false if the oldest message was dropped to make room
+    bool push(topic_t topic, const char* payload, uint8_t qos, bool retain) {
+      std::lock_guard<std::mutex> lock(mutex);
+      bool dropped = count == N;
+      if (dropped) {
+        head = (head + 1) % N;
+        count--;
+      }
+      message_t& msg = slots[(head + count) % N];
+      msg.seq = ++lastSeq;
+      msg.topic = topic;
+      msg.qos = qos;
+      msg.retain = retain;
+      strncpy(msg.payload, payload, sizeof(msg.payload) - 1);
+      msg.payload[sizeof(msg.payload) - 1] = '\0';
+      count++;
+      return !dropped;
+    }
+    bool front(message_t& out) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (count == 0) return false;
+      out = slots[head];
+      return true;
+    }
+    void pop(uint32_t seq) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (count == 0 || slots[head].seq != seq) return;
+      head = (head + 1) % N;
+      count--;
+    }
+    size_t size() {
+      std::lock_guard<std::mutex> lock(mutex);
+      return count;
+    }
+
+  private:
+    std::mutex mutex;
+    std::array<message_t, N> slots;
+    size_t head = 0;
+    size_t count = 0;
+    uint32_t lastSeq = 0;
+  };
+
+  /**
+   * esp-mqtt client fed from a dedicated task. publish() is what the NFC and actuator tasks call,
+   * it only copies the payload into the outbox and wakes the task, so a slow or unreachable broker
+   * never shows up in tap latency. The task sends everything queued in one pass while connected,
+   * across an outage messages wait in the outbox and go out after the reconnect.
+   * Topics and discovery payloads are built once in begin().
+   */
+  template <size_t N>
+  class Publisher
+  {
+  public:
+    struct stats_t {
+      uint32_t sent;
+      uint32_t dropped;
+      uint32_t failed;
+      size_t queued;
+      bool connected;
+    };
+
+    // Returns false if there is no broker configured or the client couldn't be created
+    bool begin(const espConfig::mqttConfig_t& cfg, const std::string& defaultId) {
+      if (client) return true;
+      if (cfg.mqttBroker.empty()) {
+        LOG(I, "No MQTT broker configured");
+        return false;
+      }
+      std::string id = cfg.mqttClientId.empty() ? defaultId : cfg.mqttClientId;
+      topics[HK_AUTH] = orDefault(cfg.hkTopic, id + "/homekey/auth");
+      topics[LOCK_STATE] = orDefault(cfg.lockStateTopic, id + "/lock/state");
+      topics[LOCK_CUSTOM_STATE] = cfg.lockEnableCustomState ? orDefault(cfg.lockCustomStateTopic, id + "/lock/custom_state") : "";
+      topics[ALT_ACTION] = orDefault(cfg.hkAltActionTopic, id + "/homekey/alt_action");
+      topics[STATUS] = orDefault(cfg.lwtTopic, id + "/status");
+      topics[HASS_TAG] = "homeassistant/tag/" + id + "/rfid/config";
+      hassDiscovery = cfg.hassMqttDiscoveryEnabled;
+      // left empty with tag publishing off, the empty retained payload removes the tag scanner announced before
+      if (hassDiscovery && !cfg.nfcTagNoPublish) {
+        nlohmann::json tag = { {"topic", topics[HK_AUTH]}, {"value_template", "{{ value_json.uid }}"} };
+        tagDiscovery = tag.dump();
+      }
+      esp_mqtt_client_config_t mqttCfg = {};
+      mqttCfg.broker.address.hostname = cfg.mqttBroker.c_str();
+      mqttCfg.broker.address.port = cfg.mqttPort;
+      mqttCfg.broker.address.transport = MQTT_TRANSPORT_OVER_TCP;
+      mqttCfg.credentials.client_id = id.c_str();
+      if (!cfg.mqttUsername.empty()) {
+        mqttCfg.credentials.username = cfg.mqttUsername.c_str();
+        mqttCfg.credentials.authentication.password = cfg.mqttPassword.c_str();
+      }
+      mqttCfg.session.last_will.topic = topics[STATUS].c_str();
+      mqttCfg.session.last_will.msg = "offline";
+      mqttCfg.session.last_will.qos = 1;
+      mqttCfg.session.last_will.retain = 1;
+      client = esp_mqtt_client_init(&mqttCfg);
+      if (!client) {
+        LOG(E, "Could not create the MQTT client");
+        return false;
+      }
+      esp_mqtt_client_register_event(client, MQTT_EVENT_ANY, onEvent, this);
+      xTaskCreate(task, "mqtt_publisher", 4096, this, 1, &taskHandle);
+      esp_mqtt_client_start(client);
+      LOG(I, "MQTT client started for %s:%u as %s", cfg.mqttBroker.c_str(), cfg.mqttPort, id.c_str());
+      return true;
+    }
+
+    void publish(topic_t topic, const char* payload, uint8_t qos = 0, bool retain = false) {
+      if (!taskHandle || !payload) return;
+      if (!outbox.push(topic, payload, qos, retain)) dropped++;
+      xTaskNotifyGive(taskHandle);
+    }
+
+    stats_t stats() { return { sent, dropped, failed, outbox.size(), connected }; }
+
+  private:
+    static constexpr const char* TAG = "mqttPublisher";
+    // How often the task retries on its own after a publish the client refused
+    static constexpr uint32_t RETRY_MS = 1000;
+
+    static std::string orDefault(const std::string& topic, std::string fallback) { return topic.empty() ? fallback : topic; }
+
+    static void onEvent(void* arg, esp_event_base_t base, int32_t eventId, void* eventData) {
+      Publisher* self = static_cast<Publisher*>(arg);
+      switch (static_cast<esp_mqtt_event_id_t>(eventId)) {
+      case MQTT_EVENT_CONNECTED:
+        LOG(I, "MQTT connected");
+        self->connected = true;
+        self->announce = true;
+        xTaskNotifyGive(self->taskHandle);
+        break;
+      case MQTT_EVENT_DISCONNECTED:
+        LOG(W, "MQTT disconnected, %u messages queued", unsigned(self->outbox.size()));
+        self->connected = false;
+        break;
+      default:
+        break;
+      }
+    }
+
+    static void task(void* arg) {
+      static_cast<Publisher*>(arg)->run();
+    }
+
+    void run() {
+      message_t msg;
+      while (1) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(RETRY_MS));
+        if (!connected) continue;
+        if (announce.exchange(false)) {
+          esp_mqtt_client_publish(client, topics[STATUS].c_str(), "online", 0, 1, true);
+          if (hassDiscovery) {
+            esp_mqtt_client_publish(client, topics[HASS_TAG].c_str(), tagDiscovery.c_str(), 0, 1, true);
+          }
+        }
+        while (connected && outbox.front(msg)) {
+          const std::string& topic = topics[msg.topic];
+          if (!topic.empty() && esp_mqtt_client_publish(client, topic.c_str(), msg.payload, 0, msg.qos, msg.retain) < 0) {
+            // stays queued, the next reconnect or retry picks it up
+            failed++;
+            break;
+          }
+          outbox.pop(msg.seq);
+          sent++;
+        }
+      }
+    }
+
+    Outbox<N> outbox;
+    std::array<std::string, TOPIC_MAX> topics;
+    std::string tagDiscovery;
+    bool hassDiscovery = false;
+    esp_mqtt_client_handle_t client = nullptr;
+    TaskHandle_t taskHandle = nullptr;
+    std::atomic<bool> connected{ false };
+    std::atomic<bool> announce{ false };
+    std::atomic<uint32_t> sent{ 0 };
+    std::atomic<uint32_t> dropped{ 0 };
+    std::atomic<uint32_t> failed{ 0 };
+  };
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace nfcFrame {
+  // ISO/IEC 14443-3 CRC_A: reflected CRC-16 (poly 0x8408), initial value 0x6363
+  constexpr std::array<uint16_t, 256> crcATable = [] {
+    std::array<uint16_t, 256> table = {};
+    for (uint16_t i = 0; i < 256; i++) {
+      uint16_t crc = i;
+      for (int bit = 0; bit < 8; bit++) crc = (crc & 1) ? (crc >> 1) ^ 0x8408 : crc >> 1;
+      table[i] = crc;
+    }
+    return table;
+  }();
+
+  constexpr uint16_t crcA(const uint8_t* data, size_t len, uint16_t crc = 0x6363) {
+    for (size_t i = 0; i < len; i++) crc = (crc >> 8) ^ crcATable[(crc ^ data[i]) & 0xFF];
+    return crc;
+  }
+
+  // Check values from the CRC catalogue ("123456789") and ISO/IEC 14443-3 annex B (0x00 0x00)
+  constexpr std::array<uint8_t, 9> crcACheck = { '1', '2', '3', '4', '5', '6', '7', '8', '9' };
+  constexpr std::array<uint8_t, 2> crcAZeroes = { 0x00, 0x00 };
+  static_assert(crcA(crcACheck.data(), crcACheck.size()) == 0xBF05, "CRC_A table is broken");
+  static_assert(crcA(crcAZeroes.data(), crcAZeroes.size()) == 0x1EA0, "CRC_A table is broken");
+
+  /// Short APDU (case 2/4) with the command data and Le known at compile time
+  template <size_t LC>
+  constexpr std::array<uint8_t, LC + 6> apdu(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, const std::array<uint8_t, LC>& data, uint8_t le) {
+    std::array<uint8_t, LC + 6> out = { cla, ins, p1, p2, static_cast<uint8_t>(LC) };
+    for (size_t i = 0; i < LC; i++) out[5 + i] = data[i];
+    out[5 + LC] = le;
+    return out;
+  }
+
+  // InListPassiveTarget for one target at 106 kbps type A, PN532 user manual 7.3.5
+  constexpr std::array<uint8_t, 3> inListPassiveTarget = { 0x4A, 0x01, 0x00 };
+  // ACK frame, from the host it aborts the command the PN532 is still processing (user manual 6.2.1.3)
+  constexpr std::array<uint8_t, 6> ackFrame = { 0x00, 0x00, 0xFF, 0x00, 0xFF, 0x00 };
+
+  /// Target of an InListPassiveTarget response without the response code: NbTg, Tg, SENS_RES (2), SEL_RES, NFCIDLength, NFCID
+  inline bool inListTarget(const uint8_t* res, int16_t len, uint8_t* uid, uint8_t uidCapacity, uint8_t* uidLen, uint8_t* atqa, uint8_t* sak) {
+    if (len < 6 || res[0] != 1 || res[5] > uidCapacity || len < 6 + res[5]) return false;
+    atqa[0] = res[2];
+    atqa[1] = res[3];
+    sak[0] = res[4];
+    *uidLen = res[5];
+    memcpy(uid, res + 6, res[5]);
+    return true;
+  }
+
+  constexpr std::array<uint8_t, 7> homeKeyAid = { 0xA0, 0x00, 0x00, 0x08, 0x58, 0x01, 0x01 };
+  // SELECT by name, first or only occurrence, Le = 256
+  constexpr auto selectHomeKey = apdu(0x00, 0xA4, 0x04, 0x00, homeKeyAid, 0x00);
+
+  /**
+   * Enhanced Contactless Polling frame announcing a HomeKey reader, so iPhones and Watches
+   * bring up the matching pass without the user opening Wallet. Only the reader group identifier
+   * varies, the frame and its CRC are rebuilt when that changes.
+   */
+  class EcpFrame
+  {
+  public:
+    static constexpr size_t GID_SIZE = 8;
+    static constexpr size_t SIZE = 8 + GID_SIZE + 2;
+
+    EcpFrame() { build(); }
+    // Returns true if the frame changed
+    bool update(const std::vector<uint8_t>& gid) {
+      uint8_t next[GID_SIZE] = {};
+      memcpy(next, gid.data(), gid.size() < GID_SIZE ? gid.size() : GID_SIZE);
+      if (!memcmp(next, frame.data() + HEADER_SIZE, GID_SIZE)) return false;
+      memcpy(frame.data() + HEADER_SIZE, next, GID_SIZE);
+      build();
+      return true;
+    }
+    uint8_t* data() { return frame.data(); }
+    constexpr size_t size() const { return SIZE; }
+
+  private:
+    static constexpr size_t HEADER_SIZE = 8;
+    // ECP command and version 2 followed by the HomeKey terminal type and data
+    static constexpr std::array<uint8_t, HEADER_SIZE> header = { 0x6A, 0x02, 0xCB, 0x02, 0x06, 0x02, 0x11, 0x00 };
+    void build() {
+      memcpy(frame.data(), header.data(), HEADER_SIZE);
+      uint16_t crc = crcA(frame.data(), HEADER_SIZE + GID_SIZE);
+      frame[SIZE - 2] = crc & 0xFF;
+      frame[SIZE - 1] = crc >> 8;
+    }
+    std::array<uint8_t, SIZE> frame = {};
+  };
+}
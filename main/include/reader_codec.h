@@ -0,0 +1,200 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "HomeKey.h"
+
+/**
+ * Compact binary encoding of the reader data records.
+ * Every record starts with the format version and its type. Byte fields are stored raw behind a
+ * two byte length and integers little-endian, so keys and identifiers take their own size instead
+ * of msgpack's integer arrays and decoding fills the structs directly without a json tree.
+ * Every field of the HomeKey.h structs is encoded, the layout asserts below stop the build when
+ * the library adds one.
+ */
+namespace readerCodec {
+  constexpr uint8_t VERSION = 1;
+  enum record_t : uint8_t
+  {
+    META = 'M',
+    ISSUER = 'I',
+    ENDPOINT = 'E'
+  };
+
+  class Writer
+  {
+  public:
+    Writer(record_t type, size_t reserve) {
+      buf.reserve(reserve);
+      buf.push_back(VERSION);
+      buf.push_back(type);
+    }
+    void bytes(const std::vector<uint8_t>& v) {
+      if (v.size() > UINT16_MAX) {
+        ok = false;
+        return;
+      }
+      u16(v.size());
+      buf.insert(buf.end(), v.begin(), v.end());
+    }
+    void u16(uint16_t v) {
+      buf.push_back(v & 0xFF);
+      buf.push_back(v >> 8);
+    }
+    void u32(uint32_t v) {
+      for (int i = 0; i < 4; i++) buf.push_back((v >> (i * 8)) & 0xFF);
+    }
+    // Empty if a field didn't fit its length prefix, a record is never written truncated
+    std::vector<uint8_t> finish() { return ok ? std::move(buf) : std::vector<uint8_t>(); }
+
+  private:
+    std::vector<uint8_t> buf;
+    bool ok = true;
+  };
+
+  class Reader
+  {
+  public:
+    Reader(const uint8_t* data, size_t len, record_t type) : p(data), end(data + len) {
+      ok = len >= 2 && data[0] == VERSION && data[1] == type;
+      p += 2;
+    }
+    void bytes(std::vector<uint8_t>& v) {
+      uint16_t len = u16();
+      if (!need(len)) return;
+      v.assign(p, p + len);
+      p += len;
+    }
+    uint16_t u16() {
+      if (!need(2)) return 0;
+      uint16_t v = p[0] | (p[1] << 8);
+      p += 2;
+      return v;
+    }
+    uint32_t u32() {
+      if (!need(4)) return 0;
+      uint32_t v = 0;
+      for (int i = 0; i < 4; i++) v |= static_cast<uint32_t>(p[i]) << (i * 8);
+      p += 4;
+      return v;
+    }
+    // A record is only valid if every field was present and nothing was left over
+    bool valid() const { return ok && p == end; }
+
+  private:
+    bool need(size_t n) {
+      if (!ok || static_cast<size_t>(end - p) < n) ok = false;
+      return ok;
+    }
+    const uint8_t* p;
+    const uint8_t* end;
+    bool ok;
+  };
+
+  // Field for field copies of the HomeKey.h structs as this codec knows them
+  namespace layout {
+    struct enrollment_t {
+      uint32_t unixTime;
+      std::vector<uint8_t> payload;
+    };
+    struct endpoint_t {
+      std::vector<uint8_t> id;
+      uint32_t lastUsedAt;
+      int counter;
+      int keyType;
+      std::vector<uint8_t> pk, pkX, prstK;
+      enrollment_t hap, attestation;
+    };
+    struct issuer_t {
+      std::vector<uint8_t> id, pk, pkX;
+      std::vector<hkEndpoint_t> endpoints;
+    };
+    struct reader_t {
+      std::vector<uint8_t> sk, pk, pkX, gid, id;
+      std::vector<hkIssuer_t> issuers;
+    };
+  }
+  static_assert(sizeof(hkEnrollment_t) == sizeof(layout::enrollment_t), "hkEnrollment_t changed, update the reader data codec");
+  static_assert(sizeof(hkEndpoint_t) == sizeof(layout::endpoint_t), "hkEndpoint_t changed, update encodeEndpoint/decodeEndpoint");
+  static_assert(sizeof(hkIssuer_t) == sizeof(layout::issuer_t), "hkIssuer_t changed, update encodeIssuer/decodeIssuer");
+  static_assert(sizeof(readerData_t) == sizeof(layout::reader_t), "readerData_t changed, update encodeMeta/decodeMeta");
+
+  inline void enrollment(Writer& w, const hkEnrollment_t& e) {
+    w.u32(e.unixTime);
+    w.bytes(e.payload);
+  }
+  inline void enrollment(Reader& r, hkEnrollment_t& e) {
+    e.unixTime = r.u32();
+    r.bytes(e.payload);
+  }
+
+  inline std::vector<uint8_t> encodeEndpoint(const hkEndpoint_t& e) {
+    Writer w(ENDPOINT, 200 + e.enrollments.hap.payload.size() + e.enrollments.attestation.payload.size());
+    w.bytes(e.endpoint_id);
+    w.u32(e.last_used_at);
+    w.u32(e.counter);
+    w.u32(e.key_type);
+    w.bytes(e.endpoint_pk);
+    w.bytes(e.endpoint_pk_x);
+    w.bytes(e.endpoint_prst_k);
+    enrollment(w, e.enrollments.hap);
+    enrollment(w, e.enrollments.attestation);
+    return w.finish();
+  }
+  inline bool decodeEndpoint(const std::vector<uint8_t>& buf, hkEndpoint_t& e) {
+    Reader r(buf.data(), buf.size(), ENDPOINT);
+    r.bytes(e.endpoint_id);
+    e.last_used_at = r.u32();
+    e.counter = r.u32();
+    e.key_type = r.u32();
+    r.bytes(e.endpoint_pk);
+    r.bytes(e.endpoint_pk_x);
+    r.bytes(e.endpoint_prst_k);
+    enrollment(r, e.enrollments.hap);
+    enrollment(r, e.enrollments.attestation);
+    return r.valid();
+  }
+
+  // Issuer and meta records list the slots of their children instead of embedding them
+  inline std::vector<uint8_t> encodeIssuer(const hkIssuer_t& i, const std::vector<uint16_t>& endpointSlots) {
+    Writer w(ISSUER, 128 + endpointSlots.size() * 2);
+    w.bytes(i.issuer_id);
+    w.bytes(i.issuer_pk);
+    w.bytes(i.issuer_pk_x);
+    w.u16(endpointSlots.size());
+    for (uint16_t slot : endpointSlots) w.u16(slot);
+    return w.finish();
+  }
+  inline bool decodeIssuer(const std::vector<uint8_t>& buf, hkIssuer_t& i, std::vector<uint16_t>& endpointSlots) {
+    Reader r(buf.data(), buf.size(), ISSUER);
+    r.bytes(i.issuer_id);
+    r.bytes(i.issuer_pk);
+    r.bytes(i.issuer_pk_x);
+    endpointSlots.resize(r.u16());
+    for (auto&& slot : endpointSlots) slot = r.u16();
+    return r.valid();
+  }
+
+  inline std::vector<uint8_t> encodeMeta(const readerData_t& d, const std::vector<uint16_t>& issuerSlots) {
+    Writer w(META, 192 + issuerSlots.size() * 2);
+    w.bytes(d.reader_sk);
+    w.bytes(d.reader_pk);
+    w.bytes(d.reader_pk_x);
+    w.bytes(d.reader_gid);
+    w.bytes(d.reader_id);
+    w.u16(issuerSlots.size());
+    for (uint16_t slot : issuerSlots) w.u16(slot);
+    return w.finish();
+  }
+  inline bool decodeMeta(const std::vector<uint8_t>& buf, readerData_t& d, std::vector<uint16_t>& issuerSlots) {
+    Reader r(buf.data(), buf.size(), META);
+    r.bytes(d.reader_sk);
+    r.bytes(d.reader_pk);
+    r.bytes(d.reader_pk_x);
+    r.bytes(d.reader_gid);
+    r.bytes(d.reader_id);
+    issuerSlots.resize(r.u16());
+    for (auto&& slot : issuerSlots) slot = r.u16();
+    return r.valid();
+  }
+}
@@ -0,0 +1,134 @@
+#pragma once
+#include <algorithm>
+#include <cinttypes>
+#include <cstdint>
+#include <mutex>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "HomeKey.h"
+#include "reader_state.h"
+#include "reader_store.h"
+#include "tap_trace.h"
+#include "logging.h"
+
+/**
+ * Write-behind saving of readerData. A tap only hands over the version it published and marks it
+ * dirty, a low priority task saves the latest one once no tap has marked it for `delayMs`. Taps in
+ * quick succession end up as a single save, and erasing or committing flash never delays the lock.
+ * flush() saves right away from the calling task, used outside the tap path and on shutdown.
+ * A save never replaces flash content from a newer version, and a failed one stays pending so the
+ * next mark or flush tries it again.
+ * Losing a pending version on a crash only costs what the last taps changed (counters, a new
+ * persistent key), the next tap repeats it.
+ */
+class ReaderFlusher
+{
+public:
+  struct stats_t {
+    uint32_t marks;
+    uint32_t flushes;
+    uint32_t flushUs; // duration of the last save
+  };
+
+  explicit ReaderFlusher(ReaderStore& store) : store(store) {}
+
+  void begin(uint32_t delayMs) {
+    if (taskHandle) return;
+    this->delayMs = delayMs;
+    xTaskCreate(task, "reader_flush", 4096, this, tskIDLE_PRIORITY + 1, &taskHandle);
+  }
+
+  /// Keeps `snapshot` to be saved later, falls back to saving now if the task isn't running
+  void markDirty(const readerState::pin_t& snapshot) {
+    if (!taskHandle) {
+      flush(snapshot);
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!pending || pending->version < snapshot->version) pending = snapshot;
+      marks++;
+    }
+    xTaskNotifyGive(taskHandle);
+  }
+
+  /// Saves `snapshot` now, a pending version that isn't newer gets dropped
+  bool flush(const readerState::pin_t& snapshot) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (pending && pending->version <= snapshot->version) pending.reset();
+    }
+    return save(snapshot);
+  }
+  /// Saves whatever is pending, for reboots
+  bool flushPending() {
+    readerState::pin_t snapshot;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      snapshot = std::move(pending);
+      pending.reset();
+    }
+    return snapshot ? save(snapshot) : true;
+  }
+
+  /// Erases the records, for the emptied data published as `version`
+  void erase(uint32_t version) {
+    std::lock_guard<std::mutex> storeLock(storeMutex);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (pending && pending->version <= version) pending.reset();
+    }
+    savedVersion = std::max(savedVersion, version);
+    store.erase();
+  }
+
+  stats_t stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return { marks, flushes, flushUs };
+  }
+
+private:
+  static constexpr const char* TAG = "ReaderFlusher";
+
+  static void task(void* arg) {
+    ReaderFlusher* self = static_cast<ReaderFlusher*>(arg);
+    while (1) {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      // wait for the taps to settle, every mark in the meantime restarts the wait
+      while (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(self->delayMs))) {}
+      self->flushPending();
+    }
+  }
+
+  bool save(const readerState::pin_t& snapshot) {
+    std::lock_guard<std::mutex> storeLock(storeMutex);
+    if (snapshot->version <= savedVersion) {
+      LOG(D, "Skipping version %" PRIu32 ", flash already has %" PRIu32, snapshot->version, savedVersion);
+      return true;
+    }
+    uint32_t start = tapTrace::now();
+    bool ok = store.save(snapshot->data);
+    std::lock_guard<std::mutex> lock(mutex);
+    if (ok) {
+      savedVersion = snapshot->version;
+    } else {
+      LOG(E, "Could not save version %" PRIu32 ", keeping it for the next flush", snapshot->version);
+      if (!pending || pending->version < snapshot->version) pending = snapshot;
+    }
+    flushes++;
+    flushUs = tapTrace::now() - start;
+    LOG(D, "Reader data flushed in %" PRIu32 " us, %" PRIu32 " marks so far", flushUs, marks);
+    return ok;
+  }
+
+  ReaderStore& store;
+  TaskHandle_t taskHandle = nullptr;
+  uint32_t delayMs = 0;
+  std::mutex mutex; // pending version and counters
+  std::mutex storeMutex; // ReaderStore and savedVersion, always taken before `mutex`
+  readerState::pin_t pending;
+  uint32_t savedVersion = 0;
+  uint32_t marks = 0;
+  uint32_t flushes = 0;
+  uint32_t flushUs = 0;
+};
@@ -0,0 +1,178 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "HomeKey.h"
+#include "hk_index.h"
+
+/**
+ * readerData as a series of immutable versions shared between the NFC, HAP, web and console tasks.
+ * The published version sits in one of SLOTS pin slots, `current` is the index of that slot.
+ * pin() reads the index, announces itself on that slot and copies the pointer out. It only
+ * starts over if a writer published in between, and it never waits on a writer: writers reuse a
+ * slot only once no pin is copying from it, and they don't hold anything a reader waits for.
+ * std::atomic<std::shared_ptr> isn't used because libstdc++ implements it with a spin lock, and
+ * a low priority writer preempted while holding that lock would leave the NFC task spinning.
+ * A version stays valid for as long as the pin is held. Writers are serialized, change a copy of
+ * the current version and publish it. A version is freed by whichever task drops the last pin, so
+ * a tap keeps the data it started with even if the issuers are reprovisioned halfway through.
+ * Every version carries an IssuerIndex built for its own data.
+ * Every tap publishes a version, so freed ones are kept as spares and the next version is copied
+ * into one of them, reusing the buffers of its vectors instead of allocating them again. Dropping
+ * the last pin takes the spare list's lock for that.
+ */
+namespace readerState {
+  struct snapshot_t {
+    readerData_t data;
+    hkIndex::IssuerIndex index;
+    uint32_t version = 0;
+  };
+  typedef std::shared_ptr<const snapshot_t> pin_t;
+
+  /**
+   * Copies the endpoint a tap authenticated from the tap's working copy into `into`, false if its issuer is gone.
+   * `intoIndex` and `fromIndex` are the indexes of the versions the two were copied from. An endpoint
+   * the flow just added to the working copy isn't in `fromIndex` yet and is looked up in its issuer.
+   */
+  inline bool mergeEndpoint(readerData_t& into, const hkIndex::IssuerIndex& intoIndex, const readerData_t& from, const hkIndex::IssuerIndex& fromIndex,
+    const std::vector<uint8_t>& issuerId, const std::vector<uint8_t>& endpointId) {
+    const hkEndpoint_t* source = fromIndex.findEndpoint(from, issuerId, endpointId);
+    if (!source || source->endpoint_id != endpointId) {
+      source = nullptr;
+      const hkIssuer_t* issuer = fromIndex.findIssuer(from, issuerId.data(), issuerId.size());
+      if (issuer && issuer->issuer_id == issuerId) {
+        auto it = std::find_if(issuer->endpoints.rbegin(), issuer->endpoints.rend(), [&](const hkEndpoint_t& e) { return e.endpoint_id == endpointId; });
+        if (it != issuer->endpoints.rend()) source = &*it;
+      }
+    }
+    if (!source) return false;
+    hkIssuer_t* issuer = intoIndex.findIssuer(into, issuerId.data(), issuerId.size());
+    if (!issuer || issuer->issuer_id != issuerId) return false;
+    hkEndpoint_t* endpoint = intoIndex.findEndpoint(into, issuerId, endpointId);
+    if (endpoint && endpoint->endpoint_id == endpointId) {
+      *endpoint = *source;
+    } else {
+      // first tap of this endpoint, the flow added it to the working copy
+      issuer->endpoints.push_back(*source);
+    }
+    return true;
+  }
+
+  class ReaderState
+  {
+  public:
+    struct stats_t {
+      uint32_t version;
+      int32_t live; // versions still pinned, the current one included
+    };
+
+    ReaderState() { slots[0] = std::make_shared<const snapshot_t>(); }
+    ~ReaderState() {
+      for (auto&& slot : slots) slot.reset();
+      for (size_t i = 0; i < spareCount; i++) delete spares[i];
+    }
+
+    pin_t pin() const {
+      while (1) {
+        uint8_t slot = current.load();
+        copying[slot]++;
+        if (current.load() == slot) {
+          pin_t pinned = slots[slot];
+          copying[slot]--;
+          return pinned;
+        }
+        // a writer published meanwhile, this slot may be getting reused
+        copying[slot]--;
+      }
+    }
+
+    /// Runs `mutate` on a copy of the current version and publishes the result. `mutate` may take
+    /// the version's IssuerIndex as a second argument, it describes the data as it was before the change.
+    template <typename F>
+    pin_t update(F&& mutate) {
+      std::lock_guard<std::mutex> lock(writer);
+      snapshot_t* next = spare();
+      *next = *slots[current.load()];
+      if constexpr (std::is_invocable_v<F&, readerData_t&, const hkIndex::IssuerIndex&>) {
+        mutate(next->data, std::as_const(next->index));
+      } else {
+        mutate(next->data);
+      }
+      return publishLocked(next);
+    }
+    /// Replaces the data as a whole, at boot and when it's erased
+    pin_t replace(readerData_t&& data) {
+      std::lock_guard<std::mutex> lock(writer);
+      snapshot_t* next = spare();
+      next->data = std::move(data);
+      next->version = slots[current.load()]->version;
+      return publishLocked(next);
+    }
+
+    stats_t stats() const { return { pin()->version, live.load() }; }
+
+  private:
+    static constexpr uint8_t SLOTS = 4;
+
+    // Caller holds the writer lock
+    pin_t publishLocked(snapshot_t* next) {
+      next->index.rebuild(next->data);
+      next->version++;
+      live++;
+      pin_t pinned(next, [this](const snapshot_t* s) { release(const_cast<snapshot_t*>(s)); });
+      uint8_t now = current.load();
+      uint8_t slot = idleSlot(now);
+      slots[slot] = pinned;
+      current.store(slot);
+      // drop the older versions' pins, a slot still being copied from keeps its pin until the next publish
+      for (uint8_t i = 0; i < SLOTS; i++) {
+        if (i != slot && slots[i] && !copying[i].load()) slots[i].reset();
+      }
+      return pinned;
+    }
+    // A slot other than `now` no pin() is copying from, readers only hold one for a pointer copy
+    uint8_t idleSlot(uint8_t now) {
+      while (1) {
+        for (uint8_t i = 1; i < SLOTS; i++) {
+          uint8_t slot = (now + i) % SLOTS;
+          if (!copying[slot].load()) return slot;
+        }
+        // every other slot has a reader preempted halfway through pin(), let them run
+        vTaskDelay(1);
+      }
+    }
+
+    snapshot_t* spare() {
+      std::lock_guard<std::mutex> lock(spareMutex);
+      return spareCount ? spares[--spareCount] : new snapshot_t;
+    }
+    // Runs in whichever task drops the last pin
+    void release(snapshot_t* s) {
+      live--;
+      std::lock_guard<std::mutex> lock(spareMutex);
+      if (spareCount < spares.size()) {
+        spares[spareCount++] = s;
+      } else {
+        delete s;
+      }
+    }
+
+    // Written only by writers while the slot isn't current and no pin() is copying from it
+    std::array<pin_t, SLOTS> slots;
+    std::atomic<uint8_t> current{ 0 };
+    mutable std::array<std::atomic<uint32_t>, SLOTS> copying = {};
+    std::mutex writer;
+    std::atomic<int32_t> live{ 0 };
+    std::mutex spareMutex;
+    std::array<snapshot_t*, 2> spares = {};
+    size_t spareCount = 0;
+  };
+}
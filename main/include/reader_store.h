@@ -0,0 +1,228 @@
+#pragma once
+#include <cinttypes>
+#include <cstdio>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <nvs.h>
+#include <esp_rom_crc.h>
+#include "HomeKey.h"
+#include "hk_index.h"
+#include "reader_codec.h"
+#include "logging.h"
+
+/**
+ * Stores readerData as one NVS record per endpoint, one per issuer and a meta record holding the
+ * reader keys and the issuer order, instead of a single READERDATA blob. Records use the binary
+ * encoding from reader_codec.h.
+ * A save only rewrites the records whose bytes differ from what is already in flash. Records
+ * are written leaf first and the meta record last, so an interrupted save still loads the previous
+ * issuer/endpoint layout. New identifiers never take a slot the meta record in flash still refers
+ * to, a slot freed by a save is only reused once the next meta record no longer lists it.
+ */
+class ReaderStore
+{
+public:
+  struct stats_t {
+    uint32_t saves = 0;
+    uint32_t recordsWritten = 0;
+    uint32_t recordsSkipped = 0;
+    uint32_t recordsErased = 0;
+    uint32_t bytesWritten = 0;
+  };
+
+  explicit ReaderStore(nvs_handle& handle) : handle(handle) {}
+
+  // Returns false if there are no records yet
+  bool load(readerData_t& data) {
+    std::vector<uint8_t> buf;
+    if (!get(META_KEY, buf)) return false;
+    readerData_t loaded;
+    std::vector<uint16_t> issuerOrder, endpointOrder;
+    if (!readerCodec::decodeMeta(buf, loaded, issuerOrder)) return false;
+    issuerSlots.clear();
+    endpointSlots.clear();
+    metaIssuers = std::set<uint16_t>(issuerOrder.begin(), issuerOrder.end());
+    metaEndpoints.clear();
+    char key[16];
+    for (uint16_t slot : issuerOrder) {
+      hkIssuer_t issuer;
+      issuerKey(key, slot);
+      if (!get(key, buf) || !readerCodec::decodeIssuer(buf, issuer, endpointOrder)) continue;
+      metaEndpoints.insert(endpointOrder.begin(), endpointOrder.end());
+      for (uint16_t epSlot : endpointOrder) {
+        hkEndpoint_t endpoint;
+        endpointKey(key, epSlot);
+        if (!get(key, buf) || !readerCodec::decodeEndpoint(buf, endpoint)) continue;
+        endpointSlots[hkIndex::idKey(endpoint.endpoint_id)] = epSlot;
+        issuer.endpoints.push_back(std::move(endpoint));
+      }
+      issuerSlots[hkIndex::idKey(issuer.issuer_id)] = slot;
+      loaded.issuers.push_back(std::move(issuer));
+    }
+    data = std::move(loaded);
+    // keep the slots the records were found in so the next save doesn't shuffle them around
+    assignSlots(data);
+    return true;
+  }
+
+  bool save(const readerData_t& data) {
+    stats_t before = total;
+    total.saves++;
+    assignSlots(data);
+    std::vector<uint16_t> issuerOrder, endpointOrder;
+    std::set<uint16_t> endpointsListed;
+    bool ok = true;
+    char key[16];
+    for (auto&& issuer : data.issuers) {
+      endpointOrder.clear();
+      for (auto&& endpoint : issuer.endpoints) {
+        uint16_t slot = endpointSlots[hkIndex::idKey(endpoint.endpoint_id)];
+        endpointKey(key, slot);
+        ok &= put(key, readerCodec::encodeEndpoint(endpoint));
+        endpointOrder.push_back(slot);
+        endpointsListed.insert(slot);
+      }
+      uint16_t slot = issuerSlots[hkIndex::idKey(issuer.issuer_id)];
+      issuerKey(key, slot);
+      ok &= put(key, readerCodec::encodeIssuer(issuer, endpointOrder));
+      issuerOrder.push_back(slot);
+    }
+    if (put(META_KEY, readerCodec::encodeMeta(data, issuerOrder))) {
+      metaIssuers = std::set<uint16_t>(issuerOrder.begin(), issuerOrder.end());
+      metaEndpoints = std::move(endpointsListed);
+    } else {
+      ok = false;
+    }
+    eraseUnused();
+    if (total.recordsWritten != before.recordsWritten || total.recordsErased != before.recordsErased) {
+      ok &= nvs_commit(handle) == ESP_OK;
+    }
+    if (!ok) {
+      // flash content is unknown now, make the next save rewrite everything
+      written.clear();
+    }
+    LOG(D, "Reader data saved - written: %" PRIu32 " (%" PRIu32 " bytes), unchanged: %" PRIu32 ", erased: %" PRIu32, total.recordsWritten - before.recordsWritten, total.bytesWritten - before.bytesWritten, total.recordsSkipped - before.recordsSkipped, total.recordsErased - before.recordsErased);
+    return ok;
+  }
+
+  void erase() {
+    for (auto&& entry : written) {
+      nvs_erase_key(handle, entry.first.c_str());
+    }
+    nvs_erase_key(handle, META_KEY);
+    nvs_commit(handle);
+    written.clear();
+    issuerSlots.clear();
+    endpointSlots.clear();
+    metaIssuers.clear();
+    metaEndpoints.clear();
+  }
+
+  const stats_t& stats() const { return total; }
+
+private:
+  static constexpr const char* TAG = "ReaderStore";
+  static constexpr const char* META_KEY = "RD_META";
+  static void issuerKey(char* key, uint16_t slot) { snprintf(key, 16, "RD_I%u", slot); }
+  static void endpointKey(char* key, uint16_t slot) { snprintf(key, 16, "RD_E%u", slot); }
+
+  bool get(const char* key, std::vector<uint8_t>& buf) {
+    size_t len = 0;
+    if (nvs_get_blob(handle, key, NULL, &len) != ESP_OK) return false;
+    buf.resize(len);
+    if (nvs_get_blob(handle, key, buf.data(), &len) != ESP_OK) return false;
+    written[key] = esp_rom_crc32_le(0, buf.data(), len);
+    return true;
+  }
+
+  bool put(const char* key, const std::vector<uint8_t>& buf) {
+    if (buf.empty()) {
+      LOG(E, "Could not encode %s, a field is over its length limit", key);
+      return false;
+    }
+    uint32_t crc = esp_rom_crc32_le(0, buf.data(), buf.size());
+    auto it = written.find(key);
+    if (it != written.end() && it->second == crc) {
+      total.recordsSkipped++;
+      return true;
+    }
+    esp_err_t err = nvs_set_blob(handle, key, buf.data(), buf.size());
+    if (err != ESP_OK) {
+      LOG(E, "Could not write %s: %s", key, esp_err_to_name(err));
+      return false;
+    }
+    written[key] = crc;
+    total.recordsWritten++;
+    total.bytesWritten += buf.size();
+    return true;
+  }
+
+  void assignSlots(const readerData_t& data) {
+    std::map<uint64_t, uint16_t> issuersLeft, endpointsLeft;
+    for (auto&& issuer : data.issuers) {
+      uint64_t id = hkIndex::idKey(issuer.issuer_id);
+      auto it = issuerSlots.find(id);
+      issuersLeft[id] = it != issuerSlots.end() ? it->second : UINT16_MAX;
+      for (auto&& endpoint : issuer.endpoints) {
+        uint64_t epId = hkIndex::idKey(endpoint.endpoint_id);
+        auto epIt = endpointSlots.find(epId);
+        endpointsLeft[epId] = epIt != endpointSlots.end() ? epIt->second : UINT16_MAX;
+      }
+    }
+    issuerSlots = fill(issuersLeft, metaIssuers);
+    endpointSlots = fill(endpointsLeft, metaEndpoints);
+  }
+
+  // Slots are stable per identifier for as long as it's enrolled, new identifiers take the lowest
+  // slot that is neither used nor listed in flash. Writing a new identifier into a slot the meta
+  // record still lists would overwrite the old record before the meta record stops pointing at it.
+  static std::map<uint64_t, uint16_t> fill(const std::map<uint64_t, uint16_t>& slots, std::set<uint16_t> taken) {
+    std::map<uint64_t, uint16_t> assigned;
+    for (auto&& entry : slots) {
+      if (entry.second != UINT16_MAX) {
+        assigned[entry.first] = entry.second;
+        taken.insert(entry.second);
+      }
+    }
+    uint16_t next = 0;
+    for (auto&& entry : slots) {
+      if (entry.second != UINT16_MAX) continue;
+      while (taken.count(next)) next++;
+      assigned[entry.first] = next++;
+    }
+    return assigned;
+  }
+
+  void eraseUnused() {
+    std::set<std::string> inUse = { META_KEY };
+    char key[16];
+    for (auto&& entry : issuerSlots) {
+      issuerKey(key, entry.second);
+      inUse.insert(key);
+    }
+    for (auto&& entry : endpointSlots) {
+      endpointKey(key, entry.second);
+      inUse.insert(key);
+    }
+    for (auto it = written.begin(); it != written.end();) {
+      if (!inUse.count(it->first)) {
+        nvs_erase_key(handle, it->first.c_str());
+        total.recordsErased++;
+        it = written.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  nvs_handle& handle;
+  std::map<std::string, uint32_t> written; // record key -> CRC32 of the bytes in flash
+  std::map<uint64_t, uint16_t> issuerSlots;
+  std::map<uint64_t, uint16_t> endpointSlots;
+  // slots reachable from the meta record in flash, quarantined for new identifiers
+  std::set<uint16_t> metaIssuers;
+  std::set<uint16_t> metaEndpoints;
+  stats_t total;
+};
@@ -0,0 +1,83 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <esp_heap_caps.h>
+
+/**
+ * Storage for the objects every tap creates and throws away, so a long run of taps doesn't keep
+ * carving the same sizes out of the heap. SlotPool holds N objects of one type in a block reserved
+ * once and only falls back to the heap when all of them are in use.
+ * heapNow() is what the tap trace reports to show whether fragmentation grows over a soak.
+ */
+namespace tapArena {
+  template <typename T, size_t N>
+  class SlotPool
+  {
+  public:
+    struct deleter_t {
+      SlotPool* pool = nullptr;
+      void operator()(T* p) const {
+        if (pool) pool->destroy(p);
+        else delete p;
+      }
+    };
+    typedef std::unique_ptr<T, deleter_t> ptr_t;
+
+    template <typename... Args>
+    ptr_t create(Args&&... args) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < N; i++) {
+          if (used[i]) continue;
+          used[i] = true;
+          T* p = new (&slots[i]) T(std::forward<Args>(args)...);
+          return ptr_t(p, deleter_t{ this });
+        }
+        fallbacks++;
+      }
+      return ptr_t(new T(std::forward<Args>(args)...), deleter_t{ this });
+    }
+
+    // Objects that didn't fit, should stay at 0
+    uint32_t fallbackCount() {
+      std::lock_guard<std::mutex> lock(mutex);
+      return fallbacks;
+    }
+
+  private:
+    void destroy(T* p) {
+      uintptr_t offset = reinterpret_cast<uintptr_t>(p) - reinterpret_cast<uintptr_t>(slots.data());
+      if (offset >= sizeof(slots)) {
+        delete p;
+        return;
+      }
+      size_t i = offset / sizeof(storage_t);
+      p->~T();
+      std::lock_guard<std::mutex> lock(mutex);
+      used[i] = false;
+    }
+
+    struct storage_t {
+      alignas(T) uint8_t bytes[sizeof(T)];
+    };
+    std::array<storage_t, N> slots;
+    std::array<bool, N> used = {};
+    std::mutex mutex;
+    uint32_t fallbacks = 0;
+  };
+
+  struct heap_t {
+    uint32_t free;
+    uint32_t largestBlock;
+    uint32_t blocks; // allocated blocks
+  };
+  inline heap_t heapNow() {
+    multi_heap_info_t info;
+    heap_caps_get_info(&info, MALLOC_CAP_8BIT);
+    return { uint32_t(info.total_free_bytes), uint32_t(info.largest_free_block), uint32_t(info.allocated_blocks) };
+  }
+}
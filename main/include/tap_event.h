@@ -0,0 +1,81 @@
+#pragma once
+#include <cinttypes>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+namespace tapEvent {
+  constexpr char hexDigits[] = "0123456789abcdef";
+  // Largest event is the HomeKey one at ~100 chars, a 10 byte UID needs less
+  constexpr size_t MAX_SIZE = 128;
+
+  /// Writes `len` bytes as lowercase hex into `out`, which must have room for 2 * len chars
+  inline void hexEncode(char* out, const uint8_t* data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+      out[i * 2] = hexDigits[data[i] >> 4];
+      out[i * 2 + 1] = hexDigits[data[i] & 0x0F];
+    }
+  }
+
+  /**
+   * Flat JSON object built in place in a fixed buffer, for the events published on every tap.
+   * Keys are written as given, so callers add them in alphabetical order to keep the output
+   * identical to what nlohmann::json used to dump. If the buffer runs out the event is marked
+   * invalid instead of being truncated.
+   */
+  template <size_t N = MAX_SIZE>
+  class EventBuffer
+  {
+  public:
+    EventBuffer() { put("{", 1); }
+    EventBuffer& hex(const char* key, const uint8_t* data, size_t len) {
+      if (!this->key(key) || !room(len * 2 + 2)) return *this;
+      buf[used++] = '"';
+      hexEncode(buf + used, data, len);
+      used += len * 2;
+      buf[used++] = '"';
+      return *this;
+    }
+    EventBuffer& number(const char* key, int32_t value) {
+      if (!this->key(key)) return *this;
+      char digits[12];
+      put(digits, snprintf(digits, sizeof(digits), "%" PRId32, value));
+      return *this;
+    }
+    EventBuffer& boolean(const char* key, bool value) {
+      if (this->key(key)) value ? put("true", 4) : put("false", 5);
+      return *this;
+    }
+    // Closes the object, returns nullptr if it didn't fit
+    const char* finish() {
+      put("}", 1);
+      if (!ok) return nullptr;
+      buf[used] = '\0';
+      return buf;
+    }
+    size_t size() const { return used; }
+
+  private:
+    bool key(const char* key) {
+      if (fields++) put(",", 1);
+      put("\"", 1);
+      put(key, strlen(key));
+      return put("\":", 2);
+    }
+    bool room(size_t n) {
+      if (used + n >= N) ok = false;
+      return ok;
+    }
+    bool put(const char* s, size_t n) {
+      if (!room(n)) return false;
+      memcpy(buf + used, s, n);
+      used += n;
+      return true;
+    }
+    char buf[N];
+    size_t used = 0;
+    uint8_t fields = 0;
+    bool ok = true;
+  };
+}
@@ -0,0 +1,233 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <tuple>
+#include <vector>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "HomeKey.h"
+#include "auth_context_pool.h"
+#include "flow_policy.h"
+#include "nfc_frames.h"
+#include "reader_flusher.h"
+#include "reader_state.h"
+#include "tap_arena.h"
+#include "tap_recovery.h"
+#include "tap_trace.h"
+#include "logging.h"
+
+/**
+ * Everything from the ECP broadcast to the target leaving the field: detection, SELECT,
+ * authentication with a pooled context, frame retries and restarts, merging the endpoint back and
+ * waiting for the removal. The reader is a template parameter with the PN532 class' methods, the
+ * firmware runs it on the PN532 and the host harness in test/ on a virtual one replaying recorded
+ * exchanges. What a tap leads to outside the NFC path (GPIO, HomeKit state, MQTT, /events) goes
+ * through hooks_t.
+ * Only the NFC task drives a pipeline.
+ */
+namespace tapPipeline {
+  typedef std::tuple<std::vector<uint8_t>, std::vector<uint8_t>, KeyFlow> authResult_t;
+  constexpr uint8_t ISO14443A = 0x00; // PN532_MIFARE_ISO14443A
+  // Activation attempts while a target is expected in the field, restarts and the removal wait
+  constexpr uint8_t TAP_RETRIES = 5;
+
+  struct target_t {
+    uint8_t uid[16];
+    uint8_t uidLen = 0;
+    uint8_t atqa[2] = {};
+    uint8_t sak[1] = {};
+  };
+
+  struct hooks_t {
+    std::function<void(const authResult_t&)> success;
+    std::function<void()> failed;
+    std::function<void(const target_t&)> notHomeKey;
+  };
+
+  template <typename Reader, size_t PoolDepth, size_t TraceDepth>
+  class Pipeline
+  {
+  public:
+    Pipeline(Reader& nfc, readerState::ReaderState& state, ReaderFlusher& flusher, AuthContextPool<PoolDepth>& contexts, flowPolicy::FlowPolicy& policy, tapRecovery::Recovery& recovery,
+      tapTrace::TapTracer<TraceDepth>& tracer, hooks_t hooks)
+        : nfc(nfc), state(state), flusher(flusher), contexts(contexts), policy(policy), recovery(recovery), tracer(tracer), hooks(std::move(hooks)) {}
+
+    /// Activation retries of the PN532 between taps, restored once a target left
+    void idleRetries(uint8_t retries) { idle = retries; }
+
+    /// Sends the ECP frame, returns how long it took
+    uint32_t broadcast(nfcFrame::EcpFrame& ecp) {
+      uint8_t res[4];
+      uint16_t resLen = sizeof(res);
+      uint32_t start = tapTrace::now();
+      nfc.inCommunicateThru(ecp.data(), ecp.size(), res, &resLen, 100, true);
+      return tapTrace::now() - start;
+    }
+
+    /// ECP frame and a search of up to `timeoutMs`, runs the tap if a target showed up
+    bool poll(nfcFrame::EcpFrame& ecp, uint16_t timeoutMs) {
+      uint32_t ecpUs = broadcast(ecp);
+      target_t target;
+      uint32_t detectStart = tapTrace::now();
+      if (!nfc.readPassiveTargetID(ISO14443A, target.uid, &target.uidLen, target.atqa, target.sak, timeoutMs, true, true)) return false;
+      tap(target, ecpUs, tapTrace::now() - detectStart);
+      return true;
+    }
+
+    /// Runs the tap on a target that was just activated, returns the flow or std::nullopt if it wasn't a HomeKey
+    std::optional<KeyFlow> tap(target_t& target, uint32_t ecpUs, uint32_t detectUs) {
+      if (!tracer.count()) firstHeap = tapArena::heapNow();
+      tracer.begin(ecpUs, detectUs);
+      nfc.setPassiveActivationRetries(TAP_RETRIES);
+      LOG(D, "ATQA: %02x", target.atqa[0]);
+      LOG(D, "SAK: %02x", target.sak[0]);
+      ESP_LOG_BUFFER_HEX_LEVEL(TAG, target.uid, (size_t)target.uidLen, ESP_LOG_VERBOSE);
+      LOG(I, "*** PASSIVE TARGET DETECTED ***");
+      recovery.begin(tracer.startedAt());
+      std::optional<KeyFlow> flowUsed = attempt(target);
+      while (recovery.restartPending()) {
+        tracer.restarted();
+        // the frame error may have broken the ISO-DEP link, activate the target again before SELECT
+        nfc.inRelease();
+        uint16_t timeout = std::max<uint32_t>(recovery.remainingUs(tapTrace::now()) / 1000, 1);
+        if (!nfc.readPassiveTargetID(ISO14443A, target.uid, &target.uidLen, target.atqa, target.sak, timeout, true, true)) {
+          LOG(W, "Target left before the restart");
+          hooks.failed();
+          flowUsed = kFlowFailed;
+          break;
+        }
+        flowUsed = attempt(target);
+      }
+      if (flowUsed.has_value()) {
+        recovery.finish(*flowUsed != kFlowFailed);
+        nfc.setRFField(0x02, 0x01);
+      }
+      waitRemoval(target);
+      nfc.setPassiveActivationRetries(idle);
+      tracer.commit(flowUsed.has_value() ? static_cast<int8_t>(*flowUsed) : tapTrace::NOT_HOMEKEY);
+      contexts.refill();
+      return flowUsed;
+    }
+
+    /// Heap right before the first tap, the baseline for a soak run
+    const tapArena::heap_t& firstTapHeap() const { return firstHeap; }
+
+  private:
+    static constexpr const char* TAG = "TapPipeline";
+
+    static uint32_t nowMs() { return static_cast<uint32_t>(esp_timer_get_time() / 1000); }
+
+    bool select() {
+      std::array<uint8_t, nfcFrame::selectHomeKey.size()> data = nfcFrame::selectHomeKey;
+      uint8_t selectCmdRes[9];
+      uint16_t selectCmdResLength = 9;
+      LOG(I, "Requesting supported HomeKey versions");
+      LOG(D, "SELECT HomeKey Applet, APDU: ");
+      ESP_LOG_BUFFER_HEX_LEVEL(TAG, data.data(), data.size(), ESP_LOG_VERBOSE);
+      bool status = exchange(data.data(), data.size(), selectCmdRes, &selectCmdResLength, false);
+      LOG(D, "SELECT HomeKey Applet, Response");
+      ESP_LOG_BUFFER_HEX_LEVEL(TAG, selectCmdRes, selectCmdResLength, ESP_LOG_VERBOSE);
+      return status && selectCmdResLength >= 2 && selectCmdRes[selectCmdResLength - 2] == 0x90 && selectCmdRes[selectCmdResLength - 1] == 0x00;
+    }
+
+    // SELECT -> authentication -> actions, returns std::nullopt if the target isn't a HomeKey
+    std::optional<KeyFlow> attempt(const target_t& target) {
+      auto startTime = std::chrono::high_resolution_clock::now();
+      uint32_t selectStart = tapTrace::now();
+      bool selected = select();
+      tracer.stage(tapTrace::SELECT, selectStart);
+      if (!selected) {
+        policy.discard();
+        if (recovery.selectedOnce()) {
+          // a restart, the target answered SELECT before and lost the link again
+          LOG(W, "SELECT failed after a restart");
+          hooks.failed();
+          return kFlowFailed;
+        }
+        hooks.notHomeKey(target);
+        return std::nullopt;
+      }
+      LOG(D, "*** SELECT HOMEKEY APPLET SUCCESSFUL ***");
+      recovery.selected();
+      readerState::pin_t snapshot = state.pin();
+      LOG(D, "Reader Private Key: %s", red_log::bufToHexString(snapshot->data.reader_pk.data(), snapshot->data.reader_pk.size()).c_str());
+      uint32_t authStart = tapTrace::now();
+      auto lease = contexts.take(exchange, snapshot);
+      KeyFlow requestedFlow = policy.choose(snapshot->index, nowMs());
+      auto authResult = lease.ctx->authenticate(requestedFlow);
+      tracer.stage(tapTrace::AUTH, authStart);
+      // a frame error isn't a sign the flow was too cheap, so a restart doesn't count against it
+      bool restarting = std::get<2>(authResult) == kFlowFailed && recovery.restart(tapTrace::now());
+      if (restarting) {
+        LOG(W, "Flow failed on a frame error, starting over from SELECT");
+        policy.discard();
+      } else {
+        policy.finish(std::get<2>(authResult), std::get<1>(authResult), nowMs());
+      }
+      LOG(D, "Requested flow %d, got %d", requestedFlow, std::get<2>(authResult));
+      if (std::get<2>(authResult) != kFlowFailed) {
+        hooks.success(authResult);
+        tracer.stage(tapTrace::TOTAL, tracer.startedAt());
+        // the endpoint's counter or new persistent key goes into a new version once the lock is handled,
+        // and reaches flash after the tap, see reader_flusher.h
+        flusher.markDirty(state.update([&](readerData_t& data, const hkIndex::IssuerIndex& index) {
+          if (!readerState::mergeEndpoint(data, index, *lease.data, snapshot->index, std::get<0>(authResult), std::get<1>(authResult))) {
+            LOG(W, "Issuer removed during the tap, endpoint not saved");
+          }
+        }));
+        auto stopTime = std::chrono::high_resolution_clock::now();
+        LOG(I, "Total Time (detection->auth->gpio->mqtt): %lli ms", static_cast<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(stopTime - startTime).count()));
+      } else if (!restarting) {
+        hooks.failed();
+      }
+      contexts.recycle(std::move(lease));
+      return std::get<2>(authResult);
+    }
+
+    void waitRemoval(target_t& target) {
+      vTaskDelay(50 / portTICK_PERIOD_MS);
+      nfc.inRelease();
+      int counter = 50;
+      bool deviceStillInField = nfc.readPassiveTargetID(ISO14443A, target.uid, &target.uidLen);
+      LOG(D, "Target still present: %d", deviceStillInField);
+      while (deviceStillInField) {
+        if (counter == 0) break;
+        vTaskDelay(50 / portTICK_PERIOD_MS);
+        nfc.inRelease();
+        deviceStillInField = nfc.readPassiveTargetID(ISO14443A, target.uid, &target.uidLen);
+        --counter;
+        LOG(D, "Target still present: %d Counter=%d", deviceStillInField, counter);
+      }
+      nfc.inRelease();
+    }
+
+    Reader& nfc;
+    readerState::ReaderState& state;
+    ReaderFlusher& flusher;
+    AuthContextPool<PoolDepth>& contexts;
+    flowPolicy::FlowPolicy& policy;
+    tapRecovery::Recovery& recovery;
+    tapTrace::TapTracer<TraceDepth>& tracer;
+    hooks_t hooks;
+    uint8_t idle = 0;
+    tapArena::heap_t firstHeap = {};
+    // Every APDU of a tap, the pooled contexts keep a pointer to it
+    nfcExchange_t exchange = [this](uint8_t* send, uint8_t sendLen, uint8_t* recv, uint16_t* recvLen, bool large) -> bool {
+      uint16_t capacity = *recvLen;
+      for (uint8_t tries = 0;; tries++) {
+        uint32_t start = tapTrace::now();
+        bool status = nfc.inDataExchange(send, sendLen, recv, recvLen, large);
+        tracer.round(tapTrace::now() - start);
+        policy.exchanged(sendLen, status ? *recvLen : 0);
+        if (status || !recovery.retryFrame(tries, tapTrace::now())) return status;
+        LOG(D, "Frame error, sending the APDU again");
+        *recvLen = capacity;
+      }
+    };
+  };
+}
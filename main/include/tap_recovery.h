@@ -0,0 +1,96 @@
+#pragma once
+#include <cstdint>
+#include <mutex>
+
+/**
+ * Recovery from frame errors while the target is still in the field, so a marginal antenna
+ * costs a retry instead of a second tap. Within `budgetMs` of the tap start a failed APDU is sent
+ * again up to `frameRetries` times, and a flow that still fails after a frame error is started over
+ * from SELECT with a fresh context. A flow that fails without any frame error was rejected by the
+ * device and is never retried. Restarts only happen once SELECT succeeded in the tap: a SELECT that
+ * still gets no answer after its frame retries is a target without the HomeKey applet, a plain tag
+ * whose UID should be published right away.
+ * Only the NFC task drives a tap, stats() is for the web server and console.
+ */
+namespace tapRecovery {
+  struct stats_t {
+    uint32_t taps;
+    uint32_t firstTry;           // succeeded without any frame error
+    uint32_t recoveredByRetry;   // frame errors, all fixed by sending the APDU again
+    uint32_t recoveredByRestart; // succeeded after starting over from SELECT
+    uint32_t failed;
+    uint32_t frameErrors;
+    uint32_t restarts;
+  };
+
+  class Recovery
+  {
+  public:
+    Recovery(uint32_t budgetMs, uint8_t frameRetries) : budgetUs(budgetMs * 1000), frameRetries(frameRetries) {}
+
+    void begin(uint32_t startUs) {
+      tapStartUs = startUs;
+      tapFrameErrors = 0;
+      tapRestarts = 0;
+      attemptFrameErrors = 0;
+      pending = false;
+      homeKey = false;
+    }
+
+    /// SELECT succeeded, the target is a HomeKey
+    void selected() { homeKey = true; }
+    bool selectedOnce() const { return homeKey; }
+
+    /// A frame failed after `tries` earlier sends of the same APDU, true if it should be sent again
+    bool retryFrame(uint8_t tries, uint32_t nowUs) {
+      tapFrameErrors++;
+      attemptFrameErrors++;
+      return tries < frameRetries && nowUs - tapStartUs < budgetUs;
+    }
+
+    /// The attempt failed, true if a frame error caused it and there's budget left to start over
+    bool restart(uint32_t nowUs) {
+      if (!homeKey || !attemptFrameErrors || nowUs - tapStartUs >= budgetUs) return false;
+      attemptFrameErrors = 0;
+      tapRestarts++;
+      pending = true;
+      return true;
+    }
+    // Consumed by the tap loop, a restart was decided during the attempt that just ended
+    bool restartPending() {
+      bool p = pending;
+      pending = false;
+      return p;
+    }
+    uint32_t remainingUs(uint32_t nowUs) const { return nowUs - tapStartUs < budgetUs ? budgetUs - (nowUs - tapStartUs) : 0; }
+
+    /// End of a HomeKey tap, after the last attempt
+    void finish(bool success) {
+      std::lock_guard<std::mutex> lock(mutex);
+      total.taps++;
+      total.frameErrors += tapFrameErrors;
+      total.restarts += tapRestarts;
+      if (!success) total.failed++;
+      else if (tapRestarts) total.recoveredByRestart++;
+      else if (tapFrameErrors) total.recoveredByRetry++;
+      else total.firstTry++;
+    }
+
+    stats_t stats() {
+      std::lock_guard<std::mutex> lock(mutex);
+      return total;
+    }
+
+  private:
+    const uint32_t budgetUs;
+    const uint8_t frameRetries;
+    uint32_t tapStartUs = 0;
+    uint32_t tapFrameErrors = 0;
+    uint32_t tapRestarts = 0;
+    uint32_t attemptFrameErrors = 0;
+    bool pending = false;
+    bool homeKey = false;
+    std::mutex mutex;
+    stats_t total = {};
+  };
+}
@@ -0,0 +1,138 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <esp_timer.h>
+
+namespace tapTrace {
+  enum stage_t : uint8_t
+  {
+    ECP,     // ECP broadcast (inCommunicateThru)
+    DETECT,  // readPassiveTargetID that found the target
+    SELECT,  // SELECT HomeKey applet
+    AUTH,    // HKAuthenticationContext::authenticate
+    HANDOFF, // queue send -> lock GPIO edge in the actuator task
+    STATE,   // tap start -> lockCurrentState->setVal
+    TOTAL,   // tap start -> actions dispatched
+    STAGE_MAX
+  };
+  constexpr std::array<const char*, STAGE_MAX> stageNames = { "ecp", "detect", "select", "auth", "handoff", "state", "total" };
+  constexpr uint8_t MAX_ROUNDS = 12;
+  constexpr int8_t NOT_HOMEKEY = -1;
+  constexpr int16_t ANY_FLOW = INT16_MAX;
+
+  struct tapRecord_t {
+    uint32_t seq = 0;
+    int8_t flow = NOT_HOMEKEY;
+    uint8_t rounds = 0;
+    uint8_t attempts = 1; // SELECT + authentication runs, more than one after a restart
+    uint32_t stages[STAGE_MAX] = {};
+    uint32_t roundTimes[MAX_ROUNDS] = {};
+  };
+
+  inline uint32_t now() { return static_cast<uint32_t>(esp_timer_get_time()); }
+
+  /**
+   * Per-stage timings of the last N taps.
+   * The NFC task is the only one building and committing records, the actuator task only reports
+   * the handoff and state stages through atomics, and readers copy slots out under a per-slot
+   * sequence counter, so neither side ever takes a lock.
+   */
+  template <size_t N>
+  class TapTracer
+  {
+  public:
+    void begin(uint32_t ecpUs, uint32_t detectUs) {
+      current = {};
+      current.stages[ECP] = ecpUs;
+      current.stages[DETECT] = detectUs;
+      queuedAt.store(0, std::memory_order_relaxed);
+      handoffUs.store(0, std::memory_order_relaxed);
+      stateUs.store(0, std::memory_order_relaxed);
+      tapStart.store(now(), std::memory_order_release);
+    }
+    uint32_t startedAt() const { return tapStart.load(std::memory_order_relaxed); }
+    void stage(stage_t s, uint32_t startUs) { current.stages[s] = now() - startUs; }
+    void round(uint32_t us) {
+      if (current.rounds < MAX_ROUNDS) {
+        current.roundTimes[current.rounds] = us;
+      }
+      if (current.rounds < UINT8_MAX) current.rounds++;
+    }
+    void restarted() {
+      if (current.attempts < UINT8_MAX) current.attempts++;
+    }
+    void queued() { queuedAt.store(now(), std::memory_order_release); }
+    void actuated() {
+      uint32_t t = queuedAt.exchange(0, std::memory_order_acq_rel);
+      if (t) handoffUs.store(now() - t, std::memory_order_relaxed);
+    }
+    void stateSet() { stateUs.store(now() - tapStart.load(std::memory_order_acquire), std::memory_order_relaxed); }
+    void commit(int8_t flow) {
+      current.flow = flow;
+      current.stages[HANDOFF] = handoffUs.load(std::memory_order_relaxed);
+      current.stages[STATE] = stateUs.load(std::memory_order_relaxed);
+      uint32_t h = head.load(std::memory_order_relaxed);
+      current.seq = h;
+      slot_t& slot = slots[h % N];
+      uint32_t v = slot.version.load(std::memory_order_relaxed);
+      slot.version.store(v + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      slot.record = current;
+      slot.version.store(v + 2, std::memory_order_release);
+      head.store(h + 1, std::memory_order_release);
+    }
+    uint32_t count() const { return head.load(std::memory_order_acquire); }
+    /// Copies the buffered records, newest first, returns how many were copied
+    size_t snapshot(std::array<tapRecord_t, N>& out) const {
+      uint32_t h = head.load(std::memory_order_acquire);
+      size_t n = 0;
+      for (uint32_t i = 0; i < std::min<uint32_t>(h, N); i++) {
+        const slot_t& slot = slots[(h - 1 - i) % N];
+        for (int attempt = 0; attempt < 4; attempt++) {
+          uint32_t v1 = slot.version.load(std::memory_order_acquire);
+          if (v1 & 1) continue;
+          out[n] = slot.record;
+          std::atomic_thread_fence(std::memory_order_acquire);
+          if (slot.version.load(std::memory_order_relaxed) == v1) {
+            n++;
+            break;
+          }
+        }
+      }
+      return n;
+    }
+    /// Nearest-rank p50/p95/p99 of a stage over the records in `taps`, skipping taps that never reached it
+    /// and, if `flow` is given, taps that ended with another flow
+    static std::array<uint32_t, 3> percentiles(const std::array<tapRecord_t, N>& taps, size_t n, stage_t s, int16_t flow = ANY_FLOW) {
+      std::array<uint32_t, N> values;
+      size_t count = 0;
+      for (size_t i = 0; i < n; i++) {
+        if (taps[i].stages[s] && (flow == ANY_FLOW || taps[i].flow == flow)) values[count++] = taps[i].stages[s];
+      }
+      std::array<uint32_t, 3> res = {};
+      if (count == 0) return res;
+      std::sort(values.begin(), values.begin() + count);
+      const uint8_t ranks[3] = { 50, 95, 99 };
+      for (size_t i = 0; i < 3; i++) {
+        size_t idx = (ranks[i] * count + 99) / 100;
+        res[i] = values[idx ? idx - 1 : 0];
+      }
+      return res;
+    }
+
+  private:
+    struct slot_t {
+      std::atomic<uint32_t> version{ 0 };
+      tapRecord_t record;
+    };
+    tapRecord_t current;
+    std::array<slot_t, N> slots;
+    std::atomic<uint32_t> head{ 0 };
+    std::atomic<uint32_t> tapStart{ 0 };
+    std::atomic<uint32_t> queuedAt{ 0 };
+    std::atomic<uint32_t> handoffUs{ 0 };
+    std::atomic<uint32_t> stateUs{ 0 };
+  };
+}
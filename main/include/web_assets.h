@@ -0,0 +1,151 @@
+#pragma once
+#include <cctype>
+#include <map>
+#include <string>
+#include <esp_rom_crc.h>
+#include <FS.h>
+#include <ESPAsyncWebServer.h>
+#include <nlohmann/json.hpp>
+#include "logging.h"
+
+namespace webAssets {
+  struct asset_t {
+    std::string etag;
+    bool gz = false;
+  };
+  typedef std::map<std::string, asset_t> manifest_t;
+
+  /// Reads the manifest written by tools/pack_web.py, empty if the image wasn't packed with it
+  inline manifest_t loadManifest(fs::FS& fs, const char* path = "/manifest.json") {
+    const char* TAG = "webAssets";
+    manifest_t manifest;
+    File file = fs.open(path, "r");
+    if (!file) {
+      LOG(W, "%s not found, serving assets without validators", path);
+      return manifest;
+    }
+    std::string text(file.size(), '\0');
+    file.read(reinterpret_cast<uint8_t*>(text.data()), text.size());
+    file.close();
+    nlohmann::json data = nlohmann::json::parse(text, nullptr, false);
+    if (!data.is_object()) return manifest;
+    for (auto it = data.begin(); it != data.end(); ++it) {
+      if (!it.value().is_object() || !it.value().contains("etag")) continue;
+      manifest[it.key()] = { "\"" + it.value().value("etag", std::string()) + "\"", it.value().value("gz", false) };
+    }
+    LOG(I, "%u web assets in manifest", unsigned(manifest.size()));
+    return manifest;
+  }
+
+  /**
+   * Serves the packed files under `uri` from `dir`, using the manifest for the gzip variant and the
+   * content hash ETag. A URL carrying the current hash as ?v= can't change, so it's cached for a
+   * year, everything else must revalidate and usually gets a 304.
+   */
+  class AssetHandler : public AsyncWebHandler
+  {
+  public:
+    AssetHandler(const char* uri, fs::FS& fs, const char* dir, const manifest_t& manifest) : uri(uri), fs(fs), dir(dir), manifest(manifest) {}
+
+    bool canHandle(AsyncWebServerRequest* request) override {
+      if (request->method() != HTTP_GET || !request->url().startsWith(uri.c_str())) return false;
+      request->addInterestingHeader("If-None-Match");
+      return true;
+    }
+
+    void handleRequest(AsyncWebServerRequest* request) override {
+      if (_username.length() && _password.length() && !request->authenticate(_username.c_str(), _password.c_str())) {
+        return request->requestAuthentication();
+      }
+      std::string path = dir + request->url().substring(uri.length()).c_str();
+      auto it = manifest.find(path);
+      if (it == manifest.end()) {
+        request->send(404);
+        return;
+      }
+      const asset_t& asset = it->second;
+      bool versioned = request->hasParam("v") && ("\"" + std::string(request->getParam("v")->value().c_str()) + "\"") == asset.etag;
+      const char* cacheControl = versioned ? "public, max-age=31536000, immutable" : "no-cache";
+      AsyncWebServerResponse* response;
+      if (request->hasHeader("If-None-Match") && request->header("If-None-Match") == asset.etag.c_str()) {
+        response = request->beginResponse(304);
+      } else {
+        // AsyncFileResponse sets Content-Encoding itself when handed the .gz file
+        File file = fs.open((asset.gz ? path + ".gz" : path).c_str(), "r");
+        if (!file) {
+          request->send(404);
+          return;
+        }
+        response = request->beginResponse(file, path.c_str(), String(), false);
+      }
+      response->addHeader("ETag", asset.etag.c_str());
+      response->addHeader("Cache-Control", cacheControl);
+      request->send(response);
+    }
+
+  private:
+    std::string uri;
+    fs::FS& fs;
+    std::string dir;
+    const manifest_t& manifest;
+  };
+
+  /**
+   * A templated page rendered once into RAM, so requests are answered straight from the buffer with
+   * a known length and an ETag instead of re-reading flash and running the processor each time.
+   * Placeholders are %NAME% with up to 32 uppercase letters, digits or underscores, any other % is literal.
+   */
+  class RenderedPage
+  {
+  public:
+    bool render(fs::FS& fs, const char* path, AwsTemplateProcessor processor) {
+      File file = fs.open(path, "r");
+      if (!file) return false;
+      std::string source(file.size(), '\0');
+      file.read(reinterpret_cast<uint8_t*>(source.data()), source.size());
+      file.close();
+      page.clear();
+      page.reserve(source.size());
+      size_t pos = 0;
+      while (pos < source.size()) {
+        size_t start = source.find('%', pos);
+        if (start == std::string::npos) break;
+        size_t end = start + 1;
+        while (end < source.size() && end - start <= 32 && (isupper(static_cast<unsigned char>(source[end])) || isdigit(static_cast<unsigned char>(source[end])) || source[end] == '_')) end++;
+        page.append(source, pos, start - pos);
+        if (end < source.size() && source[end] == '%' && end > start + 1) {
+          page.append(processor(String(source.substr(start + 1, end - start - 1).c_str())).c_str());
+          pos = end + 1;
+        } else {
+          page.push_back('%');
+          pos = start + 1;
+        }
+      }
+      page.append(source, pos, std::string::npos);
+      page.shrink_to_fit();
+      char tag[11];
+      snprintf(tag, sizeof(tag), "\"%08lx\"", static_cast<unsigned long>(esp_rom_crc32_le(0, reinterpret_cast<const uint8_t*>(page.data()), page.size())));
+      etag = tag;
+      return true;
+    }
+    bool empty() const { return page.empty(); }
+    size_t size() const { return page.size(); }
+
+    void send(AsyncWebServerRequest* request, const char* contentType) const {
+      AsyncWebServerResponse* response;
+      if (request->hasHeader("If-None-Match") && request->header("If-None-Match") == etag.c_str()) {
+        response = request->beginResponse(304);
+      } else {
+        // served from the buffer as is, it lives for as long as the firmware runs
+        response = request->beginResponse_P(200, contentType, reinterpret_cast<const uint8_t*>(page.data()), page.size());
+      }
+      response->addHeader("ETag", etag.c_str());
+      response->addHeader("Cache-Control", "no-cache");
+      request->send(response);
+    }
+
+  private:
+    std::string page;
+    std::string etag;
+  };
+}
@@ -1,5 +1,7 @@
+#include <cinttypes>
 #include <cstdint>
 #include <memory>
+#include <optional>
 #define JSON_NOEXCEPTION 1
 #include <sodium/crypto_sign.h>
 #include <sodium/crypto_box.h>
@@ -11,6 +13,7 @@
 #include "HomeSpan.h"
 #include "PN532_SPI.h"
 #include "PN532.h"
+#include "SPI.h"
 #include "chrono"
 #include "ESPAsyncWebServer.h"
 #include "LittleFS.h"
@@ -19,28 +22,57 @@
 #include "esp_app_desc.h"
 #include "pins_arduino.h"
 #include "NFC_SERV_CHARS.h"
-#include <mbedtls/sha256.h>
 #include <esp_mac.h>
-#include "mqtt_stub.h"
+#include <esp_system.h>
+#include "mqtt_config.h"
+#include "tap_trace.h"
+#include "actuator.h"
+#include "tap_event.h"
+#include "nfc_frames.h"
+#include "hk_index.h"
+#include "tap_arena.h"
+#include "auth_context_pool.h"
+#include "crypto_bench.h"
+#include "hk_crypto.h"
+#include "flow_policy.h"
+#include "tap_recovery.h"
+#include "tap_pipeline.h"
+#include "reader_state.h"
+#include "reader_store.h"
+#include "reader_flusher.h"
+#include "config_store.h"
+#include "body_arena.h"
+#include "web_assets.h"
+#include "hk_info_writer.h"
+#include "event_stream.h"
+#include "mqtt_publisher.h"
 
 const char* TAG = "MAIN";
 
 AsyncWebServer webServer(80);
+AsyncEventSource events("/events");
 PN532_SPI *pn532spi;
 PN532 *nfc;
-QueueHandle_t gpio_led_handle = nullptr;
-QueueHandle_t neopixel_handle = nullptr;
-QueueHandle_t gpio_lock_handle = nullptr;
-TaskHandle_t gpio_led_task_handle = nullptr;
-TaskHandle_t neopixel_task_handle = nullptr;
-TaskHandle_t gpio_lock_task_handle = nullptr;
 TaskHandle_t alt_action_task_handle = nullptr;
 TaskHandle_t nfc_reconnect_task = nullptr;
 TaskHandle_t nfc_poll_task = nullptr;
+TaskHandle_t event_task_handle = nullptr;
 
 nvs_handle savedData;
-readerData_t readerData;
-uint8_t ecpData[18] = { 0x6A, 0x2, 0xCB, 0x2, 0x6, 0x2, 0x11, 0x0 };
+nvs_handle hkAuthData;
+readerState::ReaderState readerState;
+ReaderStore readerStore(savedData);
+ReaderFlusher readerFlusher(readerStore);
+AuthContextPool<AUTH_POOL_DEPTH> authContexts(readerState, hkAuthData);
+hkIndex::ControllerIdCache controllerIds;
+BodyArena<WEB_BODY_MAX_SIZE> webBody;
+webAssets::manifest_t webManifest;
+webAssets::RenderedPage indexPage;
+tapTrace::TapTracer<TAP_TRACE_DEPTH> tapTracer;
+actuator::Engine actuators;
+nfcFrame::EcpFrame ecpFrame;
+eventStream::EventRing<EVENT_QUEUE_DEPTH> eventRing;
+mqttPublisher::Publisher<MQTT_QUEUE_DEPTH> mqtt;
 const std::array<std::array<uint8_t, 6>, 4> hk_color_vals = { {{0x01,0x04,0xce,0xd5,0xda,0x00}, {0x01,0x04,0xaa,0xd6,0xec,0x00}, {0x01,0x04,0xe3,0xe3,0xe3,0x00}, {0x01,0x04,0x00,0x00,0x00,0x00}} };
 const std::array<const char*, 6> pixelTypeMap = { "RGB", "RBG", "BRG", "BGR", "GBR", "GRB" };
 struct gpioLockAction
@@ -51,8 +83,6 @@ struct gpioLockAction
     HOMEKEY = 2,
     OTHER = 3
   };
-  uint8_t source;
-  uint8_t action;
 };
 
 std::string platform_create_id_string(void) {
@@ -190,6 +220,7 @@ namespace espConfig
     std::string webUsername = WEB_AUTH_USERNAME;
     std::string webPassword = WEB_AUTH_PASSWORD;
     std::array<uint8_t, 4> nfcGpioPins{SS, SCK, MISO, MOSI};
+    uint8_t nfcIrqPin = NFC_IRQ_PIN;
     uint8_t btrLowStatusThreshold = 10;
     bool proxBatEnabled = false;
     bool hkDumbSwitchMode = false;
@@ -206,28 +237,72 @@ namespace espConfig
     std::array<int8_t, 5> ethRmiiConfig = {0, -1, -1, -1, 0};
     #endif
     std::array<int8_t, 7> ethSpiConfig = {20, -1, -1, -1, -1, -1, -1};
-    NLOHMANN_DEFINE_TYPE_INTRUSIVE_WITH_DEFAULT(
-        misc_config_t, deviceName, otaPasswd, hk_key_color, setupCode,
-        lockAlwaysUnlock, lockAlwaysLock, controlPin, hsStatusPin,
-        nfcSuccessPin, nfcSuccessTime, nfcNeopixelPin, neoPixelType,
-        neopixelSuccessColor, neopixelFailureColor, neopixelSuccessTime,
-        neopixelFailTime, nfcSuccessHL, nfcFailPin, nfcFailTime, nfcFailHL,
-        gpioActionPin, gpioActionLockState, gpioActionUnlockState,
-        gpioActionMomentaryEnabled, gpioActionMomentaryTimeout, webAuthEnabled,
-        webUsername, webPassword, nfcGpioPins, btrLowStatusThreshold,
-        proxBatEnabled, hkDumbSwitchMode, hkAltActionInitPin,
-        hkAltActionInitLedPin, hkAltActionInitTimeout, hkAltActionPin,
-        hkAltActionTimeout, hkAltActionGpioState, hkGpioControlledState,
-        ethernetEnabled, ethActivePreset, ethPhyType,
-#if CONFIG_ETH_USE_ESP32_EMAC
-        ethRmiiConfig,
-#endif
-        ethSpiConfig
-    )
+    // Binary layout for configStore, the ids end up in NVS so they're never renumbered or reused
+    template <typename Self, typename V>
+    static void fields(Self& c, V& v) {
+      v(1, "deviceName", c.deviceName);
+      v(2, "otaPasswd", c.otaPasswd);
+      v(3, "hk_key_color", c.hk_key_color);
+      v(4, "setupCode", c.setupCode);
+      v(5, "lockAlwaysUnlock", c.lockAlwaysUnlock);
+      v(6, "lockAlwaysLock", c.lockAlwaysLock);
+      v(7, "controlPin", c.controlPin);
+      v(8, "hsStatusPin", c.hsStatusPin);
+      v(9, "nfcNeopixelPin", c.nfcNeopixelPin);
+      v(10, "neoPixelType", c.neoPixelType);
+      v(11, "neopixelSuccessColor", c.neopixelSuccessColor);
+      v(12, "neopixelFailureColor", c.neopixelFailureColor);
+      v(13, "neopixelSuccessTime", c.neopixelSuccessTime);
+      v(14, "neopixelFailTime", c.neopixelFailTime);
+      v(15, "nfcSuccessPin", c.nfcSuccessPin);
+      v(16, "nfcSuccessTime", c.nfcSuccessTime);
+      v(17, "nfcSuccessHL", c.nfcSuccessHL);
+      v(18, "nfcFailPin", c.nfcFailPin);
+      v(19, "nfcFailTime", c.nfcFailTime);
+      v(20, "nfcFailHL", c.nfcFailHL);
+      v(21, "gpioActionPin", c.gpioActionPin);
+      v(22, "gpioActionLockState", c.gpioActionLockState);
+      v(23, "gpioActionUnlockState", c.gpioActionUnlockState);
+      v(24, "gpioActionMomentaryEnabled", c.gpioActionMomentaryEnabled);
+      v(25, "hkGpioControlledState", c.hkGpioControlledState);
+      v(26, "gpioActionMomentaryTimeout", c.gpioActionMomentaryTimeout);
+      v(27, "webAuthEnabled", c.webAuthEnabled);
+      v(28, "webUsername", c.webUsername);
+      v(29, "webPassword", c.webPassword);
+      v(30, "nfcGpioPins", c.nfcGpioPins);
+      v(31, "nfcIrqPin", c.nfcIrqPin);
+      v(32, "btrLowStatusThreshold", c.btrLowStatusThreshold);
+      v(33, "proxBatEnabled", c.proxBatEnabled);
+      v(34, "hkDumbSwitchMode", c.hkDumbSwitchMode);
+      v(35, "hkAltActionInitPin", c.hkAltActionInitPin);
+      v(36, "hkAltActionInitLedPin", c.hkAltActionInitLedPin);
+      v(37, "hkAltActionInitTimeout", c.hkAltActionInitTimeout);
+      v(38, "hkAltActionPin", c.hkAltActionPin);
+      v(39, "hkAltActionTimeout", c.hkAltActionTimeout);
+      v(40, "hkAltActionGpioState", c.hkAltActionGpioState);
+      v(41, "ethernetEnabled", c.ethernetEnabled);
+      v(42, "ethActivePreset", c.ethActivePreset);
+      v(43, "ethPhyType", c.ethPhyType);
+      #if CONFIG_ETH_USE_ESP32_EMAC
+      v(44, "ethRmiiConfig", c.ethRmiiConfig);
+      #endif
+      v(45, "ethSpiConfig", c.ethSpiConfig);
+    }
+    // JSON for the web UI, the config export and configs saved by earlier firmware, from the same field list
+    friend void to_json(nlohmann::json& j, const misc_config_t& c) { configStore::toJson(j, c); }
+    friend void from_json(const nlohmann::json& j, misc_config_t& c) { configStore::fromJson(j, c); }
   } miscConfig;
 }; // namespace espConfig
 
-KeyFlow hkFlow = KeyFlow::kFlowFAST;
+// Bump when a field changes meaning, fields that are only added or retyped load with their defaults.
+// The bump adds a { from, migration } step converting what the old version stored
+constexpr uint8_t MISC_CONFIG_VERSION = 1;
+configStore::Store<espConfig::misc_config_t> miscStore(savedData, "MISCCFG", MISC_CONFIG_VERSION);
+
+flowPolicy::FlowPolicy hkFlowPolicy;
+tapRecovery::Recovery tapRetry(NFC_RETRY_BUDGET, NFC_FRAME_RETRIES);
+typedef tapPipeline::Pipeline<PN532, AUTH_POOL_DEPTH, TAP_TRACE_DEPTH> nfcPipeline_t;
+nfcPipeline_t* nfcPipeline;
 bool hkAltActionActive = false;
 SpanCharacteristic* lockCurrentState;
 SpanCharacteristic* lockTargetState;
@@ -237,12 +312,75 @@ SpanCharacteristic* btrLevel;
 std::shared_ptr<Pixel> pixel;
 
 bool save_to_nvs() {
-  std::vector<uint8_t> serialized = nlohmann::json::to_msgpack(readerData);
-  esp_err_t set_nvs = nvs_set_blob(savedData, "READERDATA", serialized.data(), serialized.size());
-  esp_err_t commit_nvs = nvs_commit(savedData);
-  LOG(D, "NVS SET STATUS: %s", esp_err_to_name(set_nvs));
-  LOG(D, "NVS COMMIT STATUS: %s", esp_err_to_name(commit_nvs));
-  return !set_nvs && !commit_nvs;
+  bool saved = readerFlusher.flush(readerState.pin());
+  LOG(D, "NVS SAVE STATUS: %d", saved);
+  return saved;
+}
+
+// Runs from esp_restart(), which the web UI, HomeSpan commands and OTA updates all reboot through
+void flushReaderData() {
+  readerFlusher.flushPending();
+}
+
+// HK_HomeKit persists readerData as a single READERDATA blob, the per-record store supersedes it
+void dropLegacyReaderData() {
+  if (nvs_erase_key(savedData, "READERDATA") == ESP_OK) {
+    nvs_commit(savedData);
+  }
+}
+
+// Queues an event for /events, callable from any task, the dispatcher does the sending
+void eventPush(const char* name, const char* data) {
+  if (!data || !event_task_handle) return;
+  eventRing.push(name, data);
+  xTaskNotifyGive(event_task_handle);
+}
+
+void mqttPublishNumber(mqttPublisher::topic_t topic, int value, uint8_t qos, bool retain) {
+  char payload[12];
+  snprintf(payload, sizeof(payload), "%d", value);
+  mqtt.publish(topic, payload, qos, retain);
+}
+
+void setLockCurrentState(int state) {
+  lockCurrentState->setVal(state);
+  mqttPublishNumber(mqttPublisher::LOCK_STATE, state, 1, true);
+  tapEvent::EventBuffer<> payload;
+  eventPush("lock", payload.number("current", state).finish());
+}
+
+void pushBatteryEvent() {
+  if (!btrLevel || !statusLowBtr) return;
+  tapEvent::EventBuffer<> payload;
+  eventPush("battery", payload.number("level", btrLevel->getVal()).boolean("low", statusLowBtr->getVal()).finish());
+}
+
+// Only task that talks to AsyncEventSource. It holds back while the clients' send queues are
+// backed up, events keep piling in the ring meanwhile and the oldest are dropped first.
+void event_task(void* arg) {
+  const char* TAG = "event_task";
+  eventStream::event_t ev;
+  uint32_t lastHealth = 0;
+  while (1) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(EVENT_HEALTH_INTERVAL));
+    if (events.count() == 0) {
+      eventRing.clear();
+      continue;
+    }
+    uint32_t now = millis();
+    if (now - lastHealth >= EVENT_HEALTH_INTERVAL) {
+      lastHealth = now;
+      tapEvent::EventBuffer<> payload;
+      payload.number("dropped", eventRing.droppedCount()).number("heap", esp_get_free_heap_size());
+      if (!espConfig::miscConfig.ethernetEnabled) payload.number("rssi", WiFi.RSSI());
+      payload.number("uptime", now / 1000);
+      eventRing.push("health", payload.finish());
+    }
+    while (events.avgPacketsWaiting() < EVENT_MAX_WAITING && eventRing.pop(ev)) {
+      LOG(V, "%s #%" PRIu32 ": %s", ev.name, ev.id, ev.data);
+      events.send(ev.data, ev.name, ev.id);
+    }
+  }
 }
 
 struct PhysicalLockBattery : Service::BatteryService
@@ -302,26 +440,6 @@ struct NFCAccessoryInformation : Service::AccessoryInformation
   } // end constructor
 };
 
-// Function to calculate CRC16
-void crc16a(unsigned char* data, unsigned int size, unsigned char* result) {
-  unsigned short w_crc = 0x6363;
-
-  for (unsigned int i = 0; i < size; ++i) {
-    unsigned char byte = data[i];
-    byte = (byte ^ (w_crc & 0x00FF));
-    byte = ((byte ^ (byte << 4)) & 0xFF);
-    w_crc = ((w_crc >> 8) ^ (byte << 8) ^ (byte << 3) ^ (byte >> 4)) & 0xFFFF;
-  }
-
-  result[0] = static_cast<unsigned char>(w_crc & 0xFF);
-  result[1] = static_cast<unsigned char>((w_crc >> 8) & 0xFF);
-}
-
-// Function to append CRC16 to data
-void with_crc16(unsigned char* data, unsigned int size, unsigned char* result) {
-  crc16a(data, size, result);
-}
-
 void alt_action_task(void* arg) {
   uint8_t buttonState = 0;
   hkAltActionActive = false;
@@ -347,141 +465,123 @@ void alt_action_task(void* arg) {
   vTaskDelete(NULL);
 }
 
-void gpio_task(void* arg) {
-  gpioLockAction status;
-  while (1) {
-    if (gpio_lock_handle != nullptr) {
-      status = {};
-      if (uxQueueMessagesWaiting(gpio_lock_handle) > 0) {
-        xQueueReceive(gpio_lock_handle, &status, 0);
-        LOG(D, "Got something in queue - source = %d action = %d", status.source, status.action);
-        if (status.action == 0) {
-          LOG(D, "%d - %d - %d -%d", espConfig::miscConfig.gpioActionPin, espConfig::miscConfig.gpioActionMomentaryEnabled, espConfig::miscConfig.lockAlwaysUnlock, espConfig::miscConfig.lockAlwaysLock);
-          if (espConfig::miscConfig.lockAlwaysUnlock && status.source != gpioLockAction::HOMEKIT) {
-            lockTargetState->setVal(lockStates::UNLOCKED);
-            if(espConfig::miscConfig.gpioActionPin != 255){
-              digitalWrite(espConfig::miscConfig.gpioActionPin, espConfig::miscConfig.gpioActionUnlockState);
-            }
-            lockCurrentState->setVal(lockStates::UNLOCKED);
+void lockGpioWrite(int state) {
+  if (espConfig::miscConfig.gpioActionPin != 255) {
+    digitalWrite(espConfig::miscConfig.gpioActionPin, state == lockStates::UNLOCKED ? espConfig::miscConfig.gpioActionUnlockState : espConfig::miscConfig.gpioActionLockState);
+  }
+}
 
-            if (static_cast<uint8_t>(espConfig::miscConfig.gpioActionMomentaryEnabled) & status.source) {
-              delay(espConfig::miscConfig.gpioActionMomentaryTimeout);
-              lockTargetState->setVal(lockStates::LOCKED);
-              if(espConfig::miscConfig.gpioActionPin != 255){
-                digitalWrite(espConfig::miscConfig.gpioActionPin, espConfig::miscConfig.gpioActionLockState);
-              }
-              lockCurrentState->setVal(lockStates::LOCKED);
-            }
-          } else if (espConfig::miscConfig.lockAlwaysLock && status.source != gpioLockAction::HOMEKIT) {
-            lockTargetState->setVal(lockStates::LOCKED);
-            if(espConfig::miscConfig.gpioActionPin != 255){
-              digitalWrite(espConfig::miscConfig.gpioActionPin, espConfig::miscConfig.gpioActionLockState);
-            }
-            lockCurrentState->setVal(lockStates::LOCKED);
-          } else {
-            int currentState = lockCurrentState->getVal();
-            if (status.source != gpioLockAction::HOMEKIT) {
-              lockTargetState->setVal(!currentState);
-            }
-            if(espConfig::miscConfig.gpioActionPin != 255){
-              digitalWrite(espConfig::miscConfig.gpioActionPin, currentState == lockStates::UNLOCKED ? espConfig::miscConfig.gpioActionLockState : espConfig::miscConfig.gpioActionUnlockState);
-            }
-            lockCurrentState->setVal(!currentState);
-            if ((static_cast<uint8_t>(espConfig::miscConfig.gpioActionMomentaryEnabled) & status.source) && currentState == lockStates::LOCKED) {
-              delay(espConfig::miscConfig.gpioActionMomentaryTimeout);
-              lockTargetState->setVal(currentState);
-              if(espConfig::miscConfig.gpioActionPin != 255){
-                digitalWrite(espConfig::miscConfig.gpioActionPin, espConfig::miscConfig.gpioActionLockState);
-              }
-              lockCurrentState->setVal(currentState);
-            }
-          }
-        } else if (status.action == 2) {
-          vTaskDelete(NULL);
-          return;
-        }
-      }
+void actuatorLock(const actuator::cmd_t& cmd) {
+  uint8_t source = cmd.arg;
+  LOG(D, "%d - %d - %d -%d", espConfig::miscConfig.gpioActionPin, espConfig::miscConfig.gpioActionMomentaryEnabled, espConfig::miscConfig.lockAlwaysUnlock, espConfig::miscConfig.lockAlwaysLock);
+  bool momentary = static_cast<uint8_t>(espConfig::miscConfig.gpioActionMomentaryEnabled) & source;
+  if (actuators.pulseCancel(actuator::P_MOMENTARY)) {
+    LOG(D, "Momentary unlock preempted by new command - source = %d", source);
+  }
+  int newState;
+  if (espConfig::miscConfig.lockAlwaysUnlock && source != gpioLockAction::HOMEKIT) {
+    newState = lockStates::UNLOCKED;
+    lockTargetState->setVal(newState);
+  } else if (espConfig::miscConfig.lockAlwaysLock && source != gpioLockAction::HOMEKIT) {
+    newState = lockStates::LOCKED;
+    momentary = false;
+    lockTargetState->setVal(newState);
+  } else {
+    int currentState = lockCurrentState->getVal();
+    newState = !currentState;
+    momentary = momentary && currentState == lockStates::LOCKED;
+    if (source != gpioLockAction::HOMEKIT) {
+      lockTargetState->setVal(newState);
     }
-    vTaskDelay(100 / portTICK_PERIOD_MS);
+  }
+  lockGpioWrite(newState);
+  if (source == gpioLockAction::HOMEKEY) {
+    tapTracer.actuated();
+  }
+  LOG(D, "Queue -> GPIO: %" PRIu32 " us", tapTrace::now() - cmd.queuedAt);
+  setLockCurrentState(newState);
+  if (source == gpioLockAction::HOMEKEY) {
+    tapTracer.stateSet();
+  }
+  if (momentary) {
+    actuators.pulseStart(actuator::P_MOMENTARY, espConfig::miscConfig.gpioActionMomentaryTimeout);
   }
 }
 
-void neopixel_task(void* arg) {
-  uint8_t status = 0;
-  while (1) {
-    if (neopixel_handle != nullptr) {
-      status = 0;
-      if (uxQueueMessagesWaiting(neopixel_handle) > 0) {
-        xQueueReceive(neopixel_handle, &status, 0);
-        LOG(D, "Got something in queue %d", status);
-        switch (status) {
-        case 0:
-          if (espConfig::miscConfig.nfcNeopixelPin && espConfig::miscConfig.nfcNeopixelPin != 255) {
-            LOG(D, "SUCCESS PIXEL %d:%d,%d,%d", espConfig::miscConfig.nfcNeopixelPin, espConfig::miscConfig.neopixelFailureColor[espConfig::misc_config_t::colorMap::R], espConfig::miscConfig.neopixelFailureColor[espConfig::misc_config_t::colorMap::G], espConfig::miscConfig.neopixelFailureColor[espConfig::misc_config_t::colorMap::B]);
-            pixel->set(pixel->RGB(espConfig::miscConfig.neopixelFailureColor[espConfig::misc_config_t::colorMap::R], espConfig::miscConfig.neopixelFailureColor[espConfig::misc_config_t::colorMap::G], espConfig::miscConfig.neopixelFailureColor[espConfig::misc_config_t::colorMap::B]));
-            delay(espConfig::miscConfig.neopixelFailTime);
-            pixel->off();
-          }
-          break;
-        case 1:
-          if (espConfig::miscConfig.nfcNeopixelPin && espConfig::miscConfig.nfcNeopixelPin != 255) {
-            LOG(D, "FAIL PIXEL %d:%d,%d,%d", espConfig::miscConfig.nfcNeopixelPin, espConfig::miscConfig.neopixelSuccessColor[espConfig::misc_config_t::colorMap::R], espConfig::miscConfig.neopixelSuccessColor[espConfig::misc_config_t::colorMap::G], espConfig::miscConfig.neopixelSuccessColor[espConfig::misc_config_t::colorMap::B]);
-            pixel->set(pixel->RGB(espConfig::miscConfig.neopixelSuccessColor[espConfig::misc_config_t::colorMap::R], espConfig::miscConfig.neopixelSuccessColor[espConfig::misc_config_t::colorMap::G], espConfig::miscConfig.neopixelSuccessColor[espConfig::misc_config_t::colorMap::B]));
-            delay(espConfig::miscConfig.neopixelSuccessTime);
-            pixel->off();
-          }
-          break;
-        default:
-          vTaskDelete(NULL);
-          return;
-          break;
-        }
-      }
+void actuatorNfcGpio(uint8_t status) {
+  switch (status) {
+  case 0:
+    if (espConfig::miscConfig.nfcFailPin && espConfig::miscConfig.nfcFailPin != 255) {
+      LOG(D, "FAIL LED %d:%d", espConfig::miscConfig.nfcFailPin, espConfig::miscConfig.nfcFailHL);
+      digitalWrite(espConfig::miscConfig.nfcFailPin, espConfig::miscConfig.nfcFailHL);
+      actuators.pulseStart(actuator::P_NFC_FAIL, espConfig::miscConfig.nfcFailTime);
     }
-    vTaskDelay(100 / portTICK_PERIOD_MS);
+    break;
+  case 1:
+    if (espConfig::miscConfig.nfcSuccessPin && espConfig::miscConfig.nfcSuccessPin != 255) {
+      LOG(D, "SUCCESS LED %d:%d", espConfig::miscConfig.nfcSuccessPin, espConfig::miscConfig.nfcSuccessHL);
+      digitalWrite(espConfig::miscConfig.nfcSuccessPin, espConfig::miscConfig.nfcSuccessHL);
+      actuators.pulseStart(actuator::P_NFC_SUCCESS, espConfig::miscConfig.nfcSuccessTime);
+    }
+    break;
+  case 2:
+    if (hkAltActionActive) {
+      digitalWrite(espConfig::miscConfig.hkAltActionPin, espConfig::miscConfig.hkAltActionGpioState);
+      actuators.pulseStart(actuator::P_ALT_ACTION, espConfig::miscConfig.hkAltActionTimeout);
+    }
+    break;
+  default:
+    break;
   }
 }
-void nfc_gpio_task(void* arg) {
-  uint8_t status = 0;
-  while (1) {
-    if (gpio_led_handle != nullptr) {
-      status = 0;
-      if (uxQueueMessagesWaiting(gpio_led_handle) > 0) {
-        xQueueReceive(gpio_led_handle, &status, 0);
-        LOG(D, "Got something in queue %d", status);
-        switch (status) {
-        case 0:
-          if (espConfig::miscConfig.nfcFailPin && espConfig::miscConfig.nfcFailPin != 255) {
-            LOG(D, "FAIL LED %d:%d", espConfig::miscConfig.nfcFailPin, espConfig::miscConfig.nfcFailHL);
-            digitalWrite(espConfig::miscConfig.nfcFailPin, espConfig::miscConfig.nfcFailHL);
-            delay(espConfig::miscConfig.nfcFailTime);
-            digitalWrite(espConfig::miscConfig.nfcFailPin, !espConfig::miscConfig.nfcFailHL);
-          }
-          break;
-        case 1:
-          if (espConfig::miscConfig.nfcSuccessPin && espConfig::miscConfig.nfcSuccessPin != 255) {
-            LOG(D, "SUCCESS LED %d:%d", espConfig::miscConfig.nfcSuccessPin, espConfig::miscConfig.nfcSuccessHL);
-            digitalWrite(espConfig::miscConfig.nfcSuccessPin, espConfig::miscConfig.nfcSuccessHL);
-            delay(espConfig::miscConfig.nfcSuccessTime);
-            digitalWrite(espConfig::miscConfig.nfcSuccessPin, !espConfig::miscConfig.nfcSuccessHL);
-          }
-          break;
-        case 2:
-          if(hkAltActionActive){
-            digitalWrite(espConfig::miscConfig.hkAltActionPin, espConfig::miscConfig.hkAltActionGpioState);
-            delay(espConfig::miscConfig.hkAltActionTimeout);
-            digitalWrite(espConfig::miscConfig.hkAltActionPin, !espConfig::miscConfig.hkAltActionGpioState);
-          }
-          break;
-        default:
-          LOG(I, "STOP");
-          vTaskDelete(NULL);
-          return;
-          break;
-        }
-      }
+
+void actuatorNeopixel(uint8_t status) {
+  if (!pixel || !espConfig::miscConfig.nfcNeopixelPin || espConfig::miscConfig.nfcNeopixelPin == 255) {
+    return;
+  }
+  auto& color = status ? espConfig::miscConfig.neopixelSuccessColor : espConfig::miscConfig.neopixelFailureColor;
+  LOG(D, "%s PIXEL %d:%d,%d,%d", status ? "SUCCESS" : "FAIL", espConfig::miscConfig.nfcNeopixelPin, color[espConfig::misc_config_t::colorMap::R], color[espConfig::misc_config_t::colorMap::G], color[espConfig::misc_config_t::colorMap::B]);
+  pixel->set(pixel->RGB(color[espConfig::misc_config_t::colorMap::R], color[espConfig::misc_config_t::colorMap::G], color[espConfig::misc_config_t::colorMap::B]));
+  actuators.pulseStart(actuator::P_NEOPIXEL, status ? espConfig::miscConfig.neopixelSuccessTime : espConfig::miscConfig.neopixelFailTime);
+}
+
+void actuatorPulseEnd(actuator::pulse_t pulse) {
+  switch (pulse) {
+  case actuator::P_MOMENTARY:
+    lockTargetState->setVal(lockStates::LOCKED);
+    lockGpioWrite(lockStates::LOCKED);
+    setLockCurrentState(lockStates::LOCKED);
+    break;
+  case actuator::P_NFC_SUCCESS:
+    digitalWrite(espConfig::miscConfig.nfcSuccessPin, !espConfig::miscConfig.nfcSuccessHL);
+    break;
+  case actuator::P_NFC_FAIL:
+    digitalWrite(espConfig::miscConfig.nfcFailPin, !espConfig::miscConfig.nfcFailHL);
+    break;
+  case actuator::P_NEOPIXEL:
+    if (pixel) {
+      pixel->off();
     }
-    vTaskDelay(100 / portTICK_PERIOD_MS);
+    break;
+  case actuator::P_ALT_ACTION:
+    digitalWrite(espConfig::miscConfig.hkAltActionPin, !espConfig::miscConfig.hkAltActionGpioState);
+    break;
+  default:
+    break;
+  }
+}
+
+void actuatorCommand(const actuator::cmd_t& cmd) {
+  switch (cmd.target) {
+  case actuator::cmd_t::LOCK:
+    actuatorLock(cmd);
+    break;
+  case actuator::cmd_t::NFC_GPIO:
+    actuatorNfcGpio(cmd.arg);
+    break;
+  case actuator::cmd_t::NEOPIXEL:
+    actuatorNeopixel(cmd.arg);
+    break;
   }
 }
 
@@ -493,8 +593,6 @@ struct LockMechanism : Service::LockMechanism
     LOG(I, "Configuring LockMechanism");
     lockCurrentState = new Characteristic::LockCurrentState(1, true);
     lockTargetState = new Characteristic::LockTargetState(1, true);
-    memcpy(ecpData + 8, readerData.reader_gid.data(), readerData.reader_gid.size());
-    with_crc16(ecpData, 16, ecpData + 16);
     if (espConfig::miscConfig.gpioActionPin != 255) {
       if (lockCurrentState->getVal() == lockStates::LOCKED) {
         digitalWrite(espConfig::miscConfig.gpioActionPin, espConfig::miscConfig.gpioActionLockState);
@@ -507,12 +605,8 @@ struct LockMechanism : Service::LockMechanism
   boolean update() {
     int targetState = lockTargetState->getNewVal();
     LOG(I, "New LockState=%d, Current LockState=%d", targetState, lockCurrentState->getVal());
-    if (espConfig::miscConfig.gpioActionPin != 255) {
-      const gpioLockAction gpioAction{ .source = gpioLockAction::HOMEKIT, .action = 0 };
-      xQueueSend(gpio_lock_handle, &gpioAction, 0);
-    } else if (espConfig::miscConfig.hkDumbSwitchMode) {
-      const gpioLockAction gpioAction{ .source = gpioLockAction::HOMEKIT, .action = 0 };
-      xQueueSend(gpio_lock_handle, &gpioAction, 0);
+    if (espConfig::miscConfig.gpioActionPin != 255 || espConfig::miscConfig.hkDumbSwitchMode) {
+      actuators.send(actuator::cmd_t::LOCK, gpioLockAction::HOMEKIT);
     }
     return (true);
   }
@@ -536,9 +630,10 @@ struct NFCAccess : Service::NFCAccess
   }
 
   boolean update() {
-    LOG(D, "PROVISIONED READER KEY: %s", red_log::bufToHexString(readerData.reader_pk.data(), readerData.reader_pk.size()).c_str());
-    LOG(D, "READER GROUP IDENTIFIER: %s", red_log::bufToHexString(readerData.reader_gid.data(), readerData.reader_gid.size()).c_str());
-    LOG(D, "READER UNIQUE IDENTIFIER: %s", red_log::bufToHexString(readerData.reader_id.data(), readerData.reader_id.size()).c_str());
+    readerState::pin_t snapshot = readerState.pin();
+    LOG(D, "PROVISIONED READER KEY: %s", red_log::bufToHexString(snapshot->data.reader_pk.data(), snapshot->data.reader_pk.size()).c_str());
+    LOG(D, "READER GROUP IDENTIFIER: %s", red_log::bufToHexString(snapshot->data.reader_gid.data(), snapshot->data.reader_gid.size()).c_str());
+    LOG(D, "READER UNIQUE IDENTIFIER: %s", red_log::bufToHexString(snapshot->data.reader_id.data(), snapshot->data.reader_id.size()).c_str());
 
     TLV8 ctrlData(NULL, 0);
     nfcControlPoint->getNewTLV(ctrlData);
@@ -548,11 +643,17 @@ struct NFCAccess : Service::NFCAccess
       return false;
     LOG(D, "Decoded data: %s", red_log::bufToHexString(tlvData.data(), tlvData.size()).c_str());
     LOG(D, "Decoded data length: %d", tlvData.size());
-    HK_HomeKit hkCtx(readerData, savedData, "READERDATA", tlvData);
-    std::vector<uint8_t> result = hkCtx.processResult();
-    if (readerData.reader_gid.size() > 0) {
-      memcpy(ecpData + 8, readerData.reader_gid.data(), readerData.reader_gid.size());
-      with_crc16(ecpData, 16, ecpData + 16);
+    std::vector<uint8_t> result;
+    snapshot = readerState.update([&](readerData_t& data) {
+      HK_HomeKit hkCtx(data, savedData, "READERDATA", tlvData);
+      result = hkCtx.processResult();
+    });
+    authContexts.invalidate();
+    hkFlowPolicy.prune(snapshot->index);
+    save_to_nvs();
+    dropLegacyReaderData();
+    if (snapshot->data.reader_gid.size() > 0) {
+      ecpFrame.update(snapshot->data.reader_gid);
     }
     TLV8 res(NULL, 0);
     res.unpack(result.data(), result.size());
@@ -563,14 +664,12 @@ struct NFCAccess : Service::NFCAccess
 };
 
 void deleteReaderData(const char* buf = "") {
+  readerFlusher.erase(readerState.replace({})->version);
   esp_err_t erase_nvs = nvs_erase_key(savedData, "READERDATA");
   esp_err_t commit_nvs = nvs_commit(savedData);
-  readerData.issuers.clear();
-  readerData.reader_gid.clear();
-  readerData.reader_id.clear();
-  readerData.reader_pk.clear();
-  readerData.reader_pk_x.clear();
-  readerData.reader_sk.clear();
+  controllerIds.clear();
+  authContexts.invalidate();
+  hkFlowPolicy.prune(readerState.pin()->index);
   LOG(D, "*** NVS W STATUS");
   LOG(D, "ERASE: %s", esp_err_to_name(erase_nvs));
   LOG(D, "COMMIT: %s", esp_err_to_name(commit_nvs));
@@ -580,13 +679,8 @@ void deleteReaderData(const char* buf = "") {
 std::vector<uint8_t> getHashIdentifier(const uint8_t* key, size_t len) {
   const char* TAG = "getHashIdentifier";
   LOG(V, "Key: %s, Length: %d", red_log::bufToHexString(key, len).c_str(), len);
-  std::vector<unsigned char> hashable;
-  std::string string = "key-identifier";
-  hashable.insert(hashable.begin(), string.begin(), string.end());
-  hashable.insert(hashable.end(), key, key + len);
-  LOG(V, "Hashable: %s", red_log::bufToHexString(&hashable.front(), hashable.size()).c_str());
   uint8_t hash[32];
-  mbedtls_sha256(&hashable.front(), hashable.size(), hash, 0);
+  hkCrypto::Sha256().update(reinterpret_cast<const uint8_t*>("key-identifier"), 14).update(key, len).finish(hash);
   LOG(V, "HashIdentifier: %s", red_log::bufToHexString(hash, 8).c_str());
   return std::vector<uint8_t>{hash, hash + 8};
 }
@@ -596,46 +690,55 @@ void pairCallback() {
     deleteReaderData(NULL);
     return;
   }
+  readerState::pin_t snapshot = readerState.pin();
+  std::vector<hkIssuer_t> newIssuers;
   for (auto it = homeSpan.controllerListBegin(); it != homeSpan.controllerListEnd(); ++it) {
-    std::vector<uint8_t> id = getHashIdentifier(it->getLTPK(), 32);
+    const std::array<uint8_t, 8>& id = controllerIds.get(it->getLTPK(), getHashIdentifier);
     LOG(D, "Found allocated controller - Hash: %s", red_log::bufToHexString(id.data(), 8).c_str());
-    hkIssuer_t* foundIssuer = nullptr;
-    for (auto&& issuer : readerData.issuers) {
-      if (std::equal(issuer.issuer_id.begin(), issuer.issuer_id.end(), id.begin())) {
-        LOG(D, "Issuer %s already added, skipping", red_log::bufToHexString(issuer.issuer_id.data(), issuer.issuer_id.size()).c_str());
-        foundIssuer = &issuer;
-        break;
-      }
-    }
-    if (foundIssuer == nullptr) {
-      LOG(D, "Adding new issuer - ID: %s", red_log::bufToHexString(id.data(), 8).c_str());
-      hkIssuer_t newIssuer;
-      newIssuer.issuer_id = std::vector<uint8_t>{ id.begin(), id.begin() + 8 };
-      newIssuer.issuer_pk.insert(newIssuer.issuer_pk.begin(), it->getLTPK(), it->getLTPK() + 32);
-      readerData.issuers.emplace_back(newIssuer);
+    if (snapshot->index.findIssuer(snapshot->data, id.data(), id.size()) != nullptr) {
+      LOG(D, "Issuer %s already added, skipping", red_log::bufToHexString(id.data(), id.size()).c_str());
+      continue;
     }
+    LOG(D, "Adding new issuer - ID: %s", red_log::bufToHexString(id.data(), 8).c_str());
+    hkIssuer_t newIssuer;
+    newIssuer.issuer_id = std::vector<uint8_t>{ id.begin(), id.end() };
+    newIssuer.issuer_pk.insert(newIssuer.issuer_pk.begin(), it->getLTPK(), it->getLTPK() + 32);
+    newIssuers.emplace_back(newIssuer);
+  }
+  // removed controllers leave the cache, it only holds the ones still paired
+  controllerIds.sweep();
+  if (!newIssuers.empty()) {
+    // pairing events all come from the HAP task, nothing else adds issuers in between
+    readerState.update([&](readerData_t& data) {
+      data.issuers.insert(data.issuers.end(), newIssuers.begin(), newIssuers.end());
+    });
+    authContexts.invalidate();
+    save_to_nvs();
   }
-  save_to_nvs();
 }
 
 void setFlow(const char* buf) {
   switch (buf[1]) {
   case '0':
-    hkFlow = KeyFlow::kFlowFAST;
+    hkFlowPolicy.pin(KeyFlow::kFlowFAST);
     LOG(I, "FAST Flow");
     break;
 
   case '1':
-    hkFlow = KeyFlow::kFlowSTANDARD;
+    hkFlowPolicy.pin(KeyFlow::kFlowSTANDARD);
     LOG(I, "STANDARD Flow");
     break;
   case '2':
-    hkFlow = KeyFlow::kFlowATTESTATION;
+    hkFlowPolicy.pin(KeyFlow::kFlowATTESTATION);
     LOG(I, "ATTESTATION Flow");
     break;
+  case 'A':
+    hkFlowPolicy.unpin();
+    LOG(I, "Adaptive Flow");
+    break;
 
   default:
-    LOG(I, "0 = FAST flow, 1 = STANDARD Flow, 2 = ATTESTATION Flow");
+    LOG(I, "0 = FAST flow, 1 = STANDARD Flow, 2 = ATTESTATION Flow, A = Adaptive (default)");
     break;
   }
 }
@@ -668,6 +771,7 @@ void setLogLevel(const char* buf) {
   esp_log_level_set("HKFastAuth", level);
   esp_log_level_set("HKStdAuth", level);
   esp_log_level_set("HKAttestAuth", level);
+  esp_log_level_set("TapPipeline", level);
   esp_log_level_set("PN532", level);
   esp_log_level_set("PN532_SPI", level);
   esp_log_level_set("ISO18013_SC", level);
@@ -679,7 +783,8 @@ void setLogLevel(const char* buf) {
 }
 
 void print_issuers(const char* buf) {
-  for (auto&& issuer : readerData.issuers) {
+  readerState::pin_t snapshot = readerState.pin();
+  for (auto&& issuer : snapshot->data.issuers) {
     LOG(I, "Issuer ID: %s, Public Key: %s", red_log::bufToHexString(issuer.issuer_id.data(), issuer.issuer_id.size()).c_str(), red_log::bufToHexString(issuer.issuer_pk.data(), issuer.issuer_pk.size()).c_str());
     for (auto&& endpoint : issuer.endpoints) {
       LOG(I, "Endpoint ID: %s, Public Key: %s", red_log::bufToHexString(endpoint.endpoint_id.data(), endpoint.endpoint_id.size()).c_str(), red_log::bufToHexString(endpoint.endpoint_pk.data(), endpoint.endpoint_pk.size()).c_str());
@@ -687,6 +792,105 @@ void print_issuers(const char* buf) {
   }
 }
 
+json tapTraceStats() {
+  auto taps = std::make_unique<std::array<tapTrace::tapRecord_t, TAP_TRACE_DEPTH>>();
+  size_t n = tapTracer.snapshot(*taps);
+  json stats;
+  stats["taps"] = tapTracer.count();
+  stats["buffered"] = n;
+  for (uint8_t s = 0; s < tapTrace::STAGE_MAX; s++) {
+    auto p = tapTracer.percentiles(*taps, n, tapTrace::stage_t(s));
+    stats["stages"][tapTrace::stageNames[s]] = { {"p50", p[0]}, {"p95", p[1]}, {"p99", p[2]} };
+  }
+  stats["last"] = json::array();
+  for (size_t i = 0; i < n; i++) {
+    const tapTrace::tapRecord_t& r = (*taps)[i];
+    json tap;
+    tap["seq"] = r.seq;
+    tap["flow"] = r.flow;
+    tap["rounds"] = r.rounds;
+    tap["attempts"] = r.attempts;
+    for (uint8_t s = 0; s < tapTrace::STAGE_MAX; s++) {
+      tap["stages"][tapTrace::stageNames[s]] = r.stages[s];
+    }
+    tap["roundTimes"] = std::vector<uint32_t>(r.roundTimes, r.roundTimes + std::min(r.rounds, tapTrace::MAX_ROUNDS));
+    stats["last"].push_back(tap);
+  }
+  stats["flowPolicy"] = hkFlowPolicy.adaptive() ? "adaptive" : "pinned";
+  for (uint8_t f = kFlowFAST; f <= kFlowATTESTATION; f++) {
+    flowPolicy::counters_t c = hkFlowPolicy.flowCounters(KeyFlow(f));
+    auto p = tapTracer.percentiles(*taps, n, tapTrace::TOTAL, f);
+    stats["flows"][flowPolicy::flowNames[f]] = { {"taps", c.taps}, {"rounds", c.rounds}, {"bytes", c.bytes}, {"p50", p[0]}, {"p95", p[1]} };
+  }
+  flowPolicy::counters_t failed = hkFlowPolicy.failedCounters();
+  stats["flows"]["failed"] = { {"taps", failed.taps}, {"rounds", failed.rounds}, {"bytes", failed.bytes} };
+  stats["endpoints"] = json::array();
+  for (auto&& [key, ep] : hkFlowPolicy.endpointStats()) {
+    // endpoint ids are 6 bytes, the key holds them in their original order
+    char id[13];
+    tapEvent::hexEncode(id, reinterpret_cast<const uint8_t*>(&key), 6);
+    id[12] = '\0';
+    stats["endpoints"].push_back({ {"endpointId", id}, {"lastFlow", ep.lastFlow <= kFlowATTESTATION ? flowPolicy::flowNames[ep.lastFlow] : "none"}, {"successes", ep.successes} });
+  }
+  tapRecovery::stats_t recovery = tapRetry.stats();
+  stats["recovery"] = { {"taps", recovery.taps}, {"firstTry", recovery.firstTry}, {"recoveredByRetry", recovery.recoveredByRetry}, {"recoveredByRestart", recovery.recoveredByRestart}, {"failed", recovery.failed}, {"frameErrors", recovery.frameErrors}, {"restarts", recovery.restarts} };
+  auto flush = readerFlusher.stats();
+  stats["readerFlush"] = { {"marks", flush.marks}, {"flushes", flush.flushes}, {"flushUs", flush.flushUs} };
+  auto versions = readerState.stats();
+  stats["readerData"] = { {"version", versions.version}, {"live", versions.live} };
+  auto pool = authContexts.stats();
+  stats["authContext"] = { {"hits", pool.hits}, {"misses", pool.misses}, {"buildUs", pool.buildUs}, {"savedUs", pool.savedUs}, {"refreshes", pool.refreshes}, {"tapCopies", pool.tapCopies}, {"ready", pool.ready}, {"heapContexts", pool.heapContexts} };
+  tapArena::heap_t heap = tapArena::heapNow();
+  const tapArena::heap_t& firstTapHeap = nfcPipeline->firstTapHeap();
+  stats["heap"]["firstTap"] = { {"free", firstTapHeap.free}, {"largestBlock", firstTapHeap.largestBlock}, {"blocks", firstTapHeap.blocks} };
+  stats["heap"]["now"] = { {"free", heap.free}, {"largestBlock", heap.largestBlock}, {"blocks", heap.blocks} };
+  return stats;
+}
+
+void print_tap_trace(const char* buf) {
+  auto taps = std::make_unique<std::array<tapTrace::tapRecord_t, TAP_TRACE_DEPTH>>();
+  size_t n = tapTracer.snapshot(*taps);
+  LOG(I, "Taps: %" PRIu32 ", buffered: %d", tapTracer.count(), n);
+  for (uint8_t s = 0; s < tapTrace::STAGE_MAX; s++) {
+    auto p = tapTracer.percentiles(*taps, n, tapTrace::stage_t(s));
+    LOG(I, "%-8s p50: %" PRIu32 " us, p95: %" PRIu32 " us, p99: %" PRIu32 " us", tapTrace::stageNames[s], p[0], p[1], p[2]);
+  }
+  LOG(I, "Flow policy: %s", hkFlowPolicy.adaptive() ? "adaptive" : "pinned");
+  for (uint8_t f = kFlowFAST; f <= kFlowATTESTATION; f++) {
+    flowPolicy::counters_t c = hkFlowPolicy.flowCounters(KeyFlow(f));
+    auto p = tapTracer.percentiles(*taps, n, tapTrace::TOTAL, f);
+    LOG(I, "%-11s taps: %" PRIu32 ", rounds: %" PRIu32 ", bytes: %" PRIu64 ", total p50: %" PRIu32 " us", flowPolicy::flowNames[f], c.taps, c.rounds, c.bytes, p[0]);
+  }
+  tapRecovery::stats_t recovery = tapRetry.stats();
+  LOG(I, "HomeKey taps: %" PRIu32 ", first try: %" PRIu32 ", recovered by APDU retry: %" PRIu32 ", by restart: %" PRIu32 ", failed: %" PRIu32 " (%" PRIu32 " frame errors, %" PRIu32 " restarts)", recovery.taps, recovery.firstTry, recovery.recoveredByRetry, recovery.recoveredByRestart, recovery.failed, recovery.frameErrors, recovery.restarts);
+  auto flush = readerFlusher.stats();
+  LOG(I, "Reader data: %" PRIu32 " taps marked dirty, %" PRIu32 " saves, last took %" PRIu32 " us", flush.marks, flush.flushes, flush.flushUs);
+  auto versions = readerState.stats();
+  LOG(I, "Reader data version %" PRIu32 ", %" PRIi32 " versions still pinned or current", versions.version, versions.live);
+  auto pool = authContexts.stats();
+  LOG(I, "Auth context pool: %" PRIu32 " hits, %" PRIu32 " misses, %d ready, %" PRIu32 " us per build, %" PRIu64 " us saved, %" PRIu32 " on the heap", pool.hits, pool.misses, pool.ready, pool.buildUs, pool.savedUs, pool.heapContexts);
+  LOG(I, "Working copies refreshed between taps: %" PRIu32 ", copied during a tap: %" PRIu32, pool.refreshes, pool.tapCopies);
+  tapArena::heap_t heap = tapArena::heapNow();
+  const tapArena::heap_t& firstTapHeap = nfcPipeline->firstTapHeap();
+  LOG(I, "Heap before the first tap: %" PRIu32 " free, largest block %" PRIu32 ", %" PRIu32 " blocks", firstTapHeap.free, firstTapHeap.largestBlock, firstTapHeap.blocks);
+  LOG(I, "Heap now: %" PRIu32 " free, largest block %" PRIu32 ", %" PRIu32 " blocks", heap.free, heap.largestBlock, heap.blocks);
+}
+
+// @C[fast iterations,slow iterations], prints one JSON line per primitive and backend, then the SHA-256 parity check.
+// Blocks the HomeSpan loop for the whole run, a few seconds with the defaults
+void run_crypto_bench(const char* buf) {
+  unsigned fast = 1000, slow = 20;
+  sscanf(buf + 1, "%u,%u", &fast, &slow);
+  cryptoBench::run([](const cryptoBench::result_t& r) {
+    char line[192];
+    cryptoBench::toJson(line, sizeof(line), r);
+    printf("%s\n", line);
+  }, fast, slow);
+  char line[128];
+  cryptoBench::toJson(line, sizeof(line), cryptoBench::checkSha256());
+  printf("%s\n", line);
+}
+
 void notFound(AsyncWebServerRequest* request) {
   request->send(404, "text/plain", "Not found");
 }
@@ -731,12 +935,70 @@ String indexProcess(const String& var) {
   return "";
 }
 
+void sendIndex(AsyncWebServerRequest* req) {
+  if (!indexPage.empty()) {
+    indexPage.send(req, "text/html");
+  } else {
+    req->send(LittleFS, "/index.html", "text/html", false, indexProcess);
+  }
+}
+
 bool headersFix(AsyncWebServerRequest* request) { request->addInterestingHeader("ANY"); return true; };
+// Checks every key of `body` against mqttConfig_t and saves the result as MQTTDATA. The MQTT client
+// only reads its settings in setup(), so they apply after the restart that follows
+void saveMqttConfig(AsyncWebServerRequest* req, const json& body) {
+  const char* TAG = "saveMqttConfig";
+  json merged = espConfig::mqttData;
+  for (auto it = body.begin(); it != body.end(); ++it) {
+    const json& value = it.value();
+    bool valid = merged.contains(it.key()) && (merged.at(it.key()).type() == value.type() || (merged.at(it.key()).is_number() && value.is_number_unsigned()));
+    if (valid && it.key() == "mqttPort") {
+      valid = value > 0 && value <= UINT16_MAX;
+    } else if (valid && it.key() == "customLockActions") {
+      valid = std::all_of(value.begin(), value.end(), [](const json& v) { return v.is_number_integer(); });
+    }
+    if (!valid) {
+      LOG(E, "\"%s\" could not validate!", it.key().c_str());
+      std::string msg = "\"\" is not a valid value for \"\"";
+      msg.insert(1, value.dump().c_str()).insert(msg.length() - 1, it.key());
+      req->send(400, "text/plain", msg.c_str());
+      return;
+    }
+    merged[it.key()] = value;
+  }
+  std::vector<uint8_t> blob = json::to_msgpack(merged);
+  esp_err_t err = nvs_set_blob(savedData, "MQTTDATA", blob.data(), blob.size());
+  if (err == ESP_OK) {
+    err = nvs_commit(savedData);
+  }
+  if (err != ESP_OK) {
+    LOG(E, "Could not save the MQTT config: %s", esp_err_to_name(err));
+    req->send(500, "text/plain", "Could not save to NVS");
+    return;
+  }
+  req->send(200, "text/plain", "Saved! Restarting...");
+  vTaskDelay(1000 / portTICK_PERIOD_MS);
+  ESP.restart();
+}
+
 void setupWeb() {
-  auto assetsHandle = new AsyncStaticWebHandler("/assets", LittleFS, "/assets/", NULL);
+  if (webManifest.empty()) {
+    webManifest = webAssets::loadManifest(LittleFS);
+  }
+  if (indexPage.empty() && indexPage.render(LittleFS, "/index.html", indexProcess)) {
+    LOG(I, "Index page rendered, %u bytes", unsigned(indexPage.size()));
+  }
+  AsyncWebHandler* assetsHandle;
+  AsyncWebHandler* routesHandle;
+  if (!webManifest.empty()) {
+    assetsHandle = new webAssets::AssetHandler("/assets", LittleFS, "/assets", webManifest);
+    routesHandle = new webAssets::AssetHandler("/fragment", LittleFS, "/routes", webManifest);
+  } else {
+    assetsHandle = new AsyncStaticWebHandler("/assets", LittleFS, "/assets/", NULL);
+    routesHandle = new AsyncStaticWebHandler("/fragment", LittleFS, "/routes", NULL);
+  }
   assetsHandle->setFilter(headersFix);
   webServer.addHandler(assetsHandle);
-  auto routesHandle = new AsyncStaticWebHandler("/fragment", LittleFS, "/routes", NULL);
   routesHandle->setFilter(headersFix);
   webServer.addHandler(routesHandle);
   AsyncCallbackWebHandler* dataProvision = new AsyncCallbackWebHandler();
@@ -747,42 +1009,26 @@ void setupWeb() {
     if (req->hasParam("type")) {
       json serializedData;
       AsyncWebParameter* data = req->getParam(0);
-      std::array<std::string, 3> pages = {"actions", "misc", "hkinfo"};
+      std::array<std::string, 4> pages = {"actions", "misc", "hkinfo", "mqtt"};
       if (std::equal(data->value().begin(), data->value().end(),pages[0].begin(), pages[0].end()) || std::equal(data->value().begin(), data->value().end(),pages[1].begin(), pages[1].end())) {
         LOG(D, "ACTIONS CONFIG REQ");
         serializedData = espConfig::miscConfig;
+      } else if (std::equal(data->value().begin(), data->value().end(),pages[3].begin(), pages[3].end())) {
+        LOG(D, "MQTT CONFIG REQ");
+        serializedData = espConfig::mqttData;
+        // write-only, a save without it keeps the stored one
+        serializedData.erase("mqttPassword");
       } else if (std::equal(data->value().begin(), data->value().end(),pages[2].begin(), pages[2].end())) {
         LOG(D, "HK DATA REQ");
-        json inputData = readerData;
-        if (inputData.contains("group_identifier")) {
-          serializedData["group_identifier"] = red_log::bufToHexString(readerData.reader_gid.data(), readerData.reader_gid.size(), true);
-        }
-        if (inputData.contains("unique_identifier")) {
-          serializedData["unique_identifier"] = red_log::bufToHexString(readerData.reader_id.data(), readerData.reader_id.size(), true);
-        }
-        if (inputData.contains("issuers")) {
-          serializedData["issuers"] = json::array();
-          for (auto it = inputData.at("issuers").begin(); it != inputData.at("issuers").end(); ++it)
-          {
-            json issuer;
-            if (it.value().contains("issuerId")) {
-              std::vector<uint8_t> id = it.value().at("issuerId").get<std::vector<uint8_t>>();
-              issuer["issuerId"] = red_log::bufToHexString(id.data(), id.size(), true);
-            }
-            if (it.value().contains("endpoints") && it.value().at("endpoints").size() > 0) {
-              issuer["endpoints"] = json::array();
-              for (auto it2 = it.value().at("endpoints").begin(); it2 != it.value().at("endpoints").end(); ++it2) {
-                json endpoint;
-                if (it2.value().contains("endpointId")) {
-                  std::vector<uint8_t> id = it2.value().at("endpointId").get<std::vector<uint8_t>>();
-                  endpoint["endpointId"] = red_log::bufToHexString(id.data(), id.size(), true);
-                }
-                issuer["endpoints"].push_back(endpoint);
-              }
-            }
-            serializedData["issuers"].push_back(issuer);
-          }
-        }
+        size_t offset = req->hasParam("offset") ? std::max(0L, req->getParam("offset")->value().toInt()) : 0;
+        size_t limit = req->hasParam("limit") ? std::max(0L, req->getParam("limit")->value().toInt()) : 0;
+        // the response is sent over several callbacks, the pin keeps the version it started with alive
+        readerState::pin_t snapshot = readerState.pin();
+        auto writer = std::make_shared<HkInfoWriter>(snapshot->data, offset, limit);
+        req->send(req->beginChunkedResponse("application/json", [writer, snapshot](uint8_t* buffer, size_t maxLen, size_t index) -> size_t {
+          return writer->fill(buffer, maxLen);
+        }));
+        return;
       } else {
         req->send(400);
         return;
@@ -815,17 +1061,23 @@ void setupWeb() {
   dataClear->onRequest([](AsyncWebServerRequest* req) {
     if (req->hasParam("type")) {
       AsyncWebParameter* data = req->getParam(0);
-      std::array<std::string, 2> pages = { "actions", "misc" };  // Remove "mqtt" from pages array
+      std::array<std::string, 3> pages = { "actions", "misc", "mqtt" };
       if (std::equal(data->value().begin(), data->value().end(), pages[0].begin(), pages[0].end())) {
         LOG(D, "ACTIONS CONFIG SEL");
-        nvs_erase_key(savedData, "MISCDATA");
+        miscStore.erase();
         espConfig::miscConfig = {};
         req->send(200, "text/plain", "200 Success");
       } else if (std::equal(data->value().begin(), data->value().end(), pages[1].begin(), pages[1].end())) {
         LOG(D, "MISC CONFIG SEL");
-        nvs_erase_key(savedData, "MISCDATA");
+        miscStore.erase();
         espConfig::miscConfig = {};
         req->send(200, "text/plain", "200 Success");
+      } else if (std::equal(data->value().begin(), data->value().end(), pages[2].begin(), pages[2].end())) {
+        LOG(D, "MQTT CONFIG SEL");
+        nvs_erase_key(savedData, "MQTTDATA");
+        nvs_commit(savedData);
+        espConfig::mqttData = {};
+        req->send(200, "text/plain", "200 Success");
       } else {
         req->send(400);
         return;
@@ -840,38 +1092,47 @@ void setupWeb() {
   dataLoad->setUri("/config/save");
   dataLoad->setMethod(HTTP_POST);
   dataLoad->onBody([](AsyncWebServerRequest* request, uint8_t* data, size_t len, size_t index, size_t total) {
-    json *dataJson = new json(json::parse(data, data + len));
-    if (!dataJson->is_discarded()) {
-      LOG(I, "%s", dataJson->dump().c_str());
-      request->_tempObject = dataJson;
+    if (index == 0 && webBody.begin(request, total)) {
+      request->onDisconnect([request]() { webBody.release(request); });
     }
+    webBody.append(request, data, len, index);
   });
   dataLoad->onRequest([=](AsyncWebServerRequest* req) {
-    json *serializedData = static_cast<json*>(req->_tempObject);
-    if (req->hasParam("type") && serializedData) {
+    json serializedData;
+    auto bodyStatus = webBody.take(req, serializedData);
+    if (bodyStatus != BodyArena<WEB_BODY_MAX_SIZE>::READY) {
+      const char* reasons[] = { "", "Missing request body", "Request body too large", "Busy, try again", "Malformed JSON" };
+      LOG(E, "Config body rejected: %s", reasons[bodyStatus]);
+      req->send(bodyStatus == BodyArena<WEB_BODY_MAX_SIZE>::TOO_LARGE ? 413 : bodyStatus == BodyArena<WEB_BODY_MAX_SIZE>::BUSY ? 503 : 400, "text/plain", reasons[bodyStatus]);
+      return;
+    }
+    LOG(D, "%s", serializedData.dump().c_str());
+    if (req->hasParam("type") && serializedData.is_object()) {
       AsyncWebParameter* data = req->getParam(0);
-      json configData;
-      std::array<std::string, 2> pages = { "actions", "misc" };  // Remove mqtt
+      espConfig::misc_config_t configData = espConfig::miscConfig;
+      std::array<std::string, 3> pages = { "actions", "misc", "mqtt" };
       uint8_t selConfig;
       if (std::equal(data->value().begin(), data->value().end(), pages[0].begin(), pages[0].end())) {
         LOG(D, "ACTIONS CONFIG SEL");
-        configData = espConfig::miscConfig;
         selConfig = 0;
       } else if (std::equal(data->value().begin(), data->value().end(), pages[1].begin(), pages[1].end())) {
         LOG(D, "MISC CONFIG SEL");
-        configData = espConfig::miscConfig;
         selConfig = 1;
+      } else if (std::equal(data->value().begin(), data->value().end(), pages[2].begin(), pages[2].end())) {
+        LOG(D, "MQTT CONFIG SEL");
+        saveMqttConfig(req, serializedData);
+        return;
       } else {
         req->send(400);
         return;
       }
       uint8_t propertiesProcessed = 0;
-      for (auto it = serializedData->begin(); it != serializedData->end(); ++it) {
-        if (configData.contains(it.key()) && ((configData.at(it.key()).type() == it.value().type()) || configData.at(it.key()).is_boolean())) {
+      for (auto it = serializedData.begin(); it != serializedData.end(); ++it) {
+        if (configStore::check(configData, it.key(), it.value()) == configStore::ASSIGNED) {
           if (it.key() == std::string("setupCode")) {
             std::string code = it.value().template get<std::string>();
             if (it.value().is_string() && (!code.empty() && std::find_if(code.begin(), code.end(), [](unsigned char c) { return !std::isdigit(c); }) == code.end()) && it.value().template get<std::string>().length() == 8) {
-              if (homeSpan.controllerListBegin() != homeSpan.controllerListEnd() && code.compare(configData.at(it.key()).template get<std::string>())) {
+              if (homeSpan.controllerListBegin() != homeSpan.controllerListEnd() && code.compare(configData.setupCode)) {
                 LOG(E, "The Setup Code can only be set if no devices are paired, reset if any issues!");
                 req->send(400, "text/plain", "The Setup Code can only be set if no devices are paired, reset if any issues!");
                 break;
@@ -900,15 +1161,6 @@ void setupWeb() {
                 break;
             }
           }
-          if (configData.at(it.key()).is_boolean() && it.value().is_number()) {
-            it.value() = static_cast<bool>(it.value().template get<uint8_t>());
-          } else if(configData.at(it.key()).is_boolean() && !it.value().is_number()) {
-            LOG(E, "\"%s\" could not validate!", it.key().c_str());
-            std::string msg = "\"\" is not a valid value for \"\"";
-            msg.insert(1, it.value().dump().c_str()).insert(msg.length() - 1, it.key());
-            req->send(400, "text/plain", msg.c_str());
-            break;
-          }
           propertiesProcessed++;
         } else {
           LOG(E, "\"%s\" could not validate!", it.key().c_str());
@@ -918,7 +1170,7 @@ void setupWeb() {
           break;
         }
       }
-      if (propertiesProcessed != serializedData->size()) {
+      if (propertiesProcessed != serializedData.size()) {
         LOG(E, "Not all properties could be validated, cannot continue!");
         if(!req->client()->disconnected() || !req->client()->disconnecting()) {
           req->send(500, "text/plain", "Something went wrong!");
@@ -927,16 +1179,8 @@ void setupWeb() {
       }
       bool rebootNeeded = false;
       std::string rebootMsg;
-      for (auto it = serializedData->begin(); it != serializedData->end(); ++it) {
-        if (it.key() == std::string("nfcTagNoPublish") && (it.value() != 0)) {
-          std::string clientId;
-          if (serializedData->contains("mqttClientId")) {
-            clientId = serializedData->at("mqttClientId");
-          }
-          std::string rfidTopic;
-          rfidTopic.append("homeassistant/tag/").append(!clientId.empty() ? clientId : espConfig::mqttData.mqttClientId).append("/rfid/config");
-          esp_mqtt_client_publish(client, rfidTopic.c_str(), "", 0, 0, false);
-        } else if (it.key() == std::string("setupCode")) {
+      for (auto it = serializedData.begin(); it != serializedData.end(); ++it) {
+        if (it.key() == std::string("setupCode")) {
           std::string code = it.value().template get<std::string>();
           if (espConfig::miscConfig.setupCode.c_str() != it.value() && code.length() == 8) {
             if (homeSpan.controllerListBegin() == homeSpan.controllerListEnd()) {
@@ -944,40 +1188,15 @@ void setupWeb() {
             }
           }
         } else if (it.key() == std::string("nfcNeopixelPin")) {
-          if (espConfig::miscConfig.nfcNeopixelPin == 255 && it.value() != 255 && neopixel_task_handle == nullptr) {
-            xTaskCreate(neopixel_task, "neopixel_task", 4096, NULL, 2, &neopixel_task_handle);
-            if (!pixel) {
-              pixel = std::make_shared<Pixel>(it.value(), PixelType::GRB);
-            }
-          } else if (espConfig::miscConfig.nfcNeopixelPin != 255 && it.value() == 255 && neopixel_task_handle != nullptr) {
-            uint8_t status = 2;
-            xQueueSend(neopixel_handle, &status, 0);
-            neopixel_task_handle = nullptr;
+          if (espConfig::miscConfig.nfcNeopixelPin == 255 && it.value() != 255 && !pixel) {
+            pixel = std::make_shared<Pixel>(it.value(), PixelType::GRB);
           }
         } else if (it.key() == std::string("nfcSuccessPin")) {
-          if (espConfig::miscConfig.nfcSuccessPin == 255 && it.value() != 255 && gpio_led_task_handle == nullptr) {
-            pinMode(it.value(), OUTPUT);
-            xTaskCreate(nfc_gpio_task, "nfc_gpio_task", 4096, NULL, 2, &gpio_led_task_handle);
-          } else if (espConfig::miscConfig.nfcSuccessPin != 255 && it.value() == 255 && gpio_led_task_handle != nullptr) {
-            if (serializedData->contains("nfcFailPin") && serializedData->at("nfcFailPin") == 255) {
-              uint8_t status = 2;
-              xQueueSend(gpio_led_handle, &status, 0);
-              gpio_led_task_handle = nullptr;
-            }
-          } else if (it.value() != 255) {
+          if (it.value() != 255) {
             pinMode(it.value(), OUTPUT);
           }
         } else if (it.key() == std::string("nfcFailPin")) {
-          if (espConfig::miscConfig.nfcFailPin == 255 && it.value() != 255 && gpio_led_task_handle == nullptr) {
-            pinMode(it.value(), OUTPUT);
-            xTaskCreate(nfc_gpio_task, "nfc_gpio_task", 4096, NULL, 2, &gpio_led_task_handle);
-          } else if (espConfig::miscConfig.nfcFailPin != 255 && it.value() == 255 && gpio_led_task_handle != nullptr) {
-            if (serializedData->contains("nfcSuccessPin") && serializedData->at("nfcSuccessPin") == 255) {
-              uint8_t status = 2;
-              xQueueSend(gpio_led_handle, &status, 0);
-              gpio_led_task_handle = nullptr;
-            }
-          } else if (it.value() != 255) {
+          if (it.value() != 255) {
             pinMode(it.value(), OUTPUT);
           }
         } else if (it.key() == std::string("btrLowStatusThreshold")) {
@@ -987,10 +1206,11 @@ void setupWeb() {
             } else {
               statusLowBtr->setVal(0);
             }
+            pushBatteryEvent();
           }
         } else if (it.key() == std::string("neoPixelType")) {
           uint8_t pixelType = it.value().template get<uint8_t>();
-          if (pixelType != configData.at(it.key()).template get<uint8_t>()) {
+          if (pixelType != configData.neoPixelType) {
             rebootNeeded = true;
             rebootMsg = "Pixel Type was changed, reboot needed! Rebooting...";
           }
@@ -998,38 +1218,24 @@ void setupWeb() {
           if (espConfig::miscConfig.gpioActionPin == 255 && it.value() != 255 ) {
             LOG(D, "ENABLING HomeKit Trigger - Simple GPIO");
             pinMode(it.value(), OUTPUT);
-            if(gpio_lock_task_handle == nullptr){
-              xTaskCreate(gpio_task, "gpio_task", 4096, NULL, 2, &gpio_lock_task_handle);
-            }
             if(espConfig::miscConfig.hkDumbSwitchMode){
-              serializedData->at("hkDumbSwitchMode") = false;
+              configData.hkDumbSwitchMode = false;
+              if (serializedData.contains("hkDumbSwitchMode")) {
+                serializedData.at("hkDumbSwitchMode") = false;
+              }
             }
           } else if (espConfig::miscConfig.gpioActionPin != 255 && it.value() == 255) {
             LOG(D, "DISABLING HomeKit Trigger - Simple GPIO");
-            if( gpio_lock_task_handle != nullptr){
-              gpioLockAction status{ .source = gpioLockAction::OTHER, .action = 2 };
-              xQueueSend(gpio_lock_handle, &status, 0);
-              gpio_lock_task_handle = nullptr;
-            }
+            actuators.pulseCancel(actuator::P_MOMENTARY);
             gpio_reset_pin(gpio_num_t(espConfig::miscConfig.gpioActionPin));
           }
-        } else if (it.key() == std::string("hkDumbSwitchMode") && gpio_lock_task_handle == nullptr) {
-          xTaskCreate(gpio_task, "gpio_task", 4096, NULL, 2, &gpio_lock_task_handle);
         }
-        configData.at(it.key()) = it.value();
+        configStore::assign(configData, it.key(), it.value());
       }
-      std::vector<uint8_t> vectorData = json::to_msgpack(configData);
-      esp_err_t set_nvs = nvs_set_blob(savedData, selConfig == 0 ? "MQTTDATA" : "MISCDATA", vectorData.data(), vectorData.size());
-      esp_err_t commit_nvs = nvs_commit(savedData);
-      LOG(D, "SET_STATUS: %s", esp_err_to_name(set_nvs));
-      LOG(D, "COMMIT_STATUS: %s", esp_err_to_name(commit_nvs));
-      if (set_nvs == ESP_OK && commit_nvs == ESP_OK) {
-        LOG(I, "Config successfully saved to NVS");
-        if (selConfig == 0) {
-          configData.get_to<espConfig::mqttConfig_t>(espConfig::mqttData);
-        } else {
-          configData.get_to<espConfig::misc_config_t>(espConfig::miscConfig);
-        }
+      int changedFields = miscStore.save(configData);
+      if (changedFields >= 0) {
+        LOG(I, "Config successfully saved to NVS, %d field(s) changed", changedFields);
+        espConfig::miscConfig = configData;
       } else {
         LOG(E, "Something went wrong, could not save to NVS");
       }
@@ -1044,6 +1250,8 @@ void setupWeb() {
           req->send(200, "text/plain", "Saved and applied!");
         }
       }
+    } else {
+      req->send(400);
     }
   });
   auto rebootDeviceHandle = new AsyncCallbackWebHandler();
@@ -1092,19 +1300,28 @@ void setupWeb() {
     request->send(200, "text/plain", rssi_val.c_str());
     });
   webServer.addHandler(getWifiRssi);
+  auto tapTraceHandle = new AsyncCallbackWebHandler();
+  tapTraceHandle->setUri("/tap_trace");
+  tapTraceHandle->setMethod(HTTP_GET);
+  tapTraceHandle->onRequest([](AsyncWebServerRequest* request) {
+    request->send(200, "application/json", tapTraceStats().dump().c_str());
+    });
+  webServer.addHandler(tapTraceHandle);
   AsyncCallbackWebHandler* rootHandle = new AsyncCallbackWebHandler();
   webServer.addHandler(rootHandle);
   rootHandle->setUri("/");
   rootHandle->setMethod(HTTP_GET);
+  rootHandle->setFilter(headersFix);
   rootHandle->onRequest([](AsyncWebServerRequest* req) {
-    req->send(LittleFS, "/index.html", "text/html", false, indexProcess);
+    sendIndex(req);
   });
   AsyncCallbackWebHandler* hashPage = new AsyncCallbackWebHandler();
   webServer.addHandler(hashPage);
   hashPage->setUri("/#*");
   hashPage->setMethod(HTTP_GET);
+  hashPage->setFilter(headersFix);
   hashPage->onRequest([](AsyncWebServerRequest* req) {
-    req->send(LittleFS, "/index.html", "text/html", false, indexProcess);
+    sendIndex(req);
   });
   if (espConfig::miscConfig.webAuthEnabled) {
     LOG(I, "Web Authentication Enabled");
@@ -1117,8 +1334,14 @@ void setupWeb() {
     resetHkHandle->setAuthentication(espConfig::miscConfig.webUsername.c_str(), espConfig::miscConfig.webPassword.c_str());
     resetWifiHandle->setAuthentication(espConfig::miscConfig.webUsername.c_str(), espConfig::miscConfig.webPassword.c_str());
     getWifiRssi->setAuthentication(espConfig::miscConfig.webUsername.c_str(), espConfig::miscConfig.webPassword.c_str());
+    tapTraceHandle->setAuthentication(espConfig::miscConfig.webUsername.c_str(), espConfig::miscConfig.webPassword.c_str());
     startConfigAP->setAuthentication(espConfig::miscConfig.webUsername.c_str(), espConfig::miscConfig.webPassword.c_str());
     ethSuppportConfig->setAuthentication(espConfig::miscConfig.webUsername.c_str(), espConfig::miscConfig.webPassword.c_str());
+    events.setAuthentication(espConfig::miscConfig.webUsername.c_str(), espConfig::miscConfig.webPassword.c_str());
+  }
+  webServer.addHandler(&events);
+  if (!event_task_handle) {
+    xTaskCreate(event_task, "event_task", 4096, NULL, 1, &event_task_handle);
   }
   webServer.onNotFound(notFound);
   webServer.begin();
@@ -1127,6 +1350,142 @@ void setupWeb() {
 void wifiCallback(int status) {
   if (status == 1) {
     setupWeb();
+    mqtt.begin(espConfig::mqttData, platform_create_id_string());
+  }
+}
+
+void hkAuthSuccess(const std::tuple<std::vector<uint8_t>, std::vector<uint8_t>, KeyFlow>& authResult) {
+  if (espConfig::miscConfig.nfcSuccessPin != 255) {
+    actuators.send(actuator::cmd_t::NFC_GPIO, 1);
+  }
+  if (espConfig::miscConfig.nfcNeopixelPin != 255) {
+    actuators.send(actuator::cmd_t::NEOPIXEL, 1);
+  }
+  if ((espConfig::miscConfig.gpioActionPin != 255 && espConfig::miscConfig.hkGpioControlledState) || espConfig::miscConfig.hkDumbSwitchMode) {
+    tapTracer.queued();
+    actuators.send(actuator::cmd_t::LOCK, gpioLockAction::HOMEKEY);
+  }
+  if (espConfig::miscConfig.hkAltActionInitPin != 255 && espConfig::miscConfig.hkAltActionPin != 255) {
+    actuators.send(actuator::cmd_t::NFC_GPIO, 2);
+  }
+  if (hkAltActionActive) {
+    mqtt.publish(mqttPublisher::ALT_ACTION, "alt_action");
+  }
+  const std::vector<uint8_t>& issuerId = std::get<0>(authResult);
+  const std::vector<uint8_t>& endpointId = std::get<1>(authResult);
+  readerState::pin_t snapshot = readerState.pin();
+  tapEvent::EventBuffer<> payload;
+  payload.hex("endpointId", endpointId.data(), endpointId.size())
+    .boolean("homekey", true)
+    .hex("issuerId", issuerId.data(), issuerId.size())
+    .hex("readerId", snapshot->data.reader_id.data(), snapshot->data.reader_id.size());
+  const char* payloadStr = payload.finish();
+  mqtt.publish(mqttPublisher::HK_AUTH, payloadStr);
+  eventPush("tap", payloadStr);
+  if (espConfig::miscConfig.lockAlwaysUnlock) {
+    if (espConfig::miscConfig.gpioActionPin == 255 || !espConfig::miscConfig.hkGpioControlledState) {
+      setLockCurrentState(lockStates::UNLOCKED);
+      tapTracer.stateSet();
+      lockTargetState->setVal(lockStates::UNLOCKED);
+    }
+  } else if (espConfig::miscConfig.lockAlwaysLock) {
+    if (espConfig::miscConfig.gpioActionPin == 255 || espConfig::miscConfig.hkGpioControlledState) {
+      setLockCurrentState(lockStates::LOCKED);
+      tapTracer.stateSet();
+      lockTargetState->setVal(lockStates::LOCKED);
+    }
+  } else {
+    int currentState = lockCurrentState->getVal();
+    if (espConfig::mqttData.lockEnableCustomState) {
+      if (currentState == lockStates::UNLOCKED) {
+        mqttPublishNumber(mqttPublisher::LOCK_CUSTOM_STATE, espConfig::mqttData.customLockActions["LOCK"], 0, false);
+      } else if (currentState == lockStates::LOCKED) {
+        mqttPublishNumber(mqttPublisher::LOCK_CUSTOM_STATE, espConfig::mqttData.customLockActions["UNLOCK"], 0, false);
+      }
+    }
+  }
+}
+
+void hkAuthFailure() {
+  if (espConfig::miscConfig.nfcFailPin != 255) {
+    actuators.send(actuator::cmd_t::NFC_GPIO, 0);
+  }
+  if (espConfig::miscConfig.nfcNeopixelPin != 255) {
+    actuators.send(actuator::cmd_t::NEOPIXEL, 0);
+  }
+}
+
+void hkTapFailed() {
+  hkAuthFailure();
+  tapEvent::EventBuffer<> payload;
+  eventPush("tap", payload.boolean("homekey", true).boolean("success", false).finish());
+  LOG(W, "We got status FlowFailed, mqtt untouched!");
+}
+
+void tagPublishUid(const uint8_t* uid, uint8_t uidLen, const uint8_t* atqa, const uint8_t* sak) {
+  hkAuthFailure();
+  tapEvent::EventBuffer<> payload;
+  payload.hex("atqa", atqa, 2).boolean("homekey", false).hex("sak", sak, 1).hex("uid", uid, uidLen);
+  const char* payload_dump = payload.finish();
+  mqtt.publish(mqttPublisher::HK_AUTH, payload_dump);
+  eventPush("tap", payload_dump);
+}
+
+// With the IRQ line wired the PN532 keeps searching on its own and signals a found target through it,
+// otherwise every poll gives up after a single activation attempt
+uint8_t nfcIdleRetries() {
+  return espConfig::miscConfig.nfcIrqPin != 255 ? 0xFF : 0;
+}
+
+void IRAM_ATTR nfc_irq_isr() {
+  BaseType_t higherPriorityTaskWoken = pdFALSE;
+  vTaskNotifyGiveFromISR(nfc_poll_task, &higherPriorityTaskWoken);
+  portYIELD_FROM_ISR(higherPriorityTaskWoken);
+}
+
+// Aborts the command the PN532 is processing with an ACK frame. PN532_SPI has no call for a bare
+// ACK, so the frame goes out on the SPI bus it set up, behind the data write byte
+void nfcAbortSearch() {
+  SPI.beginTransaction(SPISettings(1000000, LSBFIRST, SPI_MODE0));
+  digitalWrite(espConfig::miscConfig.nfcGpioPins[0], LOW);
+  delay(1);
+  SPI.transfer(0x01);
+  for (uint8_t b : nfcFrame::ackFrame) SPI.transfer(b);
+  digitalWrite(espConfig::miscConfig.nfcGpioPins[0], HIGH);
+  SPI.endTransaction();
+}
+
+// Target from the response of the search started by nfcIrqPoll, if the PN532 has one
+bool nfcReadSearch(tapPipeline::target_t& target, uint16_t timeoutMs) {
+  uint8_t res[32];
+  int16_t len = pn532spi->readResponse(res, sizeof(res), timeoutMs);
+  return nfcFrame::inListTarget(res, len, target.uid, sizeof(target.uid), &target.uidLen, target.atqa, target.sak);
+}
+
+// One ECP cycle with the IRQ line wired: the PN532 searches on its own after the ECP frame and
+// pulls the line once a target answered, its response is read and the tap runs on that target.
+// Without a target by NFC_IRQ_ECP_INTERVAL the search is aborted so the ECP frame can go out again.
+void nfcIrqPoll() {
+  uint32_t ecpUs = nfcPipeline->broadcast(ecpFrame);
+  uint32_t detectStart = tapTrace::now();
+  if (pn532spi->writeCommand(nfcFrame::inListPassiveTarget.data(), nfcFrame::inListPassiveTarget.size()) != 0) {
+    LOG(W, "Could not start the target search");
+    vTaskDelay(50 / portTICK_PERIOD_MS);
+    return;
+  }
+  // drop the edge of the command's ACK frame, writeCommand already read it
+  ulTaskNotifyTake(pdTRUE, 0);
+  tapPipeline::target_t target;
+  bool found = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(NFC_IRQ_ECP_INTERVAL)) && nfcReadSearch(target, 10);
+  if (!found) {
+    nfcAbortSearch();
+    // drain a response the PN532 had ready right before the abort, that target is still taken
+    found = nfcReadSearch(target, 1);
+    ulTaskNotifyTake(pdTRUE, 0);
+  }
+  if (found) {
+    LOG(D, "PN532 IRQ, target in field");
+    nfcPipeline->tap(target, ecpUs, tapTrace::now() - detectStart);
   }
 }
 
@@ -1145,7 +1504,7 @@ void nfc_retry(void* arg) {
       ESP_LOGI("NFC_SETUP", "Firmware ver. %d.%d", maj, min);
       nfc->SAMConfig();
       nfc->setRFField(0x02, 0x01);
-      nfc->setPassiveActivationRetries(0);
+      nfc->setPassiveActivationRetries(nfcIdleRetries());
       ESP_LOGI("NFC_SETUP", "Waiting for an ISO14443A card");
       vTaskResume(nfc_poll_task);
       vTaskDelete(NULL);
@@ -1171,14 +1530,17 @@ void nfc_thread_entry(void* arg) {
     ESP_LOGI("NFC_SETUP", "Firmware ver. %d.%d", maj, min);
     nfc->SAMConfig();
     nfc->setRFField(0x02, 0x01);
-    nfc->setPassiveActivationRetries(0);
+    nfc->setPassiveActivationRetries(nfcIdleRetries());
     ESP_LOGI("NFC_SETUP", "Waiting for an ISO14443A card");
   }
-  memcpy(ecpData + 8, readerData.reader_gid.data(), readerData.reader_gid.size());
-  with_crc16(ecpData, 16, ecpData + 16);
+  bool irqMode = espConfig::miscConfig.nfcIrqPin != 255;
+  if (irqMode) {
+    LOG(I, "PN532 IRQ on GPIO %d, polling is interrupt-driven", espConfig::miscConfig.nfcIrqPin);
+    pinMode(espConfig::miscConfig.nfcIrqPin, INPUT_PULLUP);
+    attachInterrupt(espConfig::miscConfig.nfcIrqPin, nfc_irq_isr, FALLING);
+  }
+  ecpFrame.update(readerState.pin()->data.reader_gid);
   while (1) {
-    uint8_t res[4];
-    uint16_t resLen = 4;
     bool writeStatus = nfc->writeRegister(0x633d, 0, true);
     if (!writeStatus) {
       LOG(W, "writeRegister has failed, abandoning ship !!");
@@ -1186,129 +1548,12 @@ void nfc_thread_entry(void* arg) {
       xTaskCreate(nfc_retry, "nfc_reconnect_task", 8192, NULL, 1, &nfc_reconnect_task);
       vTaskSuspend(NULL);
     }
-    nfc->inCommunicateThru(ecpData, sizeof(ecpData), res, &resLen, 100, true);
-    uint8_t uid[16];
-    uint8_t uidLen = 0;
-    uint8_t atqa[2];
-    uint8_t sak[1];
-    bool passiveTarget = nfc->readPassiveTargetID(PN532_MIFARE_ISO14443A, uid, &uidLen, atqa, sak, 500, true, true);
-    if (passiveTarget) {
-      nfc->setPassiveActivationRetries(5);
-      LOG(D, "ATQA: %02x", atqa[0]);
-      LOG(D, "SAK: %02x", sak[0]);
-      ESP_LOG_BUFFER_HEX_LEVEL(TAG, uid, (size_t)uidLen, ESP_LOG_VERBOSE);
-      LOG(I, "*** PASSIVE TARGET DETECTED ***");
-      auto startTime = std::chrono::high_resolution_clock::now();
-      uint8_t data[13] = { 0x00, 0xA4, 0x04, 0x00, 0x07, 0xA0, 0x00, 0x00, 0x08, 0x58, 0x01, 0x01, 0x0 };
-      uint8_t selectCmdRes[9];
-      uint16_t selectCmdResLength = 9;
-      LOG(I, "Requesting supported HomeKey versions");
-      LOG(D, "SELECT HomeKey Applet, APDU: ");
-      ESP_LOG_BUFFER_HEX_LEVEL(TAG, data, sizeof(data), ESP_LOG_VERBOSE);
-      bool status = nfc->inDataExchange(data, sizeof(data), selectCmdRes, &selectCmdResLength);
-      LOG(D, "SELECT HomeKey Applet, Response");
-      ESP_LOG_BUFFER_HEX_LEVEL(TAG, selectCmdRes, selectCmdResLength, ESP_LOG_VERBOSE);
-      if (status && selectCmdRes[selectCmdResLength - 2] == 0x90 && selectCmdRes[selectCmdResLength - 1] == 0x00) {
-        LOG(D, "*** SELECT HOMEKEY APPLET SUCCESSFUL ***");
-        LOG(D, "Reader Private Key: %s", red_log::bufToHexString(readerData.reader_pk.data(), readerData.reader_pk.size()).c_str());
-        HKAuthenticationContext authCtx([](uint8_t* s, uint8_t l, uint8_t* r, uint16_t* rl, bool il) -> bool {return nfc->inDataExchange(s, l, r, rl, il);}, readerData, savedData);
-        auto authResult = authCtx.authenticate(hkFlow);
-        if (std::get<2>(authResult) != kFlowFailed) {
-          bool status = true;
-          if (espConfig::miscConfig.nfcSuccessPin != 255) {
-            xQueueSend(gpio_led_handle, &status, 0);
-          }
-          if (espConfig::miscConfig.nfcNeopixelPin != 255) {
-            xQueueSend(neopixel_handle, &status, 0);
-          }
-          if ((espConfig::miscConfig.gpioActionPin != 255 && espConfig::miscConfig.hkGpioControlledState) || espConfig::miscConfig.hkDumbSwitchMode) {
-            const gpioLockAction action{ .source = gpioLockAction::HOMEKEY, .action = 0 };
-            xQueueSend(gpio_lock_handle, &action, 0);
-          }
-          if (espConfig::miscConfig.hkAltActionInitPin != 255 && espConfig::miscConfig.hkAltActionPin != 255) {
-            uint8_t status = 2;
-            xQueueSend(gpio_led_handle, &status, 0);
-          }
-          if (hkAltActionActive) {
-            // mqtt_publish(espConfig::mqttData.hkAltActionTopic, "alt_action", 0, false);
-          }
-          json payload;
-          payload["issuerId"] = hex_representation(std::get<0>(authResult));
-          payload["endpointId"] = hex_representation(std::get<1>(authResult));
-          payload["readerId"] = hex_representation(readerData.reader_id);
-          payload["homekey"] = true;
-          std::string payloadStr = payload.dump();
-          // mqtt_publish(espConfig::mqttData.hkTopic, payloadStr, 0, false);
-          if (espConfig::miscConfig.lockAlwaysUnlock) {
-            if (espConfig::miscConfig.gpioActionPin == 255 || !espConfig::miscConfig.hkGpioControlledState) {
-              lockCurrentState->setVal(lockStates::UNLOCKED);
-              lockTargetState->setVal(lockStates::UNLOCKED);
-              // mqtt_publish(espConfig::mqttData.lockStateTopic, std::to_string(lockStates::UNLOCKED), 1, true);
-            }
-          } else if (espConfig::miscConfig.lockAlwaysLock) {
-            if (espConfig::miscConfig.gpioActionPin == 255 || espConfig::miscConfig.hkGpioControlledState) {
-              lockCurrentState->setVal(lockStates::LOCKED);
-              lockTargetState->setVal(lockStates::LOCKED);
-              // mqtt_publish(espConfig::mqttData.lockStateTopic, std::to_string(lockStates::LOCKED), 1, true);
-            }
-          } else {
-            int currentState = lockCurrentState->getVal();
-            if (espConfig::mqttData.lockEnableCustomState) {
-              if (currentState == lockStates::UNLOCKED) {
-                // mqtt_publish(espConfig::mqttData.lockCustomStateTopic, std::to_string(espConfig::mqttData.customLockActions["LOCK"]), 0, false);
-              } else if (currentState == lockStates::LOCKED) {
-                // mqtt_publish(espConfig::mqttData.lockCustomStateTopic, std::to_string(espConfig::mqttData.customLockActions["UNLOCK"]), 0, false);
-              }
-            }
-          }
-
-          auto stopTime = std::chrono::high_resolution_clock::now();
-          LOG(I, "Total Time (detection->auth->gpio->mqtt): %lli ms", std::chrono::duration_cast<std::chrono::milliseconds>(stopTime - startTime).count());
-        } else {
-          bool status = false;
-          if (espConfig::miscConfig.nfcFailPin != 255) {
-            xQueueSend(gpio_led_handle, &status, 0);
-          }
-          if (espConfig::miscConfig.nfcNeopixelPin != 255) {
-            xQueueSend(neopixel_handle, &status, 0);
-          }
-          LOG(W, "We got status FlowFailed, mqtt untouched!");
-        }
-        nfc->setRFField(0x02, 0x01);
-      } else if(!espConfig::mqttData.nfcTagNoPublish) {
-        LOG(W, "Invalid Response, probably not Homekey, publishing target's UID");
-        bool status = false;
-        if (espConfig::miscConfig.nfcFailPin != 255) {
-          xQueueSend(gpio_led_handle, &status, 0);
-        }
-        if (espConfig::miscConfig.nfcNeopixelPin != 255) {
-          xQueueSend(neopixel_handle, &status, 0);
-        }
-        json payload;
-        payload["atqa"] = hex_representation(std::vector<uint8_t>(atqa, atqa + 2));
-        payload["sak"] = hex_representation(std::vector<uint8_t>(sak, sak + 1));
-        payload["uid"] = hex_representation(std::vector<uint8_t>(uid, uid + uidLen));
-        payload["homekey"] = false;
-        std::string payload_dump = payload.dump();
-        // mqtt_publish(espConfig::mqttData.hkTopic.c_str(), payload_dump.c_str(), 0, 0, false);
-      }
+    if (irqMode) {
+      nfcIrqPoll();
+    } else {
+      nfcPipeline->poll(ecpFrame, 500);
       vTaskDelay(50 / portTICK_PERIOD_MS);
-      nfc->inRelease();
-      int counter = 50;
-      bool deviceStillInField = nfc->readPassiveTargetID(PN532_MIFARE_ISO14443A, uid, &uidLen);
-      LOG(D, "Target still present: %d", deviceStillInField);
-      while (deviceStillInField) {
-        if (counter == 0) break;
-        vTaskDelay(50 / portTICK_PERIOD_MS);
-        nfc->inRelease();
-        deviceStillInField = nfc->readPassiveTargetID(PN532_MIFARE_ISO14443A, uid, &uidLen);
-        --counter;
-        LOG(D, "Target still present: %d Counter=%d", deviceStillInField, counter);
-      }
-      nfc->inRelease();
-      nfc->setPassiveActivationRetries(0);
     }
-    vTaskDelay(50 / portTICK_PERIOD_MS);
   }
   vTaskDelete(NULL);
   return;
@@ -1343,13 +1588,17 @@ void setup() {
   Serial.begin(115200);
   const esp_app_desc_t* app_desc = esp_app_get_description();
   std::string app_version = app_desc->version;
-  gpio_led_handle = xQueueCreate(2, sizeof(uint8_t));
-  neopixel_handle = xQueueCreate(2, sizeof(uint8_t));
-  gpio_lock_handle = xQueueCreate(2, sizeof(gpioLockAction));
+  actuators.begin({ actuatorCommand, actuatorPulseEnd });
   size_t len;
   const char* TAG = "SETUP";
   nvs_open("SAVED_DATA", NVS_READWRITE, &savedData);
-  if (!nvs_get_blob(savedData, "READERDATA", NULL, &len)) {
+  // HKAuthenticationContext only gets a read-only handle, whatever it changes is saved through readerStore
+  nvs_open("SAVED_DATA", NVS_READONLY, &hkAuthData);
+  readerData_t readerData;
+  if (readerStore.load(readerData)) {
+    LOG(I, "Reader Data loaded from NVS");
+    dropLegacyReaderData();
+  } else if (!nvs_get_blob(savedData, "READERDATA", NULL, &len)) {
     std::vector<uint8_t> savedBuf(len);
     nvs_get_blob(savedData, "READERDATA", savedBuf.data(), &len);
     LOG(D, "NVS READERDATA LENGTH: %d", len);
@@ -1358,31 +1607,68 @@ void setup() {
     if (!data.is_discarded()) {
       data.get_to<readerData_t>(readerData);
       LOG(I, "Reader Data loaded from NVS");
+      if (readerStore.save(readerData)) {
+        LOG(I, "Reader Data migrated to per-record storage");
+        dropLegacyReaderData();
+      }
     }
   }
-  if (!nvs_get_blob(savedData, "MISCDATA", NULL, &len)) {
+  readerState::pin_t snapshot = readerState.replace(std::move(readerData));
+  if (!hkCrypto::knownAnswer()) {
+    LOG(E, "SHA-256 failed its known-answer test, reader identifiers will be wrong!");
+  }
+  uint32_t configLoadStart = tapTrace::now();
+  size_t configLoadHeap = esp_get_free_heap_size();
+  uint8_t miscVersion = miscStore.load(espConfig::miscConfig);
+  if (miscVersion == 0 && !nvs_get_blob(savedData, "MISCDATA", NULL, &len)) {
+    // Config saved as JSON or msgpack by earlier firmware
     std::vector<uint8_t> dataBuf(len);
     nvs_get_blob(savedData, "MISCDATA", dataBuf.data(), &len);
-    std::string str(dataBuf.begin(), dataBuf.end());
     LOG(D, "NVS MISCDATA LENGTH: %d", len);
     ESP_LOG_BUFFER_HEX_LEVEL(TAG, dataBuf.data(), dataBuf.size(), ESP_LOG_VERBOSE);
-    auto isValidJson = nlohmann::json::accept(dataBuf);
-    if (isValidJson) {
-      nlohmann::json data = nlohmann::json::parse(str);
-      if (!data.is_discarded()) {
-        data.get_to<espConfig::misc_config_t>(espConfig::miscConfig);
-        LOG(I, "Misc Config loaded from NVS");
-      }
-    } else {
-      nlohmann::json data = nlohmann::json::from_msgpack(dataBuf);
-      if (!data.is_discarded()) {
-        data.get_to<espConfig::misc_config_t>(espConfig::miscConfig);
-        LOG(I, "Misc Config loaded from NVS");
+    nlohmann::json data = nlohmann::json::parse(dataBuf, nullptr, false);
+    if (data.is_discarded()) {
+      data = nlohmann::json::from_msgpack(dataBuf, true, false);
+    }
+    if (!data.is_discarded() && data.is_object()) {
+      data.get_to<espConfig::misc_config_t>(espConfig::miscConfig);
+      if (miscStore.save(espConfig::miscConfig) >= 0) {
+        nvs_erase_key(savedData, "MISCDATA");
+        nvs_commit(savedData);
+        LOG(I, "Misc Config migrated to the binary format");
       }
     }
+  } else if (miscVersion != 0 && miscVersion != MISC_CONFIG_VERSION) {
+    LOG(I, "Misc Config upgraded from schema v%u to v%u", miscVersion, MISC_CONFIG_VERSION);
+  }
+  if (miscVersion != 0) {
+    LOG(I, "Misc Config loaded from NVS");
+  }
+  LOG(D, "Misc Config load took %" PRIu32 " us, heap delta %d bytes", tapTrace::now() - configLoadStart, int(configLoadHeap) - int(esp_get_free_heap_size()));
+  if (!nvs_get_blob(savedData, "MQTTDATA", NULL, &len)) {
+    std::vector<uint8_t> dataBuf(len);
+    nvs_get_blob(savedData, "MQTTDATA", dataBuf.data(), &len);
+    nlohmann::json data = nlohmann::json::from_msgpack(dataBuf, true, false);
+    if (data.is_discarded()) {
+      data = nlohmann::json::parse(dataBuf, nullptr, false);
+    }
+    if (!data.is_discarded() && data.is_object()) {
+      data.get_to<espConfig::mqttConfig_t>(espConfig::mqttData);
+      LOG(I, "MQTT Config loaded from NVS");
+    }
   }
   pn532spi = new PN532_SPI(espConfig::miscConfig.nfcGpioPins[0], espConfig::miscConfig.nfcGpioPins[1], espConfig::miscConfig.nfcGpioPins[2], espConfig::miscConfig.nfcGpioPins[3]);
   nfc = new PN532(*pn532spi);
+  nfcPipeline = new nfcPipeline_t(*nfc, readerState, readerFlusher, authContexts, hkFlowPolicy, tapRetry, tapTracer, {
+    hkAuthSuccess,
+    hkTapFailed,
+    [](const tapPipeline::target_t& target) {
+      if (!espConfig::mqttData.nfcTagNoPublish) {
+        LOG(W, "Invalid Response, probably not Homekey, publishing target's UID");
+        tagPublishUid(target.uid, target.uidLen, target.atqa, target.sak);
+      }
+    } });
+  nfcPipeline->idleRetries(nfcIdleRetries());
   nfc->begin();
   if (espConfig::miscConfig.nfcSuccessPin && espConfig::miscConfig.nfcSuccessPin != 255) {
     pinMode(espConfig::miscConfig.nfcSuccessPin, OUTPUT);
@@ -1448,11 +1734,11 @@ void setup() {
   homeSpan.setLogLevel(0);
   homeSpan.setSketchVersion(app_version.c_str());
 
-  LOG(I, "READER GROUP ID (%d): %s", readerData.reader_gid.size(), red_log::bufToHexString(readerData.reader_gid.data(), readerData.reader_gid.size()).c_str());
-  LOG(I, "READER UNIQUE ID (%d): %s", readerData.reader_id.size(), red_log::bufToHexString(readerData.reader_id.data(), readerData.reader_id.size()).c_str());
+  LOG(I, "READER GROUP ID (%d): %s", snapshot->data.reader_gid.size(), red_log::bufToHexString(snapshot->data.reader_gid.data(), snapshot->data.reader_gid.size()).c_str());
+  LOG(I, "READER UNIQUE ID (%d): %s", snapshot->data.reader_id.size(), red_log::bufToHexString(snapshot->data.reader_id.data(), snapshot->data.reader_id.size()).c_str());
 
-  LOG(I, "HOMEKEY ISSUERS: %d", readerData.issuers.size());
-  for (auto&& issuer : readerData.issuers) {
+  LOG(I, "HOMEKEY ISSUERS: %d", snapshot->data.issuers.size());
+  for (auto&& issuer : snapshot->data.issuers) {
     LOG(D, "Issuer ID: %s, Public Key: %s", red_log::bufToHexString(issuer.issuer_id.data(), issuer.issuer_id.size()).c_str(), red_log::bufToHexString(issuer.issuer_pk.data(), issuer.issuer_pk.size()).c_str());
   }
   homeSpan.enableAutoStartAP();
@@ -1468,10 +1754,15 @@ void setup() {
   new SpanUserCommand('L', "Set Log Level", setLogLevel);
   new SpanUserCommand('F', "Set HomeKey Flow", setFlow);
   new SpanUserCommand('P', "Print Issuers", print_issuers);
+  new SpanUserCommand('T', "Print tap timings", print_tap_trace);
+  new SpanUserCommand('C', "Crypto benchmark, JSON lines", run_crypto_bench);
   new SpanUserCommand('R', "Remove Endpoints", [](const char*) {
-    for (auto&& issuer : readerData.issuers) {
-      issuer.endpoints.clear();
-    }
+    readerState::pin_t snapshot = readerState.update([](readerData_t& data) {
+      for (auto&& issuer : data.issuers) {
+        issuer.endpoints.clear();
+      }
+    });
+    hkFlowPolicy.prune(snapshot->index);
     save_to_nvs();
     });
   new SpanUserCommand('N', "Btr status low", [](const char* arg) {
@@ -1483,10 +1774,12 @@ void setup() {
       statusLowBtr->setVal(1);
       LOG(I, "Low status set to LOW");
     }
+    pushBatteryEvent();
   });
   new SpanUserCommand('B', "Btr level", [](const char* arg) {
     uint8_t level = atoi(static_cast<const char *>(arg + 1));
     btrLevel->setVal(level);
+    pushBatteryEvent();
   });
 
   new SpanAccessory();
@@ -1503,18 +1796,15 @@ void setup() {
   homeSpan.setConnectionCallback(wifiCallback);
   if (espConfig::miscConfig.nfcNeopixelPin != 255) {
     pixel = std::make_shared<Pixel>(espConfig::miscConfig.nfcNeopixelPin, pixelTypeMap[espConfig::miscConfig.neoPixelType]);
-    xTaskCreate(neopixel_task, "neopixel_task", 4096, NULL, 2, &neopixel_task_handle);
-  }
-  if (espConfig::miscConfig.nfcSuccessPin != 255 || espConfig::miscConfig.nfcFailPin != 255) {
-    xTaskCreate(nfc_gpio_task, "nfc_gpio_task", 4096, NULL, 2, &gpio_led_task_handle);
-  }
-  if (espConfig::miscConfig.gpioActionPin != 255 || espConfig::miscConfig.hkDumbSwitchMode) {
-    xTaskCreate(gpio_task, "gpio_task", 4096, NULL, 2, &gpio_lock_task_handle);
   }
+  actuators.start(4096, 2);
   if (espConfig::miscConfig.hkAltActionInitPin != 255) {
     xTaskCreate(alt_action_task, "alt_action_task", 2048, NULL, 2, &alt_action_task_handle);
   }
-  xTaskCreate(nfc_thread_entry, "nfc_task", 8192, NULL, 1, &nfc_poll_task);
+  authContexts.begin(AUTH_POOL_CORE);
+  readerFlusher.begin(READER_FLUSH_DELAY);
+  esp_register_shutdown_handler(flushReaderData);
+  xTaskCreatePinnedToCore(nfc_thread_entry, "nfc_task", 8192, NULL, 1, &nfc_poll_task, NFC_TASK_CORE < portNUM_PROCESSORS ? NFC_TASK_CORE : tskNO_AFFINITY);
 }
 
 //////////////////////////////////////
@@ -1523,15 +1813,3 @@ void loop() {
   homeSpan.poll();
   vTaskDelay(5);
 }
-
-// Add hex_representation function near the top with other utility functions
-std::string hex_representation(const std::vector<uint8_t>& data) {
-    std::string result;
-    result.reserve(data.size() * 2);
-    for (uint8_t byte : data) {
-        char hex[3];
-        snprintf(hex, sizeof(hex), "%02x", byte);
-        result += hex;
-    }
-    return result;
-}
@@ -0,0 +1,108 @@
+// What take() costs a tap, with the pool cold (every take builds) and warm (the refill task built
+// and refreshed the ready contexts between taps), for a small home and a large site. Every tap
+// publishes a new version, so warm takes must not copy readerData: the refill task does it.
+// The context is the host stand-in, a cold take here is the working copy and the slot without the
+// ephemeral key pair the library generates on the device, see /stats authContext.buildUs for that.
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include "config.h"
+#include "auth_context_pool.h"
+#include "reader_state.h"
+
+static nvs_handle handle;
+
+static readerData_t population(uint8_t issuers, uint8_t endpointsPerIssuer) {
+  readerData_t data;
+  data.reader_sk.assign(32, 1);
+  data.reader_pk.assign(65, 2);
+  data.reader_pk_x.assign(32, 3);
+  data.reader_gid.assign(8, 4);
+  data.reader_id.assign(8, 5);
+  for (uint8_t i = 0; i < issuers; i++) {
+    hkIssuer_t issuer;
+    issuer.issuer_id = { i, 1, 2, 3, 4, 5, 6, 7 };
+    issuer.issuer_pk.assign(32, i);
+    issuer.issuer_pk_x.assign(32, i);
+    for (uint8_t j = 0; j < endpointsPerIssuer; j++) {
+      hkEndpoint_t e;
+      e.endpoint_id = { i, j, 0, 0, 0, 0 };
+      e.endpoint_pk.assign(65, i);
+      e.endpoint_pk_x.assign(32, i);
+      e.endpoint_prst_k.assign(32, j);
+      issuer.endpoints.push_back(e);
+    }
+    data.issuers.push_back(issuer);
+  }
+  return data;
+}
+
+struct takes_t {
+  double us = 0;
+  uint32_t tapCopies = 0;
+  uint32_t refreshes = 0;
+};
+
+// Taps as nfc_thread_entry runs them, only take() is timed. With the task running, each tap waits
+// for the refill to bring the pool back to N contexts on the version the tap published
+static takes_t taps(const readerData_t& data, bool warm, uint32_t iterations) {
+  // the refill task never returns, as on the device, so the pool and what it uses are never freed
+  readerState::ReaderState& state = *new readerState::ReaderState;
+  state.replace(readerData_t(data));
+  AuthContextPool<AUTH_POOL_DEPTH>& pool = *new AuthContextPool<AUTH_POOL_DEPTH>(state, handle);
+  if (warm) pool.begin(AUTH_POOL_CORE);
+  nfcExchange_t exchange = [](uint8_t*, uint8_t, uint8_t*, uint16_t*, bool) { return true; };
+  auto settle = [&](uint32_t refreshes) {
+    for (int i = 0; i < 1000; i++) {
+      auto stats = pool.stats();
+      if (stats.ready == AUTH_POOL_DEPTH && stats.refreshes >= refreshes) return;
+      vTaskDelay(1);
+    }
+    assert(!"refill task didn't catch up");
+  };
+  if (warm) settle(0);
+  double total = 0;
+  uint32_t refreshes = 0;
+  for (uint32_t i = 0; i < iterations; i++) {
+    readerState::pin_t snapshot = state.pin();
+    auto start = std::chrono::steady_clock::now();
+    auto lease = pool.take(exchange, snapshot);
+    total += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    auto result = lease.ctx->authenticate(kFlowFAST);
+    state.update([&](readerData_t& d, const hkIndex::IssuerIndex& index) { readerState::mergeEndpoint(d, index, *lease.data, snapshot->index, std::get<0>(result), std::get<1>(result)); });
+    pool.recycle(std::move(lease));
+    snapshot.reset();
+    pool.refill();
+    // the contexts left in the pool were on the previous version
+    refreshes += AUTH_POOL_DEPTH - 1;
+    if (warm) settle(refreshes);
+  }
+  auto stats = pool.stats();
+  assert(warm ? stats.hits == iterations && stats.misses == 0 : stats.misses == iterations);
+  return { total / iterations, stats.tapCopies, stats.refreshes };
+}
+
+static void run(const char* name, const readerData_t& data, uint32_t iterations) {
+  takes_t cold = taps(data, false, iterations);
+  takes_t warm = taps(data, true, iterations);
+  // the refill task keeps up with one tap at a time, none of them copies on the tap path
+  assert(warm.tapCopies == 0 && warm.refreshes >= iterations * (AUTH_POOL_DEPTH - 1));
+  // what take() used to do on every tap once the previous one had published its version
+  readerData_t copy = data;
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < iterations; i++) {
+    copy = data;
+  }
+  double copyUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / iterations;
+  printf("{\"population\":\"%s\",\"take_us\":{\"cold\":%.2f,\"pooled\":%.2f},\"readerdata_copy_us\":%.2f,\"tap_copies\":{\"cold\":%u,\"pooled\":%u},\"refreshes\":%u}\n",
+    name, cold.us, warm.us, copyUs, cold.tapCopies, warm.tapCopies, warm.refreshes);
+}
+
+int main(int argc, char** argv) {
+  uint32_t iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : 200;
+  run("home_2x2", population(2, 2), iterations);
+  run("site_16x20", population(16, 20), iterations);
+  puts("ok");
+  return 0;
+}
@@ -0,0 +1,141 @@
+// BodyArena the way the /config/save handlers drive it: bodies split over several chunks, chunks out
+// of order, bodies larger than the buffer, malformed ones, a second request interleaving with the
+// first and a client that disconnects halfway. Allocations are counted through operator new, the
+// chunks must not allocate and the heap has to be back at its baseline once a body is handled.
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include "body_arena.h"
+
+static std::atomic<size_t> allocs{ 0 }, frees{ 0 };
+static size_t liveBlocks() { return allocs - frees; }
+
+void* operator new(size_t n) {
+  allocs++;
+  void* p = malloc(n);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+void operator delete(void* p) noexcept {
+  if (!p) return;
+  frees++;
+  free(p);
+}
+void operator delete(void* p, size_t) noexcept { operator delete(p); }
+
+typedef BodyArena<256> arena_t;
+static arena_t arena;
+static int requestA, requestB;
+
+// onBody for each (index, length) chunk of `body`, in the order given
+static void send(const void* request, const std::string& body, const std::vector<std::pair<size_t, size_t>>& chunks) {
+  for (auto&& [index, len] : chunks) {
+    if (index == 0) arena.begin(request, body.size());
+    arena.append(request, reinterpret_cast<const uint8_t*>(body.data()) + index, len, index);
+  }
+}
+
+static std::vector<std::pair<size_t, size_t>> split(size_t total, size_t chunk) {
+  std::vector<std::pair<size_t, size_t>> chunks;
+  for (size_t i = 0; i < total; i += chunk) chunks.push_back({ i, std::min(chunk, total - i) });
+  return chunks;
+}
+
+static arena_t::status_t handle(const void* request, nlohmann::json& out) { return arena.take(request, out); }
+
+int main() {
+  const std::string body = R"({"nfcTagNoPublish":true,"mqttBroker":"192.168.1.2","lockAlwaysUnlock":false,"hkGpioControlledState":true})";
+  nlohmann::json parsed;
+  // warm up nlohmann's statics before taking the baseline
+  assert(handle(&requestA, parsed) == arena_t::NO_BODY);
+  parsed = nlohmann::json::parse(body);
+  parsed = nullptr;
+  auto sevens = split(body.size(), 7);
+  size_t baseline = liveBlocks();
+
+  // split across several chunks, no allocation until the body is parsed
+  size_t before = allocs;
+  send(&requestA, body, sevens);
+  assert(allocs == before);
+  {
+    nlohmann::json out;
+    assert(handle(&requestA, out) == arena_t::READY && out["mqttBroker"] == "192.168.1.2" && out.size() == 4);
+  }
+  assert(liveBlocks() == baseline);
+
+  // chunks out of order land at their index
+  {
+    auto chunks = split(body.size(), 16);
+    std::swap(chunks[1], chunks[3]);
+    std::swap(chunks[2], chunks.back());
+    send(&requestA, body, chunks);
+    nlohmann::json out;
+    assert(handle(&requestA, out) == arena_t::READY && out == nlohmann::json::parse(body));
+  }
+
+  // larger than the buffer, announced in the total or only found out from the chunks
+  {
+    std::string large = "{\"key\":\"" + std::string(400, 'x') + "\"}";
+    send(&requestA, large, split(large.size(), 100));
+    nlohmann::json out;
+    assert(handle(&requestA, out) == arena_t::TOO_LARGE && out.is_null());
+    arena.begin(&requestA, 10);
+    arena.append(&requestA, reinterpret_cast<const uint8_t*>(large.data()), 200, 0);
+    arena.append(&requestA, reinterpret_cast<const uint8_t*>(large.data()) + 200, 200, 200);
+    assert(handle(&requestA, out) == arena_t::TOO_LARGE);
+  }
+  assert(liveBlocks() == baseline);
+
+  // malformed, truncated and empty
+  for (std::string bad : { std::string("{\"a\":"), body.substr(0, body.size() - 1), std::string("not json"), std::string() }) {
+    send(&requestA, bad, split(bad.size(), 5));
+    if (bad.empty()) arena.begin(&requestA, 0);
+    nlohmann::json out;
+    assert(handle(&requestA, out) == arena_t::MALFORMED);
+  }
+  assert(liveBlocks() == baseline);
+
+  // a second request interleaving with the first is turned away, the first still completes
+  {
+    auto chunks = split(body.size(), 20);
+    for (auto&& chunk : chunks) {
+      send(&requestA, body, { chunk });
+      send(&requestB, body, { chunk });
+    }
+    nlohmann::json out;
+    assert(handle(&requestB, out) == arena_t::BUSY && out.is_null());
+    assert(handle(&requestA, out) == arena_t::READY && out == nlohmann::json::parse(body));
+  }
+
+  // a client that disconnects halfway frees the buffer for the next one
+  send(&requestA, body, { split(body.size(), 30)[0] });
+  arena.release(&requestB); // not the owner, nothing happens
+  send(&requestB, body, split(body.size(), 30));
+  {
+    nlohmann::json out;
+    assert(handle(&requestB, out) == arena_t::BUSY);
+  }
+  arena.release(&requestA);
+  send(&requestB, body, split(body.size(), 30));
+  {
+    nlohmann::json out;
+    assert(handle(&requestA, out) == arena_t::BUSY);
+    assert(handle(&requestB, out) == arena_t::READY && out == nlohmann::json::parse(body));
+    assert(handle(&requestB, out) == arena_t::NO_BODY);
+  }
+  assert(liveBlocks() == baseline);
+
+  // many bodies in a row, the heap doesn't move
+  for (int i = 0; i < 1000; i++) {
+    send(i % 2 ? &requestA : &requestB, body, split(body.size(), 1 + i % 50));
+    nlohmann::json out;
+    assert(handle(i % 2 ? &requestA : &requestB, out) == arena_t::READY);
+  }
+  printf("live blocks %zu -> %zu, %zu allocations in total\n", baseline, liveBlocks(), size_t(allocs));
+  assert(liveBlocks() == baseline);
+  puts("ok");
+  return 0;
+}
@@ -0,0 +1,96 @@
+// JSON and NVS round trips of a config struct through config_store.h: to_json/from_json driven by
+// fields(), the number of changed fields a save reports from the blob comparison and the
+// migrations a load runs for a config stored by an older schema
+#include <cassert>
+#include <cstdio>
+#include <vector>
+#include "config_store.h"
+
+struct test_config_t {
+  enum colorMap
+  {
+    R,
+    G,
+    B
+  };
+  std::string name = "reader";
+  bool enabled = true;
+  uint16_t timeout = 500;
+  std::array<uint8_t, 4> pins{ 5, 18, 19, 23 };
+  std::map<colorMap, int> color = { {R, 0}, {G, 255}, {B, 0} };
+  template <typename Self, typename V>
+  static void fields(Self& c, V& v) {
+    v(1, "name", c.name);
+    v(2, "enabled", c.enabled);
+    v(3, "timeout", c.timeout);
+    v(4, "pins", c.pins);
+    v(5, "color", c.color);
+  }
+  friend void to_json(nlohmann::json& j, const test_config_t& c) { configStore::toJson(j, c); }
+  friend void from_json(const nlohmann::json& j, test_config_t& c) { configStore::fromJson(j, c); }
+};
+
+// v1 -> v2 counts the timeout in tens of ms, v2 -> v3 renames the reader
+static std::vector<uint8_t> migrated;
+static void timeoutInTens(test_config_t& c, const std::vector<uint8_t>& blob) {
+  migrated.push_back(1);
+  configStore::Records::record_t r = configStore::Records::find(blob, 3);
+  assert(r.data && r.len == 2 && c.timeout == uint16_t(r.data[0] | r.data[1] << 8));
+  c.timeout /= 10;
+}
+static void renamed(test_config_t& c, const std::vector<uint8_t>&) {
+  migrated.push_back(2);
+  c.name += " (v3)";
+}
+
+static bool same(const test_config_t& a, const test_config_t& b) {
+  return a.name == b.name && a.enabled == b.enabled && a.timeout == b.timeout && a.pins == b.pins && a.color == b.color;
+}
+
+int main() {
+  test_config_t cfg;
+  cfg.name = "front door";
+  cfg.enabled = false;
+  cfg.timeout = 1200;
+  cfg.pins = { 1, 2, 3, 4 };
+  cfg.color[test_config_t::B] = 128;
+  nlohmann::json j = cfg;
+  assert(j.size() == 5 && j["pins"].is_array() && j["color"].is_array());
+  test_config_t decoded = j.get<test_config_t>();
+  assert(same(cfg, decoded));
+
+  // missing keys keep their defaults, unknown keys and values of the wrong shape are skipped
+  decoded = nlohmann::json::parse(R"({"timeout": 42, "enabled": 0, "pins": [1, 2], "other": true})").get<test_config_t>();
+  test_config_t expected;
+  expected.timeout = 42;
+  expected.enabled = false;
+  assert(same(expected, decoded));
+
+  nvs_handle handle;
+  configStore::Store<test_config_t> store(handle, "TESTCFG", 1);
+  assert(store.save(cfg) == 5);
+  assert(store.save(cfg) == 0);
+  cfg.timeout++;
+  cfg.color[test_config_t::R] = 1;
+  assert(store.save(cfg) == 2);
+  test_config_t loaded;
+  assert(store.load(loaded) == 1 && same(cfg, loaded));
+
+  // a schema bump runs each step from the stored version up, in order, and rewrites the config once
+  configStore::Store<test_config_t> bumped(handle, "TESTCFG", 3, { { 2, renamed }, { 1, timeoutInTens } });
+  assert(bumped.load(loaded) == 1);
+  assert((migrated == std::vector<uint8_t>{ 1, 2 }));
+  assert(loaded.timeout == cfg.timeout / 10 && loaded.name == "front door (v3)" && loaded.pins == cfg.pins);
+  assert(bumped.save(loaded) == 0);
+  migrated.clear();
+  test_config_t reloaded;
+  configStore::Store<test_config_t> current(handle, "TESTCFG", 3, { { 2, renamed }, { 1, timeoutInTens } });
+  assert(current.load(reloaded) == 3 && migrated.empty() && same(loaded, reloaded));
+  // a config from v2 only goes through the last step
+  configStore::Store<test_config_t> v2(handle, "TESTCFG", 2);
+  v2.save(cfg);
+  assert(current.load(reloaded) == 2 && (migrated == std::vector<uint8_t>{ 2 }));
+
+  puts("ok");
+  return 0;
+}
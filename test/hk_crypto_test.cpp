@@ -0,0 +1,47 @@
+// hkCrypto::Sha256 against the FIPS 180-2 test vectors, in one update and fed in chunks that split
+// the 64-byte blocks at odd offsets, plus the knownAnswer() boot check. Needs only mbedtls, so the
+// SHA-256 path main.cpp hashes with is covered where libsodium and crypto_bench aren't available.
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <string>
+#include "hk_crypto.h"
+
+static std::string hex(const uint8_t* data, size_t len) {
+  std::string out;
+  char byte[3];
+  for (size_t i = 0; i < len; i++) {
+    snprintf(byte, sizeof(byte), "%02x", data[i]);
+    out += byte;
+  }
+  return out;
+}
+
+static std::string digest(const std::string& message, size_t chunk) {
+  hkCrypto::Sha256 sha;
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(message.data());
+  for (size_t i = 0; i < message.size(); i += chunk) {
+    sha.update(p + i, std::min(chunk, message.size() - i));
+  }
+  uint8_t out[32];
+  sha.finish(out);
+  return hex(out, sizeof(out));
+}
+
+int main() {
+  const std::pair<std::string, const char*> vectors[] = {
+    { "", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+    { "abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+    { "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+    { std::string(1000000, 'a'), "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0" },
+  };
+  for (auto&& [message, expected] : vectors) {
+    assert(digest(message, message.size() + 1) == expected);
+    for (size_t chunk : { 1, 3, 55, 63, 64, 65, 1000 }) {
+      if (chunk < message.size()) assert(digest(message, chunk) == expected);
+    }
+  }
+  assert(hkCrypto::knownAnswer());
+  puts("ok");
+  return 0;
+}
@@ -0,0 +1,104 @@
+// IssuerIndex against the linear scans it replaces, at 10, 100 and 1000 endpoints: every lookup
+// has to land on the same endpoint, and the cost of a tap's lookup, of rebuilding the index for a
+// published version and of a pairing event's sync is printed as one JSON line per population.
+// The pairing sync uses a stand-in for getHashIdentifier, only the cold run pays for it.
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include "hk_index.h"
+
+static hkEndpoint_t* linearFind(readerData_t& data, const std::vector<uint8_t>& issuerId, const std::vector<uint8_t>& endpointId) {
+  for (auto&& issuer : data.issuers) {
+    if (issuer.issuer_id != issuerId) continue;
+    for (auto&& endpoint : issuer.endpoints) {
+      if (endpoint.endpoint_id == endpointId) return &endpoint;
+    }
+  }
+  return nullptr;
+}
+
+static std::vector<uint8_t> standInHash(const uint8_t* ltpk, size_t len) {
+  uint64_t h = 1469598103934665603ull;
+  for (size_t i = 0; i < len; i++) h = (h ^ ltpk[i]) * 1099511628211ull;
+  return std::vector<uint8_t>(reinterpret_cast<uint8_t*>(&h), reinterpret_cast<uint8_t*>(&h) + 8);
+}
+
+template <typename F>
+static double nsPerOp(uint32_t iterations, F&& op) {
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < iterations; i++) op(i);
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+}
+
+static void run(size_t endpointCount, uint32_t iterations) {
+  // HomeKit allows 16 admin controllers, every one of them an issuer
+  size_t issuerCount = std::min<size_t>(16, std::max<size_t>(1, endpointCount / 10));
+  readerData_t data;
+  std::vector<std::array<uint8_t, 32>> ltpks(issuerCount);
+  std::mt19937 rng{ uint32_t(endpointCount) };
+  for (size_t i = 0; i < issuerCount; i++) {
+    for (auto&& b : ltpks[i]) b = uint8_t(rng());
+    hkIssuer_t issuer;
+    issuer.issuer_id = standInHash(ltpks[i].data(), ltpks[i].size());
+    data.issuers.push_back(issuer);
+  }
+  std::vector<std::pair<size_t, size_t>> taps;
+  for (size_t e = 0; e < endpointCount; e++) {
+    hkIssuer_t& issuer = data.issuers[e % issuerCount];
+    hkEndpoint_t endpoint;
+    endpoint.endpoint_id = { uint8_t(rng()), uint8_t(rng()), uint8_t(e), uint8_t(e >> 8), 0, 0 };
+    issuer.endpoints.push_back(endpoint);
+    taps.push_back({ e % issuerCount, issuer.endpoints.size() - 1 });
+  }
+  hkIndex::IssuerIndex index;
+  double rebuildNs = nsPerOp(std::max<uint32_t>(iterations / 100, 10), [&](uint32_t) { index.rebuild(data); });
+  assert(index.issuerCount() == issuerCount && index.endpointCount() == endpointCount);
+
+  for (auto&& [i, e] : taps) {
+    const hkIssuer_t& issuer = data.issuers[i];
+    const hkEndpoint_t& endpoint = issuer.endpoints[e];
+    assert(index.findEndpoint(data, issuer.issuer_id, endpoint.endpoint_id) == &endpoint);
+    assert(linearFind(data, issuer.issuer_id, endpoint.endpoint_id) == &endpoint);
+    assert(index.hasEndpoint(hkIndex::idKey(endpoint.endpoint_id)));
+  }
+  std::vector<uint8_t> unknown = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+  assert(!index.findEndpoint(data, data.issuers[0].issuer_id, unknown));
+  assert(!index.hasEndpoint(hkIndex::idKey(unknown)));
+
+  volatile uintptr_t sink = 0;
+  double indexNs = nsPerOp(iterations, [&](uint32_t n) {
+    auto& [i, e] = taps[n % taps.size()];
+    sink = sink + uintptr_t(index.findEndpoint(data, data.issuers[i].issuer_id, data.issuers[i].endpoints[e].endpoint_id));
+  });
+  double linearNs = nsPerOp(iterations, [&](uint32_t n) {
+    auto& [i, e] = taps[n % taps.size()];
+    sink = sink + uintptr_t(linearFind(data, data.issuers[i].issuer_id, data.issuers[i].endpoints[e].endpoint_id));
+  });
+
+  // pairCallback: every controller's identifier through the cache, then looked up as an issuer
+  hkIndex::ControllerIdCache cache;
+  auto sync = [&] {
+    size_t known = 0;
+    for (auto&& ltpk : ltpks) {
+      const std::array<uint8_t, 8>& id = cache.get(ltpk.data(), standInHash);
+      known += index.findIssuer(data, id.data(), id.size()) != nullptr;
+    }
+    cache.sweep();
+    assert(known == issuerCount);
+  };
+  double coldNs = nsPerOp(1, [&](uint32_t) { sync(); });
+  double warmNs = nsPerOp(std::max<uint32_t>(iterations / 100, 10), [&](uint32_t) { sync(); });
+  assert(cache.size() == issuerCount);
+
+  printf("{\"endpoints\":%zu,\"issuers\":%zu,\"lookup_ns\":{\"index\":%.1f,\"linear\":%.1f},\"rebuild_ns\":%.0f,\"pairing_sync_ns\":{\"cold\":%.0f,\"warm\":%.0f}}\n",
+    endpointCount, issuerCount, indexNs, linearNs, rebuildNs, coldNs, warmNs);
+}
+
+int main(int argc, char** argv) {
+  uint32_t iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : 20000;
+  for (size_t endpoints : { 10, 100, 1000 }) run(endpoints, iterations);
+  puts("ok");
+  return 0;
+}
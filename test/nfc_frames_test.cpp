@@ -0,0 +1,135 @@
+// nfc_frames.h against the code it replaced: the table CRC_A against the bitwise crc16a that was in
+// main.cpp, EcpFrame against the ecpData the firmware used to build for GIDs of 0, 8 and more than 8
+// bytes, the APDU layout and the InListPassiveTarget parser on short and oversized NFCID lengths.
+// Ends with the CRC throughput of both implementations as one JSON line.
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include "nfc_frames.h"
+
+// main.cpp's crc16a before nfc_frames.h
+static uint16_t crc16a(const uint8_t* data, size_t size) {
+  unsigned short w_crc = 0x6363;
+  for (size_t i = 0; i < size; ++i) {
+    unsigned char byte = data[i];
+    byte = (byte ^ (w_crc & 0x00FF));
+    byte = ((byte ^ (byte << 4)) & 0xFF);
+    w_crc = ((w_crc >> 8) ^ (byte << 8) ^ (byte << 3) ^ (byte >> 4)) & 0xFFFF;
+  }
+  return w_crc;
+}
+
+static void testCrc() {
+  std::mt19937 rng(7);
+  for (size_t len = 0; len < 300; len++) {
+    std::vector<uint8_t> data(len);
+    for (auto&& b : data) b = uint8_t(rng());
+    assert(nfcFrame::crcA(data.data(), data.size()) == crc16a(data.data(), data.size()));
+  }
+  // a frame followed by its CRC, low byte first, has a residue of 0
+  uint8_t framed[11] = { '1', '2', '3', '4', '5', '6', '7', '8', '9' };
+  uint16_t crc = nfcFrame::crcA(framed, 9);
+  framed[9] = crc & 0xFF;
+  framed[10] = crc >> 8;
+  assert(nfcFrame::crcA(framed, sizeof(framed)) == 0);
+}
+
+// ecpData as main.cpp built it: header, GID copied in, with_crc16 over the first 16 bytes
+static std::array<uint8_t, 18> legacyEcp(const std::vector<uint8_t>& gid) {
+  std::array<uint8_t, 18> ecp = { 0x6A, 0x2, 0xCB, 0x2, 0x6, 0x2, 0x11, 0x0 };
+  memcpy(ecp.data() + 8, gid.data(), gid.size());
+  uint16_t crc = crc16a(ecp.data(), 16);
+  ecp[16] = crc & 0xFF;
+  ecp[17] = crc >> 8;
+  return ecp;
+}
+
+static void testEcp() {
+  nfcFrame::EcpFrame frame;
+  static_assert(nfcFrame::EcpFrame::SIZE == 18);
+  // a fresh frame is the one for an empty GID, updating to it changes nothing
+  assert(!memcmp(frame.data(), legacyEcp({}).data(), frame.size()));
+  assert(!frame.update({}));
+  std::vector<uint8_t> gid = { 1, 2, 3, 4, 5, 6, 7, 8 };
+  assert(frame.update(gid));
+  assert(!memcmp(frame.data(), legacyEcp(gid).data(), frame.size()));
+  assert(nfcFrame::crcA(frame.data(), frame.size()) == 0);
+  assert(!frame.update(gid));
+  // only the first 8 bytes are a GID, the rest used to run over ecpData
+  std::vector<uint8_t> longGid = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 };
+  assert(!frame.update(longGid));
+  longGid[0] = 0xAA;
+  assert(frame.update(longGid));
+  assert(!memcmp(frame.data(), legacyEcp({ longGid.begin(), longGid.begin() + 8 }).data(), frame.size()));
+  // a shorter GID pads with zeroes
+  assert(frame.update({ 0xAA }));
+  assert(!memcmp(frame.data(), legacyEcp({ 0xAA, 0, 0, 0, 0, 0, 0, 0 }).data(), frame.size()));
+  assert(frame.update({}));
+  assert(!memcmp(frame.data(), legacyEcp({}).data(), frame.size()));
+}
+
+static void testApdu() {
+  // the SELECT main.cpp spelled out by hand
+  constexpr std::array<uint8_t, 13> select = { 0x00, 0xA4, 0x04, 0x00, 0x07, 0xA0, 0x00, 0x00, 0x08, 0x58, 0x01, 0x01, 0x0 };
+  static_assert(nfcFrame::selectHomeKey == select);
+  constexpr auto empty = nfcFrame::apdu(0x80, 0xCA, 0x01, 0x02, std::array<uint8_t, 0>{}, 0x10);
+  static_assert(empty.size() == 6 && empty[4] == 0 && empty[5] == 0x10);
+  constexpr auto apdu = nfcFrame::apdu(0x80, 0x3C, 0x00, 0x01, std::array<uint8_t, 3>{ 0xDE, 0xAD, 0xBF }, 0x00);
+  static_assert(apdu == std::array<uint8_t, 9>{ 0x80, 0x3C, 0x00, 0x01, 0x03, 0xDE, 0xAD, 0xBF, 0x00 });
+}
+
+static void testInListTarget() {
+  uint8_t uid[10], uidLen = 0, atqa[2], sak[1];
+  // NbTg 1, Tg 1, SENS_RES 00 04, SEL_RES 08, NFCIDLength 4, NFCID
+  const uint8_t ok[] = { 0x01, 0x01, 0x00, 0x04, 0x08, 0x04, 0xDE, 0xAD, 0xBE, 0xEF };
+  assert(nfcFrame::inListTarget(ok, sizeof(ok), uid, sizeof(uid), &uidLen, atqa, sak));
+  assert(uidLen == 4 && !memcmp(uid, ok + 6, 4) && atqa[0] == 0x00 && atqa[1] == 0x04 && sak[0] == 0x08);
+  // 7 byte UID, trailing ATS bytes are ignored
+  const uint8_t seven[] = { 0x01, 0x01, 0x00, 0x44, 0x20, 0x07, 1, 2, 3, 4, 5, 6, 7, 0x05, 0x78 };
+  assert(nfcFrame::inListTarget(seven, sizeof(seven), uid, sizeof(uid), &uidLen, atqa, sak) && uidLen == 7);
+  // NFCIDLength past the end of the response
+  assert(!nfcFrame::inListTarget(ok, sizeof(ok) - 1, uid, sizeof(uid), &uidLen, atqa, sak));
+  // NFCIDLength larger than the caller's buffer
+  const uint8_t oversized[] = { 0x01, 0x01, 0x00, 0x04, 0x08, 0xFF, 1, 2, 3, 4 };
+  uidLen = 0;
+  assert(!nfcFrame::inListTarget(oversized, sizeof(oversized), uid, sizeof(uid), &uidLen, atqa, sak) && uidLen == 0);
+  assert(!nfcFrame::inListTarget(seven, sizeof(seven), uid, 4, &uidLen, atqa, sak));
+  // shorter than the fixed part, no target, a negative length from a failed read
+  assert(!nfcFrame::inListTarget(ok, 5, uid, sizeof(uid), &uidLen, atqa, sak));
+  const uint8_t none[] = { 0x00, 0x01, 0x00, 0x04, 0x08, 0x04, 1, 2, 3, 4 };
+  assert(!nfcFrame::inListTarget(none, sizeof(none), uid, sizeof(uid), &uidLen, atqa, sak));
+  assert(!nfcFrame::inListTarget(ok, -1, uid, sizeof(uid), &uidLen, atqa, sak));
+}
+
+template <typename F>
+static double mbPerSecond(const std::vector<uint8_t>& data, uint32_t rounds, F&& crc) {
+  volatile uint16_t sink = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < rounds; i++) sink = sink ^ crc(data.data(), data.size());
+  double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return double(data.size()) * rounds / s / 1e6;
+}
+
+int main(int argc, char** argv) {
+  uint32_t rounds = argc > 1 ? strtoul(argv[1], NULL, 10) : 2000;
+  testCrc();
+  testEcp();
+  testApdu();
+  testInListTarget();
+  std::vector<uint8_t> data(4096);
+  std::mt19937 rng(1);
+  for (auto&& b : data) b = uint8_t(rng());
+  double table = mbPerSecond(data, rounds, [](const uint8_t* d, size_t n) { return nfcFrame::crcA(d, n); });
+  double bitwise = mbPerSecond(data, rounds, crc16a);
+  // the ECP frame as the NFC task rebuilt it before every broadcast
+  nfcFrame::EcpFrame frame;
+  volatile uint16_t sink = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < rounds * 100; i++) sink = sink ^ nfcFrame::crcA(frame.data(), 16);
+  double ecpNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / (rounds * 100);
+  printf("{\"crc_a_mb_s\":{\"table\":%.1f,\"bitwise\":%.1f},\"ecp_crc_ns\":%.1f}\n", table, bitwise, ecpNs);
+  puts("ok");
+  return 0;
+}
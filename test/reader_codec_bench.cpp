@@ -0,0 +1,127 @@
+// reader_codec.h against the msgpack READERDATA blob it replaced: blob size and encode/decode time for
+// a few populations, one JSON line each. Both paths have to give back the same readerData.
+// The json mapping is HK-HomeKit-Lib's, field names and order as in its HomeKey.h.
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <nlohmann/json.hpp>
+#include "reader_codec.h"
+
+NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(hkEnrollment_t, unixTime, payload)
+NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(hkEnrollments_t, hap, attestation)
+NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(hkEndpoint_t, endpoint_id, last_used_at, counter, key_type, endpoint_pk, endpoint_pk_x, endpoint_prst_k, enrollments)
+NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(hkIssuer_t, issuer_id, issuer_pk, issuer_pk_x, endpoints)
+NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(readerData_t, reader_sk, reader_pk, reader_pk_x, reader_gid, reader_id, issuers)
+
+static std::mt19937 rng(3);
+
+static std::vector<uint8_t> randomBytes(size_t len) {
+  std::vector<uint8_t> v(len);
+  for (auto&& b : v) b = uint8_t(rng());
+  return v;
+}
+
+static readerData_t population(size_t issuers, size_t endpointsPerIssuer, bool enrolled) {
+  readerData_t data;
+  data.reader_sk = randomBytes(32);
+  data.reader_pk = randomBytes(65);
+  data.reader_pk_x = randomBytes(32);
+  data.reader_gid = randomBytes(8);
+  data.reader_id = randomBytes(8);
+  for (size_t i = 0; i < issuers; i++) {
+    hkIssuer_t issuer;
+    issuer.issuer_id = randomBytes(8);
+    issuer.issuer_pk = randomBytes(32);
+    issuer.issuer_pk_x = randomBytes(32);
+    for (size_t j = 0; j < endpointsPerIssuer; j++) {
+      hkEndpoint_t e;
+      e.endpoint_id = randomBytes(6);
+      e.last_used_at = 1700000000u + j;
+      e.counter = int(j * 3);
+      e.key_type = 2;
+      e.endpoint_pk = randomBytes(65);
+      e.endpoint_pk_x = randomBytes(32);
+      e.endpoint_prst_k = randomBytes(32);
+      if (enrolled) e.enrollments = { { 1700000000u, randomBytes(180) }, { 1700000100u, randomBytes(700) } };
+      issuer.endpoints.push_back(e);
+    }
+    data.issuers.push_back(issuer);
+  }
+  return data;
+}
+
+// The records ReaderStore writes, slots numbered in order
+static std::vector<std::vector<uint8_t>> encodeRecords(const readerData_t& data) {
+  std::vector<std::vector<uint8_t>> records;
+  std::vector<uint16_t> issuerSlots, endpointSlots;
+  uint16_t endpointSlot = 0;
+  for (uint16_t i = 0; i < data.issuers.size(); i++) {
+    endpointSlots.clear();
+    for (auto&& e : data.issuers[i].endpoints) {
+      records.push_back(readerCodec::encodeEndpoint(e));
+      endpointSlots.push_back(endpointSlot++);
+    }
+    records.push_back(readerCodec::encodeIssuer(data.issuers[i], endpointSlots));
+    issuerSlots.push_back(i);
+  }
+  records.push_back(readerCodec::encodeMeta(data, issuerSlots));
+  return records;
+}
+
+static bool decodeRecords(const std::vector<std::vector<uint8_t>>& records, readerData_t& out) {
+  std::vector<uint16_t> issuerSlots, endpointSlots;
+  if (!readerCodec::decodeMeta(records.back(), out, issuerSlots)) return false;
+  size_t r = 0;
+  for (size_t i = 0; i < issuerSlots.size(); i++) {
+    std::vector<hkEndpoint_t> endpoints;
+    for (; r < records.size() - 1; r++) {
+      hkEndpoint_t e;
+      if (!readerCodec::decodeEndpoint(records[r], e)) break;
+      endpoints.push_back(std::move(e));
+    }
+    hkIssuer_t issuer;
+    if (!readerCodec::decodeIssuer(records[r++], issuer, endpointSlots) || endpointSlots.size() != endpoints.size()) return false;
+    issuer.endpoints = std::move(endpoints);
+    out.issuers.push_back(std::move(issuer));
+  }
+  return true;
+}
+
+template <typename F>
+static double usPerOp(uint32_t iterations, F&& op) {
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < iterations; i++) op();
+  return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / iterations;
+}
+
+static void run(const char* name, const readerData_t& data, uint32_t iterations) {
+  std::vector<uint8_t> blob = nlohmann::json::to_msgpack(nlohmann::json(data));
+  std::vector<std::vector<uint8_t>> records = encodeRecords(data);
+  size_t recordBytes = 0;
+  for (auto&& r : records) recordBytes += r.size();
+
+  readerData_t fromBlob = nlohmann::json::from_msgpack(blob).get<readerData_t>(), fromRecords;
+  assert(decodeRecords(records, fromRecords));
+  assert(nlohmann::json(fromBlob) == nlohmann::json(data) && nlohmann::json(fromRecords) == nlohmann::json(data));
+
+  double msgpackEncode = usPerOp(iterations, [&] { blob = nlohmann::json::to_msgpack(nlohmann::json(data)); });
+  double msgpackDecode = usPerOp(iterations, [&] { fromBlob = nlohmann::json::from_msgpack(blob).get<readerData_t>(); });
+  double codecEncode = usPerOp(iterations, [&] { records = encodeRecords(data); });
+  double codecDecode = usPerOp(iterations, [&] {
+    fromRecords = {};
+    decodeRecords(records, fromRecords);
+  });
+  printf("{\"population\":\"%s\",\"bytes\":{\"msgpack\":%zu,\"codec\":%zu,\"records\":%zu},\"encode_us\":{\"msgpack\":%.1f,\"codec\":%.1f},\"decode_us\":{\"msgpack\":%.1f,\"codec\":%.1f}}\n",
+    name, blob.size(), recordBytes, records.size(), msgpackEncode, codecEncode, msgpackDecode, codecDecode);
+}
+
+int main(int argc, char** argv) {
+  uint32_t iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : 200;
+  run("home_2x2", population(2, 2, false), iterations);
+  run("home_4x3_enrolled", population(4, 3, true), iterations);
+  run("site_16x20", population(16, 20, false), iterations / 10 + 1);
+  puts("ok");
+  return 0;
+}
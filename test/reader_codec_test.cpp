@@ -0,0 +1,86 @@
+// Round trip of every reader data record type through reader_codec.h, including attestation
+// payloads larger than a one byte length could describe
+#include <cassert>
+#include <cstdio>
+#include "reader_codec.h"
+
+static std::vector<uint8_t> pattern(size_t len, uint8_t seed) {
+  std::vector<uint8_t> v(len);
+  for (size_t i = 0; i < len; i++) v[i] = uint8_t(seed + i * 7);
+  return v;
+}
+
+static hkEndpoint_t makeEndpoint(uint8_t seed) {
+  hkEndpoint_t e;
+  e.endpoint_id = pattern(6, seed);
+  e.last_used_at = 0x12345678u + seed;
+  e.counter = -3 + seed;
+  e.key_type = 2;
+  e.endpoint_pk = pattern(65, seed + 1);
+  e.endpoint_pk_x = pattern(32, seed + 2);
+  e.endpoint_prst_k = pattern(32, seed + 3);
+  e.enrollments.hap = { 1700000000u, pattern(300, seed + 4) };
+  e.enrollments.attestation = { 1700000123u, pattern(1200, seed + 5) };
+  return e;
+}
+
+static bool same(const hkEnrollment_t& a, const hkEnrollment_t& b) { return a.unixTime == b.unixTime && a.payload == b.payload; }
+
+static bool same(const hkEndpoint_t& a, const hkEndpoint_t& b) {
+  return a.endpoint_id == b.endpoint_id && a.last_used_at == b.last_used_at && a.counter == b.counter && a.key_type == b.key_type &&
+    a.endpoint_pk == b.endpoint_pk && a.endpoint_pk_x == b.endpoint_pk_x && a.endpoint_prst_k == b.endpoint_prst_k &&
+    same(a.enrollments.hap, b.enrollments.hap) && same(a.enrollments.attestation, b.enrollments.attestation);
+}
+
+int main() {
+  hkEndpoint_t endpoint = makeEndpoint(9), decoded;
+  std::vector<uint8_t> buf = readerCodec::encodeEndpoint(endpoint);
+  assert(readerCodec::decodeEndpoint(buf, decoded));
+  assert(same(endpoint, decoded));
+
+  // an endpoint without enrollments, as the library creates it on the first tap
+  hkEndpoint_t bare;
+  bare.endpoint_id = pattern(6, 1);
+  buf = readerCodec::encodeEndpoint(bare);
+  assert(readerCodec::decodeEndpoint(buf, decoded) && same(bare, decoded));
+
+  // truncated or padded records are rejected
+  buf = readerCodec::encodeEndpoint(endpoint);
+  std::vector<uint8_t> cut(buf.begin(), buf.end() - 1);
+  assert(!readerCodec::decodeEndpoint(cut, decoded));
+  buf.push_back(0);
+  assert(!readerCodec::decodeEndpoint(buf, decoded));
+
+  // a field over the length limit encodes to nothing rather than a truncated record
+  hkEndpoint_t huge = endpoint;
+  huge.enrollments.attestation.payload.resize(UINT16_MAX + 1);
+  assert(readerCodec::encodeEndpoint(huge).empty());
+
+  hkIssuer_t issuer, decodedIssuer;
+  issuer.issuer_id = pattern(8, 20);
+  issuer.issuer_pk = pattern(32, 21);
+  issuer.issuer_pk_x = pattern(32, 22);
+  std::vector<uint16_t> slots = { 0, 7, 300 }, decodedSlots;
+  buf = readerCodec::encodeIssuer(issuer, slots);
+  assert(readerCodec::decodeIssuer(buf, decodedIssuer, decodedSlots));
+  assert(decodedIssuer.issuer_id == issuer.issuer_id && decodedIssuer.issuer_pk == issuer.issuer_pk && decodedIssuer.issuer_pk_x == issuer.issuer_pk_x);
+  assert(decodedSlots == slots);
+
+  readerData_t data, decodedData;
+  data.reader_sk = pattern(32, 30);
+  data.reader_pk = pattern(65, 31);
+  data.reader_pk_x = pattern(32, 32);
+  data.reader_gid = pattern(8, 33);
+  data.reader_id = pattern(8, 34);
+  buf = readerCodec::encodeMeta(data, slots);
+  assert(readerCodec::decodeMeta(buf, decodedData, decodedSlots));
+  assert(decodedData.reader_sk == data.reader_sk && decodedData.reader_pk == data.reader_pk && decodedData.reader_pk_x == data.reader_pk_x);
+  assert(decodedData.reader_gid == data.reader_gid && decodedData.reader_id == data.reader_id);
+  assert(decodedSlots == slots);
+
+  // records of one type don't decode as another
+  assert(!readerCodec::decodeIssuer(readerCodec::encodeEndpoint(endpoint), decodedIssuer, decodedSlots));
+
+  puts("ok");
+  return 0;
+}
@@ -0,0 +1,166 @@
+// Concurrent provisioning and authentication on ReaderState: a tapper thread authenticates with
+// pooled contexts and merges its endpoint back, three readers pin and check versions, and a
+// provisioner removes, adds and replaces issuers and flushes. Every pinned version has to stay
+// internally consistent, and once it's quiet every tap has to land. Meant to also run under
+// -DHOST_SANITIZER=thread.
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+#include <random>
+#include <thread>
+#include "auth_context_pool.h"
+#include "reader_flusher.h"
+
+static nvs_handle handle;
+
+static hkIssuer_t makeIssuer(uint8_t id) {
+  hkIssuer_t issuer;
+  issuer.issuer_id = { id, 1, 2, 3, 4, 5, 6, 7 };
+  issuer.issuer_pk.assign(32, id);
+  for (uint8_t j = 0; j < 2; j++) {
+    hkEndpoint_t e;
+    e.endpoint_id = { id, j, 0, 0, 0, 0 };
+    e.endpoint_pk.assign(65, id);
+    issuer.endpoints.push_back(e);
+  }
+  return issuer;
+}
+
+// Contents match their ids and the version's index finds every issuer and endpoint
+static void check(const readerState::snapshot_t& s) {
+  for (auto&& issuer : s.data.issuers) {
+    assert(issuer.issuer_pk.size() == 32 && issuer.issuer_pk[0] == issuer.issuer_id[0]);
+    assert(s.index.findIssuer(s.data, issuer.issuer_id.data(), issuer.issuer_id.size()) == &issuer);
+    for (auto&& e : issuer.endpoints) {
+      assert(e.endpoint_id[0] == issuer.issuer_id[0] && e.endpoint_pk[0] == issuer.issuer_id[0]);
+      assert(s.index.findEndpoint(s.data, issuer.issuer_id, e.endpoint_id) == &e);
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  int ops = argc > 1 ? atoi(argv[1]) : 3000;
+  readerState::ReaderState state;
+  {
+    readerData_t d;
+    d.reader_gid = { 1 };
+    for (uint8_t i = 0; i < 4; i++) d.issuers.push_back(makeIssuer(i));
+    state.replace(std::move(d));
+  }
+  ReaderStore store(handle);
+  ReaderFlusher flusher(store);
+  flusher.begin(5);
+  AuthContextPool<2> pool(state, handle);
+  pool.begin(0);
+  std::atomic<bool> stop{ false };
+  std::atomic<uint32_t> taps{ 0 }, merged{ 0 }, lost{ 0 }, reads{ 0 };
+  nfcExchange_t exchange = [](uint8_t*, uint8_t, uint8_t*, uint16_t*, bool) { return true; };
+
+  std::thread tapper([&] {
+    while (!stop) {
+      readerState::pin_t snapshot = state.pin();
+      check(*snapshot);
+      auto lease = pool.take(exchange, snapshot);
+      auto result = lease.ctx->authenticate(kFlowFAST);
+      if (std::get<2>(result) != kFlowFailed) {
+        taps++;
+        bool ok = false;
+        flusher.markDirty(state.update([&](readerData_t& d, const hkIndex::IssuerIndex& index) { ok = readerState::mergeEndpoint(d, index, *lease.data, snapshot->index, std::get<0>(result), std::get<1>(result)); }));
+        (ok ? merged : lost)++;
+      }
+      pool.recycle(std::move(lease));
+      pool.refill();
+    }
+  });
+  std::vector<std::thread> readers;
+  for (int t = 0; t < 3; t++) {
+    readers.emplace_back([&, t] {
+      std::mt19937 rng(t);
+      while (!stop) {
+        readerState::pin_t snapshot = state.pin();
+        check(*snapshot);
+        if (rng() % 8 == 0) std::this_thread::yield();
+        reads++;
+      }
+    });
+  }
+  std::thread provisioner([&] {
+    std::mt19937 rng(42);
+    for (int i = 0; i < ops; i++) {
+      switch (rng() % 4) {
+      case 0:
+        state.update([&](readerData_t& d) {
+          if (!d.issuers.empty()) d.issuers.erase(d.issuers.begin() + rng() % d.issuers.size());
+        });
+        break;
+      case 1:
+        state.update([&](readerData_t& d) {
+          // like pairCallback, an issuer that's already there isn't added again
+          hkIssuer_t issuer = makeIssuer(uint8_t(4 + rng() % 200));
+          bool known = std::any_of(d.issuers.begin(), d.issuers.end(), [&](const hkIssuer_t& i) { return i.issuer_id == issuer.issuer_id; });
+          if (d.issuers.size() < 12 && !known) d.issuers.push_back(issuer);
+        });
+        break;
+      case 2:
+        state.update([](readerData_t& d) {
+          for (auto&& issuer : d.issuers) issuer.endpoints.clear();
+        });
+        break;
+      case 3: {
+        readerData_t d;
+        d.issuers.push_back(makeIssuer(uint8_t(rng() % 4)));
+        readerState::pin_t replaced = state.replace(std::move(d));
+        if (i % 100 == 0) flusher.erase(replaced->version);
+      } break;
+      }
+      pool.invalidate();
+      if (i % 50 == 0) flusher.flush(state.pin());
+    }
+    stop = true;
+  });
+  provisioner.join();
+  tapper.join();
+  for (auto&& reader : readers) reader.join();
+  printf("%d provisioning ops, %u taps (merged %u, issuer gone %u), %u reads\n", ops, taps.load(), merged.load(), lost.load(), reads.load());
+
+  // quiet: every tap on the same endpoint lands, in memory and in flash
+  {
+    readerData_t d;
+    d.issuers.push_back(makeIssuer(9));
+    state.replace(std::move(d));
+  }
+  for (int i = 0; i < 100; i++) {
+    readerState::pin_t snapshot = state.pin();
+    auto lease = pool.take(exchange, snapshot);
+    auto result = lease.ctx->authenticate(kFlowFAST);
+    flusher.markDirty(state.update([&](readerData_t& d, const hkIndex::IssuerIndex& index) { readerState::mergeEndpoint(d, index, *lease.data, snapshot->index, std::get<0>(result), std::get<1>(result)); }));
+    pool.recycle(std::move(lease));
+  }
+  assert(state.pin()->data.issuers[0].endpoints[0].counter == 100);
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  flusher.flushPending();
+  readerData_t loaded;
+  assert(store.load(loaded) && loaded.issuers[0].endpoints[0].counter == 100);
+  // an endpoint the flow added to the working copy isn't in the pinned index, it's appended to its issuer
+  {
+    readerState::pin_t snapshot = state.pin();
+    readerData_t working = snapshot->data;
+    hkEndpoint_t added;
+    added.endpoint_id = { 9, 7, 0, 0, 0, 0 };
+    working.issuers[0].endpoints.push_back(added);
+    std::vector<uint8_t> issuerId = working.issuers[0].issuer_id, goneId = makeIssuer(42).issuer_id;
+    state.update([&](readerData_t& d, const hkIndex::IssuerIndex& index) {
+      assert(readerState::mergeEndpoint(d, index, working, snapshot->index, issuerId, added.endpoint_id));
+      assert(!readerState::mergeEndpoint(d, index, working, snapshot->index, goneId, added.endpoint_id));
+    });
+    readerState::pin_t now = state.pin();
+    assert(now->data.issuers[0].endpoints.size() == 3 && now->index.findEndpoint(now->data, issuerId, added.endpoint_id));
+  }
+  // only the current version is left once nobody pins an older one
+  auto stats = state.stats();
+  printf("version %u, live versions %d, flushes %u\n", stats.version, int(stats.live), flusher.stats().flushes);
+  assert(stats.live == 1);
+  puts("ok");
+  return 0;
+}
@@ -0,0 +1,132 @@
+// Interrupts ReaderStore::save() before every single NVS write and checks what loads afterwards:
+// either the old layout with each record old or new, or the complete new layout. Endpoints must
+// always load under the issuer they belong to, also when a save removes and adds identifiers.
+#include <cassert>
+#include <cstdio>
+#include <functional>
+#include <sys/wait.h>
+#include "reader_store.h"
+
+static nvs_handle handle;
+
+static hkIssuer_t makeIssuer(uint8_t id, int counter) {
+  hkIssuer_t issuer;
+  issuer.issuer_id = { id, 0, 0, 0, 0, 0, 0, 0 };
+  issuer.issuer_pk.assign(32, id);
+  issuer.issuer_pk_x.assign(32, id);
+  for (uint8_t j = 0; j < 2; j++) {
+    hkEndpoint_t e;
+    e.endpoint_id = { id, j, 0, 0, 0, 0 };
+    e.counter = counter;
+    e.endpoint_pk.assign(65, id);
+    e.endpoint_pk_x.assign(32, id);
+    if (counter) e.endpoint_prst_k.assign(32, uint8_t(counter));
+    issuer.endpoints.push_back(e);
+  }
+  return issuer;
+}
+
+static readerData_t makeData(std::initializer_list<uint8_t> issuers, int counter) {
+  readerData_t d;
+  d.reader_sk.assign(32, 1);
+  d.reader_pk.assign(65, 2);
+  d.reader_pk_x.assign(32, 3);
+  d.reader_gid = { 1, 2, 3, 4, 5, 6, 7, 8 };
+  d.reader_id = { 8, 7, 6, 5, 4, 3, 2, 1 };
+  for (uint8_t id : issuers) d.issuers.push_back(makeIssuer(id, counter));
+  return d;
+}
+
+static const hkIssuer_t* findIssuer(const readerData_t& d, const std::vector<uint8_t>& id) {
+  for (auto&& issuer : d.issuers) {
+    if (issuer.issuer_id == id) return &issuer;
+  }
+  return nullptr;
+}
+
+static bool sameEndpoint(const hkEndpoint_t& a, const hkEndpoint_t& b) {
+  return a.endpoint_id == b.endpoint_id && a.counter == b.counter && a.endpoint_prst_k == b.endpoint_prst_k;
+}
+
+// Every loaded issuer is from `before` or `after` with its own endpoints, each one as in either
+static bool consistent(const readerData_t& got, const readerData_t& before, const readerData_t& after, bool& allAfter) {
+  const readerData_t* layout = got.issuers.size() == before.issuers.size() && findIssuer(before, got.issuers.back().issuer_id) ? &before : &after;
+  if (got.issuers.size() != layout->issuers.size()) return false;
+  allAfter = layout == &after;
+  for (size_t i = 0; i < got.issuers.size(); i++) {
+    const hkIssuer_t& issuer = got.issuers[i];
+    if (issuer.issuer_id != layout->issuers[i].issuer_id || issuer.endpoints.size() != 2) return false;
+    const hkIssuer_t* old = findIssuer(before, issuer.issuer_id);
+    const hkIssuer_t* now = findIssuer(after, issuer.issuer_id);
+    for (size_t j = 0; j < issuer.endpoints.size(); j++) {
+      const hkEndpoint_t& e = issuer.endpoints[j];
+      if (e.endpoint_id[0] != issuer.issuer_id[0]) return false;
+      bool isOld = old && sameEndpoint(e, old->endpoints[j]);
+      bool isNew = now && sameEndpoint(e, now->endpoints[j]);
+      if (!isOld && !isNew) return false;
+      allAfter &= isNew;
+    }
+  }
+  return true;
+}
+
+static void crashPoints(const char* name, const readerData_t& before, const readerData_t& after) {
+  int points = 0, asBefore = 0, asAfter = 0;
+  for (long k = 0;; k++) {
+    nvsStub::clear();
+    {
+      ReaderStore store(handle);
+      assert(store.save(before));
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+      nvsStub::crashAt(k);
+      ReaderStore store(handle);
+      readerData_t loaded;
+      store.load(loaded);
+      store.save(after);
+      _exit(0);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    bool crashed = WIFEXITED(status) && WEXITSTATUS(status) == 3;
+    nvsStub::backTo(nvsStub::state().file);
+    ReaderStore store(handle);
+    readerData_t got;
+    assert(store.load(got));
+    bool allAfter = false;
+    if (!consistent(got, before, after, allAfter)) {
+      fprintf(stderr, "%s: inconsistent reader data after a crash before write %ld\n", name, k);
+      exit(1);
+    }
+    points++;
+    (allAfter ? asAfter : asBefore)++;
+    if (!crashed) {
+      assert(allAfter);
+      break;
+    }
+  }
+  printf("%s: %d crash points, %d loaded the old layout, %d the new one\n", name, points, asBefore, asAfter);
+}
+
+int main() {
+  nvsStub::backTo("reader_store_test.nvs");
+  crashPoints("update", makeData({ 0, 1, 2 }, 0), makeData({ 0, 1, 2, 3 }, 1));
+  // issuer 1 leaves and 5 arrives in the same save, 5 must not take 1's slots
+  crashPoints("replace", makeData({ 0, 1 }, 0), makeData({ 0, 5 }, 0));
+  crashPoints("replace twice", makeData({ 1, 2 }, 3), makeData({ 6, 7 }, 0));
+
+  // freed slots come back once the meta record no longer lists them, and nothing is left behind
+  nvsStub::clear();
+  ReaderStore store(handle);
+  assert(store.save(makeData({ 0, 1 }, 0)));
+  assert(store.save(makeData({ 0, 5 }, 0)));
+  assert(nvsStub::count() == 1 + 2 + 4);
+  assert(store.save(makeData({ 0, 5, 6 }, 0)));
+  assert(nvsStub::count() == 1 + 3 + 6);
+  readerData_t got;
+  assert(store.load(got) && got.issuers.size() == 3 && got.issuers[2].endpoints[1].endpoint_id[0] == 6);
+  nvsStub::clear();
+  puts("ok");
+  return 0;
+}
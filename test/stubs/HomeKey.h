@@ -0,0 +1,50 @@
+#pragma once
+// Host stand-in for HK-HomeKit-Lib's HomeKey.h: the same structs, fields and field order
+#include <cstdint>
+#include <vector>
+
+enum KeyFlow
+{
+  kFlowFAST = 0x00,
+  kFlowSTANDARD = 0x01,
+  kFlowATTESTATION = 0x02,
+  kFlowNEXT,
+  kFlowFailed = 0xFF
+};
+
+struct hkEnrollment_t {
+  uint32_t unixTime = 0;
+  std::vector<uint8_t> payload;
+};
+
+struct hkEnrollments_t {
+  hkEnrollment_t hap;
+  hkEnrollment_t attestation;
+};
+
+struct hkEndpoint_t {
+  std::vector<uint8_t> endpoint_id;
+  uint32_t last_used_at = 0;
+  int counter = 0;
+  int key_type = 0;
+  std::vector<uint8_t> endpoint_pk;
+  std::vector<uint8_t> endpoint_pk_x;
+  std::vector<uint8_t> endpoint_prst_k;
+  hkEnrollments_t enrollments;
+};
+
+struct hkIssuer_t {
+  std::vector<uint8_t> issuer_id;
+  std::vector<uint8_t> issuer_pk;
+  std::vector<uint8_t> issuer_pk_x;
+  std::vector<hkEndpoint_t> endpoints;
+};
+
+struct readerData_t {
+  std::vector<uint8_t> reader_sk;
+  std::vector<uint8_t> reader_pk;
+  std::vector<uint8_t> reader_pk_x;
+  std::vector<uint8_t> reader_gid;
+  std::vector<uint8_t> reader_id;
+  std::vector<hkIssuer_t> issuers;
+};
@@ -0,0 +1,6 @@
+#pragma once
+// Host stand-in for the esp_err_t codes the headers in main/include and the other stubs return
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_INVALID_STATE 0x103
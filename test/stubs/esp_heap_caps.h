@@ -0,0 +1,34 @@
+#pragma once
+// Host stand-in for heap_caps_get_info() on top of glibc's mallinfo2(). glibc has no largest free
+// block, the releasable space at the top of the heap stands in for it. allocated_blocks comes from
+// hostHeap::liveBlocks, which a test that counts its allocations can point at its own counter.
+#include <cstddef>
+#include <cstdint>
+#include <malloc.h>
+
+#define MALLOC_CAP_8BIT (1 << 2)
+
+struct multi_heap_info_t {
+  size_t total_free_bytes;
+  size_t total_allocated_bytes;
+  size_t largest_free_block;
+  size_t minimum_free_bytes;
+  size_t allocated_blocks;
+  size_t free_blocks;
+  size_t total_blocks;
+};
+
+namespace hostHeap {
+  inline size_t (*liveBlocks)() = nullptr;
+}
+
+inline void heap_caps_get_info(multi_heap_info_t* info, uint32_t caps) {
+  struct mallinfo2 m = mallinfo2();
+  *info = {};
+  info->total_free_bytes = m.fordblks;
+  info->total_allocated_bytes = m.uordblks;
+  info->largest_free_block = m.keepcost;
+  info->minimum_free_bytes = m.fordblks;
+  info->allocated_blocks = hostHeap::liveBlocks ? hostHeap::liveBlocks() : 0;
+  info->free_blocks = m.ordblks;
+}
@@ -0,0 +1,13 @@
+#pragma once
+// Host stand-in for the ROM CRC32, same polynomial and conventions
+#include <cstddef>
+#include <cstdint>
+
+inline uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t* buf, size_t len) {
+  crc = ~crc;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= buf[i];
+    for (int k = 0; k < 8; k++) crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+  }
+  return ~crc;
+}
@@ -0,0 +1,87 @@
+#pragma once
+// Host stand-in for esp_timer: esp_timer_get_time() in microseconds on the monotonic clock, and
+// one-shot timers that each fire from a thread of their own instead of the shared esp_timer task
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include "esp_err.h"
+
+inline int64_t esp_timer_get_time() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+typedef void (*esp_timer_cb_t)(void* arg);
+typedef enum
+{
+  ESP_TIMER_TASK,
+  ESP_TIMER_ISR
+} esp_timer_dispatch_t;
+typedef struct {
+  esp_timer_cb_t callback;
+  void* arg;
+  esp_timer_dispatch_t dispatch_method;
+  const char* name;
+  bool skip_unhandled_events;
+} esp_timer_create_args_t;
+
+struct hostTimer_t {
+  esp_timer_cb_t callback;
+  void* arg;
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool armed = false;
+  uint32_t generation = 0; // bumped by every start and stop, a wait for an older one is abandoned
+  std::chrono::steady_clock::time_point due;
+};
+typedef hostTimer_t* esp_timer_handle_t;
+
+inline esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* handle) {
+  hostTimer_t* timer = new hostTimer_t{};
+  timer->callback = args->callback;
+  timer->arg = args->arg;
+  *handle = timer;
+  std::thread([timer] {
+    std::unique_lock<std::mutex> lock(timer->mutex);
+    while (1) {
+      timer->cv.wait(lock, [timer] { return timer->armed; });
+      uint32_t generation = timer->generation;
+      if (timer->cv.wait_until(lock, timer->due, [timer, generation] { return timer->generation != generation; })) continue;
+      // like esp_timer, a one-shot timer is no longer active by the time its callback runs
+      timer->armed = false;
+      lock.unlock();
+      timer->callback(timer->arg);
+      lock.lock();
+    }
+  }).detach();
+  return ESP_OK;
+}
+
+inline esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeoutUs) {
+  {
+    std::lock_guard<std::mutex> lock(timer->mutex);
+    if (timer->armed) return ESP_ERR_INVALID_STATE;
+    timer->armed = true;
+    timer->generation++;
+    timer->due = std::chrono::steady_clock::now() + std::chrono::microseconds(timeoutUs);
+  }
+  timer->cv.notify_one();
+  return ESP_OK;
+}
+
+inline esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+  {
+    std::lock_guard<std::mutex> lock(timer->mutex);
+    if (!timer->armed) return ESP_ERR_INVALID_STATE;
+    timer->armed = false;
+    timer->generation++;
+  }
+  timer->cv.notify_one();
+  return ESP_OK;
+}
+
+inline bool esp_timer_is_active(esp_timer_handle_t timer) {
+  std::lock_guard<std::mutex> lock(timer->mutex);
+  return timer->armed;
+}
@@ -0,0 +1,31 @@
+#pragma once
+// Host stand-in for the FreeRTOS types and macros the headers in main/include use, one tick per ms
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdMS_TO_TICKS(ms) (ms)
+#define portTICK_PERIOD_MS 1
+#define portMAX_DELAY 0xFFFFFFFF
+#define portNUM_PROCESSORS 2
+#define tskIDLE_PRIORITY 0
+#define tskNO_AFFINITY 0x7FFFFFFF
+
+struct hostTask_t {
+  void (*fn)(void*);
+  void* arg;
+  int core;
+  std::mutex mutex;
+  std::condition_variable cv;
+  uint32_t notified = 0;
+  std::thread thread;
+};
+typedef hostTask_t* TaskHandle_t;
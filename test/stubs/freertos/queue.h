@@ -0,0 +1,47 @@
+#pragma once
+// Host stand-in for FreeRTOS queues: fixed depth, items copied in and out by value. Sends and
+// receives never block, the callers in main/include only use them with a zero timeout
+#include <cstring>
+#include <mutex>
+#include <vector>
+#include "FreeRTOS.h"
+
+struct hostQueue_t {
+  std::mutex mutex;
+  std::vector<uint8_t> items;
+  size_t itemSize;
+  size_t depth;
+  size_t head = 0;
+  size_t count = 0;
+};
+typedef hostQueue_t* QueueHandle_t;
+
+inline QueueHandle_t xQueueCreate(UBaseType_t depth, UBaseType_t itemSize) {
+  hostQueue_t* queue = new hostQueue_t{};
+  queue->items.resize(depth * itemSize);
+  queue->itemSize = itemSize;
+  queue->depth = depth;
+  return queue;
+}
+
+inline BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t) {
+  std::lock_guard<std::mutex> lock(queue->mutex);
+  if (queue->count == queue->depth) return pdFALSE;
+  memcpy(queue->items.data() + (queue->head + queue->count) % queue->depth * queue->itemSize, item, queue->itemSize);
+  queue->count++;
+  return pdTRUE;
+}
+
+inline BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t) {
+  std::lock_guard<std::mutex> lock(queue->mutex);
+  if (!queue->count) return pdFALSE;
+  memcpy(item, queue->items.data() + queue->head * queue->itemSize, queue->itemSize);
+  queue->head = (queue->head + 1) % queue->depth;
+  queue->count--;
+  return pdTRUE;
+}
+
+inline UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+  std::lock_guard<std::mutex> lock(queue->mutex);
+  return UBaseType_t(queue->count);
+}
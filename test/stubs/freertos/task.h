@@ -0,0 +1,76 @@
+#pragma once
+// Host stand-in for FreeRTOS tasks: each task is a detached std::thread with its own notification
+// value, enough for the notify give/take and set-bits patterns main/include relies on
+#include "FreeRTOS.h"
+
+typedef enum
+{
+  eNoAction,
+  eSetBits,
+  eIncrement
+} eNotifyAction;
+
+namespace hostTask {
+  inline thread_local hostTask_t* current = nullptr;
+  // threads that aren't tasks (main(), test threads) still get a notification value of their own
+  inline hostTask_t* self() {
+    if (!current) current = new hostTask_t{};
+    return current;
+  }
+}
+
+inline BaseType_t xTaskCreatePinnedToCore(void (*fn)(void*), const char*, uint32_t, void* arg, UBaseType_t, TaskHandle_t* handle, BaseType_t core) {
+  hostTask_t* task = new hostTask_t{};
+  task->fn = fn;
+  task->arg = arg;
+  task->core = core;
+  if (handle) *handle = task;
+  task->thread = std::thread([task] {
+    hostTask::current = task;
+    task->fn(task->arg);
+  });
+  task->thread.detach();
+  return pdPASS;
+}
+
+inline BaseType_t xTaskCreate(void (*fn)(void*), const char* name, uint32_t stack, void* arg, UBaseType_t priority, TaskHandle_t* handle) {
+  return xTaskCreatePinnedToCore(fn, name, stack, arg, priority, handle, tskNO_AFFINITY);
+}
+
+inline TaskHandle_t xTaskGetCurrentTaskHandle() { return hostTask::self(); }
+
+inline BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action) {
+  {
+    std::lock_guard<std::mutex> lock(task->mutex);
+    if (action == eSetBits) task->notified |= value;
+    else if (action == eIncrement) task->notified++;
+  }
+  task->cv.notify_one();
+  return pdPASS;
+}
+
+inline BaseType_t xTaskNotifyGive(TaskHandle_t task) { return xTaskNotify(task, 0, eIncrement); }
+
+inline uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks) {
+  hostTask_t* task = hostTask::self();
+  std::unique_lock<std::mutex> lock(task->mutex);
+  auto ready = [task] { return task->notified > 0; };
+  if (ticks == portMAX_DELAY) task->cv.wait(lock, ready);
+  else task->cv.wait_for(lock, std::chrono::milliseconds(ticks), ready);
+  uint32_t value = task->notified;
+  if (value) task->notified = clearOnExit ? 0 : value - 1;
+  return value;
+}
+
+inline BaseType_t xTaskNotifyWait(uint32_t clearOnEntry, uint32_t clearOnExit, uint32_t* value, TickType_t ticks) {
+  hostTask_t* task = hostTask::self();
+  std::unique_lock<std::mutex> lock(task->mutex);
+  task->notified &= ~clearOnEntry;
+  auto ready = [task] { return task->notified != 0; };
+  bool got = ticks == portMAX_DELAY ? (task->cv.wait(lock, ready), true) : task->cv.wait_for(lock, std::chrono::milliseconds(ticks), ready);
+  if (value) *value = task->notified;
+  if (got) task->notified &= ~clearOnExit;
+  return got ? pdTRUE : pdFALSE;
+}
+
+inline void vTaskDelay(TickType_t ticks) { std::this_thread::sleep_for(std::chrono::milliseconds(ticks)); }
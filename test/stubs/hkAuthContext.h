@@ -0,0 +1,43 @@
+#pragma once
+// Host stand-in for HK-HomeKit-Lib's HKAuthenticationContext. It does none of the library's
+// crypto: authenticate() sends one frame through the exchange and, if the frame goes through,
+// authenticates the first endpoint it finds and bumps its counter the way a tap does.
+// A test can set hostAuth::script to decide the frames and the outcome instead, the tap replay
+// harness sends the recorded APDUs of a trace that way.
+#include <functional>
+#include <tuple>
+#include <vector>
+#include <nvs.h>
+#include "HomeKey.h"
+
+namespace hostAuth {
+  typedef std::function<bool(uint8_t*, uint8_t, uint8_t*, uint16_t*, bool)> nfc_t;
+  typedef std::function<std::tuple<std::vector<uint8_t>, std::vector<uint8_t>, KeyFlow>(KeyFlow, nfc_t&, readerData_t&)> script_t;
+  inline script_t script;
+}
+
+class HKAuthenticationContext
+{
+public:
+  HKAuthenticationContext(std::function<bool(uint8_t*, uint8_t, uint8_t*, uint16_t*, bool)>& nfc, readerData_t& readerData, nvs_handle& savedData) : nfc(nfc), readerData(readerData) {}
+
+  std::tuple<std::vector<uint8_t>, std::vector<uint8_t>, KeyFlow> authenticate(KeyFlow flow) {
+    if (hostAuth::script) return hostAuth::script(flow, nfc, readerData);
+    uint8_t frame[4] = { 0x80, 0x80, 0x01, 0x01 };
+    uint8_t res[4];
+    uint16_t resLen = sizeof(res);
+    if (!nfc(frame, sizeof(frame), res, &resLen, false)) return { {}, {}, kFlowFailed };
+    for (auto&& issuer : readerData.issuers) {
+      for (auto&& endpoint : issuer.endpoints) {
+        endpoint.counter++;
+        endpoint.endpoint_prst_k.assign(32, uint8_t(endpoint.counter));
+        return { issuer.issuer_id, endpoint.endpoint_id, flow };
+      }
+    }
+    return { {}, {}, kFlowFailed };
+  }
+
+private:
+  std::function<bool(uint8_t*, uint8_t, uint8_t*, uint16_t*, bool)>& nfc;
+  readerData_t& readerData;
+};
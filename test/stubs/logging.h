@@ -0,0 +1,38 @@
+#pragma once
+// Host stand-in for the LOG macro: W and E go to stderr, HK_LOG=D (or I, V) shows more
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+namespace hostLog {
+  inline bool enabled(char level) {
+    static const char* order = "EWIDV";
+    static const char* env = getenv("HK_LOG");
+    const char* max = strchr(order, env && *env ? *env : 'W');
+    const char* at = strchr(order, level);
+    return max && at && at <= max;
+  }
+}
+
+#define LOG(x, format, ...)                                                                  \
+  do {                                                                                       \
+    if (hostLog::enabled(#x[0])) fprintf(stderr, #x " %s: " format "\n", TAG, ##__VA_ARGS__); \
+  } while (0)
+
+#define ESP_LOG_VERBOSE 5
+#define ESP_LOG_BUFFER_HEX_LEVEL(tag, buf, len, level) \
+  do {                                                 \
+  } while (0)
+
+namespace red_log {
+  inline std::string bufToHexString(const uint8_t* buf, size_t len) {
+    std::string out;
+    char hex[3];
+    for (size_t i = 0; i < len; i++) {
+      snprintf(hex, sizeof(hex), "%02x", buf[i]);
+      out += hex;
+    }
+    return out;
+  }
+}
@@ -0,0 +1,9 @@
+#pragma once
+// Host stand-in for mbedtls_platform_zeroize, a memset the compiler can't drop
+#include <cstddef>
+#include <cstring>
+
+inline void mbedtls_platform_zeroize(void* buf, size_t len) {
+  static void* (*const volatile wipe)(void*, int, size_t) = memset;
+  if (len) wipe(buf, 0, len);
+}
@@ -0,0 +1,72 @@
+#pragma once
+// Host stand-in for esp-mqtt with a broker the test controls: publish sleeps for
+// brokerDelayMs and fails while brokerUp is false
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+typedef const char* esp_event_base_t;
+typedef void (*esp_event_handler_t)(void*, esp_event_base_t, int32_t, void*);
+enum esp_mqtt_event_id_t
+{
+  MQTT_EVENT_ANY = -1,
+  MQTT_EVENT_ERROR = 0,
+  MQTT_EVENT_CONNECTED,
+  MQTT_EVENT_DISCONNECTED
+};
+enum esp_mqtt_transport_t
+{
+  MQTT_TRANSPORT_OVER_TCP
+};
+struct esp_mqtt_client_config_t {
+  struct {
+    struct {
+      const char* hostname;
+      uint32_t port;
+      esp_mqtt_transport_t transport;
+    } address;
+  } broker;
+  struct {
+    const char* client_id;
+    const char* username;
+    struct {
+      const char* password;
+    } authentication;
+  } credentials;
+  struct {
+    struct {
+      const char* topic;
+      const char* msg;
+      int qos;
+      int retain;
+    } last_will;
+  } session;
+};
+struct esp_mqtt_client {
+  esp_event_handler_t handler;
+  void* arg;
+};
+typedef esp_mqtt_client* esp_mqtt_client_handle_t;
+
+namespace hostBroker {
+  inline std::atomic<int> delayMs{ 0 };
+  inline std::atomic<bool> up{ true };
+  inline std::atomic<int> received{ 0 };
+}
+
+inline esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t*) { return new esp_mqtt_client{}; }
+inline int esp_mqtt_client_register_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t, esp_event_handler_t handler, void* arg) {
+  client->handler = handler;
+  client->arg = arg;
+  return 0;
+}
+inline int esp_mqtt_client_start(esp_mqtt_client_handle_t client) {
+  client->handler(client->arg, "MQTT_EVENTS", MQTT_EVENT_CONNECTED, nullptr);
+  return 0;
+}
+inline int esp_mqtt_client_publish(esp_mqtt_client_handle_t, const char*, const char*, int, int, int) {
+  if (!hostBroker::up) return -1;
+  std::this_thread::sleep_for(std::chrono::milliseconds(hostBroker::delayMs.load()));
+  return ++hostBroker::received;
+}
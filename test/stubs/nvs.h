@@ -0,0 +1,148 @@
+#pragma once
+// Host stand-in for NVS blobs. Entries live in memory unless nvsStub::backTo() points them at a
+// file, which is rewritten on every set/erase so each entry is durable on its own like in flash.
+// nvsStub::crashAt() kills the process right before the nth write to simulate a power cut, and
+// nvsStub::failWrites() makes sets fail the way a full partition would.
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "esp_err.h"
+
+typedef uint32_t nvs_handle;
+typedef nvs_handle nvs_handle_t;
+#define ESP_ERR_NVS_NOT_FOUND 0x1102
+#define ESP_ERR_NVS_NOT_ENOUGH_SPACE 0x1105
+#define ESP_ERR_NVS_INVALID_LENGTH 0x110c
+
+namespace nvsStub {
+  typedef std::map<std::string, std::vector<uint8_t>> entries_t;
+  struct state_t {
+    std::mutex mutex;
+    entries_t entries;
+    std::string file;
+    long crashAt = -1;
+    long writes = 0;
+    bool failing = false;
+  };
+  inline state_t& state() {
+    static state_t s;
+    return s;
+  }
+
+  inline entries_t readFile(const std::string& path) {
+    entries_t m;
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) return m;
+    uint32_t kl, vl;
+    while (fread(&kl, 4, 1, f) == 1) {
+      std::string k(kl, 0);
+      if (fread(&k[0], 1, kl, f) != kl || fread(&vl, 4, 1, f) != 1) break;
+      std::vector<uint8_t> v(vl);
+      if (vl && fread(v.data(), 1, vl, f) != vl) break;
+      m[k] = v;
+    }
+    fclose(f);
+    return m;
+  }
+  inline void writeFile(const std::string& path, const entries_t& m) {
+    std::string tmp = path + ".tmp";
+    FILE* f = fopen(tmp.c_str(), "wb");
+    if (!f) return;
+    for (auto&& [k, v] : m) {
+      uint32_t kl = k.size(), vl = v.size();
+      fwrite(&kl, 4, 1, f);
+      fwrite(k.data(), 1, kl, f);
+      fwrite(&vl, 4, 1, f);
+      fwrite(v.data(), 1, vl, f);
+    }
+    fclose(f);
+    rename(tmp.c_str(), path.c_str());
+  }
+
+  /// Keeps the entries in `path` from now on, loading what's already there; empty goes back to memory
+  inline void backTo(const std::string& path) {
+    std::lock_guard<std::mutex> lock(state().mutex);
+    state().file = path;
+    state().entries = path.empty() ? entries_t() : readFile(path);
+  }
+  inline void crashAt(long write) {
+    std::lock_guard<std::mutex> lock(state().mutex);
+    state().crashAt = write;
+    state().writes = 0;
+  }
+  inline void failWrites(bool failing) {
+    std::lock_guard<std::mutex> lock(state().mutex);
+    state().failing = failing;
+  }
+  inline void clear() {
+    std::lock_guard<std::mutex> lock(state().mutex);
+    state().entries.clear();
+    if (!state().file.empty()) remove(state().file.c_str());
+  }
+  inline size_t count() {
+    std::lock_guard<std::mutex> lock(state().mutex);
+    return state().entries.size();
+  }
+
+  // called with the mutex held before every write
+  inline void beforeWrite() {
+    if (state().crashAt >= 0 && state().writes++ == state().crashAt) _exit(3);
+  }
+  inline void afterWrite() {
+    if (!state().file.empty()) writeFile(state().file, state().entries);
+  }
+}
+
+inline esp_err_t nvs_get_blob(nvs_handle, const char* key, void* out, size_t* len) {
+  std::lock_guard<std::mutex> lock(nvsStub::state().mutex);
+  auto it = nvsStub::state().entries.find(key);
+  if (it == nvsStub::state().entries.end()) return ESP_ERR_NVS_NOT_FOUND;
+  if (out) {
+    if (*len < it->second.size()) return ESP_ERR_NVS_INVALID_LENGTH;
+    memcpy(out, it->second.data(), it->second.size());
+  }
+  *len = it->second.size();
+  return ESP_OK;
+}
+
+inline esp_err_t nvs_set_blob(nvs_handle, const char* key, const void* data, size_t len) {
+  std::lock_guard<std::mutex> lock(nvsStub::state().mutex);
+  nvsStub::beforeWrite();
+  if (nvsStub::state().failing) return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+  nvsStub::state().entries[key] = std::vector<uint8_t>(static_cast<const uint8_t*>(data), static_cast<const uint8_t*>(data) + len);
+  nvsStub::afterWrite();
+  return ESP_OK;
+}
+
+inline esp_err_t nvs_erase_key(nvs_handle, const char* key) {
+  std::lock_guard<std::mutex> lock(nvsStub::state().mutex);
+  nvsStub::beforeWrite();
+  bool erased = nvsStub::state().entries.erase(key);
+  nvsStub::afterWrite();
+  return erased ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+}
+
+inline esp_err_t nvs_commit(nvs_handle) {
+  std::lock_guard<std::mutex> lock(nvsStub::state().mutex);
+  return nvsStub::state().failing ? ESP_FAIL : ESP_OK;
+}
+
+inline const char* esp_err_to_name(esp_err_t err) {
+  switch (err) {
+  case ESP_OK:
+    return "ESP_OK";
+  case ESP_ERR_NVS_NOT_FOUND:
+    return "ESP_ERR_NVS_NOT_FOUND";
+  case ESP_ERR_NVS_NOT_ENOUGH_SPACE:
+    return "ESP_ERR_NVS_NOT_ENOUGH_SPACE";
+  case ESP_ERR_NVS_INVALID_LENGTH:
+    return "ESP_ERR_NVS_INVALID_LENGTH";
+  default:
+    return "ESP_FAIL";
+  }
+}
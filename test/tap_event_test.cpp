@@ -0,0 +1,140 @@
+// EventBuffer against the nlohmann::json payloads it replaced: every event the firmware builds has
+// to come out byte for byte as json::dump() printed it, and building one must not allocate.
+// Ends with the cost of a HomeKey and a plain tag event on both paths as one JSON line.
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <random>
+#include <string>
+#include <nlohmann/json.hpp>
+#include "tap_event.h"
+
+static std::atomic<size_t> allocs{ 0 };
+
+void* operator new(size_t n) {
+  allocs++;
+  void* p = malloc(n);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+// main.cpp's helper before tap_event.h
+static std::string hex_representation(const std::vector<uint8_t>& data) {
+  std::string result;
+  result.reserve(data.size() * 2);
+  for (uint8_t byte : data) {
+    char hex[3];
+    snprintf(hex, sizeof(hex), "%02x", byte);
+    result += hex;
+  }
+  return result;
+}
+
+static std::mt19937 rng(5);
+static std::vector<uint8_t> randomBytes(size_t len) {
+  std::vector<uint8_t> v(len);
+  for (auto&& b : v) b = uint8_t(rng());
+  return v;
+}
+
+static std::string legacyHomeKey(const std::vector<uint8_t>& issuerId, const std::vector<uint8_t>& endpointId, const std::vector<uint8_t>& readerId) {
+  nlohmann::json payload;
+  payload["issuerId"] = hex_representation(issuerId);
+  payload["endpointId"] = hex_representation(endpointId);
+  payload["readerId"] = hex_representation(readerId);
+  payload["homekey"] = true;
+  return payload.dump();
+}
+static const char* homeKey(tapEvent::EventBuffer<>& payload, const std::vector<uint8_t>& issuerId, const std::vector<uint8_t>& endpointId, const std::vector<uint8_t>& readerId) {
+  return payload.hex("endpointId", endpointId.data(), endpointId.size())
+    .boolean("homekey", true)
+    .hex("issuerId", issuerId.data(), issuerId.size())
+    .hex("readerId", readerId.data(), readerId.size())
+    .finish();
+}
+
+static std::string legacyTag(const uint8_t* uid, uint8_t uidLen, const uint8_t* atqa, const uint8_t* sak) {
+  nlohmann::json payload;
+  payload["atqa"] = hex_representation(std::vector<uint8_t>(atqa, atqa + 2));
+  payload["sak"] = hex_representation(std::vector<uint8_t>(sak, sak + 1));
+  payload["uid"] = hex_representation(std::vector<uint8_t>(uid, uid + uidLen));
+  payload["homekey"] = false;
+  return payload.dump();
+}
+static const char* tag(tapEvent::EventBuffer<>& payload, const uint8_t* uid, uint8_t uidLen, const uint8_t* atqa, const uint8_t* sak) {
+  return payload.hex("atqa", atqa, 2).boolean("homekey", false).hex("sak", sak, 1).hex("uid", uid, uidLen).finish();
+}
+
+template <typename F>
+static double nsPerOp(uint32_t iterations, F&& op) {
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < iterations; i++) op();
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+}
+
+int main(int argc, char** argv) {
+  uint32_t iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : 20000;
+
+  for (size_t len = 0; len <= 16; len++) {
+    std::vector<uint8_t> issuerId = randomBytes(8), endpointId = randomBytes(len), readerId = randomBytes(8);
+    std::string expected = legacyHomeKey(issuerId, endpointId, readerId);
+    size_t before = allocs;
+    tapEvent::EventBuffer<> payload;
+    const char* got = homeKey(payload, issuerId, endpointId, readerId);
+    assert(allocs == before);
+    assert(got && expected == got && payload.size() == expected.size());
+  }
+  for (uint8_t uidLen : { 4, 7, 10 }) {
+    std::vector<uint8_t> uid = randomBytes(uidLen), atqa = randomBytes(2), sak = randomBytes(1);
+    tapEvent::EventBuffer<> payload;
+    const char* got = tag(payload, uid.data(), uidLen, atqa.data(), sak.data());
+    assert(got && legacyTag(uid.data(), uidLen, atqa.data(), sak.data()) == got);
+  }
+  for (int32_t state : { 0, 1, 3, -1, INT32_MIN, INT32_MAX }) {
+    tapEvent::EventBuffer<> payload;
+    assert(nlohmann::json({ { "current", state } }).dump() == payload.number("current", state).finish());
+  }
+  {
+    tapEvent::EventBuffer<> payload;
+    assert(nlohmann::json({ { "homekey", true }, { "success", false } }).dump() == payload.boolean("homekey", true).boolean("success", false).finish());
+    tapEvent::EventBuffer<> empty;
+    assert(nlohmann::json::object().dump() == empty.finish());
+  }
+  // too long for the buffer: no event rather than a truncated one
+  {
+    std::vector<uint8_t> large = randomBytes(64);
+    tapEvent::EventBuffer<> payload;
+    assert(!payload.hex("uid", large.data(), large.size()).finish());
+    tapEvent::EventBuffer<16> small;
+    assert(!small.number("current", INT32_MIN).finish());
+  }
+
+  std::vector<uint8_t> issuerId = randomBytes(8), endpointId = randomBytes(6), readerId = randomBytes(8);
+  std::vector<uint8_t> uid = randomBytes(7), atqa = randomBytes(2), sak = randomBytes(1);
+  volatile size_t sink = 0;
+  size_t before = allocs;
+  double legacyHomeKeyNs = nsPerOp(iterations, [&] { sink = sink + legacyHomeKey(issuerId, endpointId, readerId).size(); });
+  double legacyAllocs = double(allocs - before) / iterations;
+  double legacyTagNs = nsPerOp(iterations, [&] { sink = sink + legacyTag(uid.data(), 7, atqa.data(), sak.data()).size(); });
+  before = allocs;
+  double homeKeyNs = nsPerOp(iterations, [&] {
+    tapEvent::EventBuffer<> payload;
+    sink = sink + strlen(homeKey(payload, issuerId, endpointId, readerId));
+  });
+  double tagNs = nsPerOp(iterations, [&] {
+    tapEvent::EventBuffer<> payload;
+    sink = sink + strlen(tag(payload, uid.data(), 7, atqa.data(), sak.data()));
+  });
+  assert(allocs == before);
+  printf("{\"homekey_ns\":{\"nlohmann\":%.0f,\"event_buffer\":%.0f},\"tag_ns\":{\"nlohmann\":%.0f,\"event_buffer\":%.0f},\"allocations\":{\"nlohmann\":%.1f,\"event_buffer\":0}}\n",
+    legacyHomeKeyNs, homeKeyNs, legacyTagNs, tagNs, legacyAllocs);
+  puts("ok");
+  return 0;
+}
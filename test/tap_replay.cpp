@@ -0,0 +1,287 @@
+// Tap harness: runs the firmware's tap pipeline (tap_pipeline.h) against a virtual PN532 replaying
+// recorded taps, with optional frame errors and latency, and reports per-tap latency and CPU time
+// for each trace. The authentication context is the host stand-in, so the flows cost what the
+// recorded device time and the pipeline cost, not the library's crypto.
+// A successful tap sends the lock command through the actuator engine (actuator.h) as
+// hkAuthSuccess does, the time from the send to the lock GPIO edge is reported as the handoff.
+// With --momentary-ms every unlock starts a momentary pulse, a tap arriving before it ran out
+// preempts it.
+//
+//   tap_replay --trace traces/fast.trace [--trace ...] [--taps N] [--check]
+//              [--drop-every N] [--drop-rate P] [--seed S] [--latency-scale X] [--extra-latency-us N]
+//              [--fail-from N] [--dwell-ms N] [--expect OUTCOME] [--max-p95-ms N]
+//              [--momentary-ms N] [--max-handoff-ms N]
+//
+// With several traces the taps take turns. Prints one JSON line per trace; --check fails the run
+// if a tap ends other than its trace expects (or --expect says for every trace), if the p95
+// latency is over --max-p95-ms, the p95 handoff over --max-handoff-ms, a lock command or the end
+// of a pulse got lost, or the reader sent something the recording didn't.
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "config.h"
+#include "actuator.h"
+#include "tap_pipeline.h"
+#include "virtual_pn532.h"
+
+using virtualPn532::trace_t;
+
+struct tapOutcome_t {
+  std::string outcome = "missed";
+  uint32_t latencyUs = 0; // tap start -> hook
+  uint32_t cpuUs = 0;     // thread CPU time of the whole poll, removal wait included
+  uint8_t rounds = 0;
+  uint8_t attempts = 0;
+};
+
+static uint32_t threadCpuUs() {
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return uint32_t(ts.tv_sec * 1000000ull + ts.tv_nsec / 1000);
+}
+
+static uint32_t percentile(std::vector<uint32_t> values, uint8_t rank) {
+  if (values.empty()) return 0;
+  std::sort(values.begin(), values.end());
+  size_t idx = (rank * values.size() + 99) / 100;
+  return values[idx ? idx - 1 : 0];
+}
+
+static readerData_t readerDataFor(const std::vector<trace_t>& traces) {
+  readerData_t data;
+  data.reader_sk.assign(32, 1);
+  data.reader_pk.assign(65, 2);
+  data.reader_pk_x.assign(32, 3);
+  data.reader_gid.assign(8, 4);
+  data.reader_id.assign(8, 5);
+  for (auto&& trace : traces) {
+    if (trace.issuerId.empty()) continue;
+    auto issuer = std::find_if(data.issuers.begin(), data.issuers.end(), [&](const hkIssuer_t& i) { return i.issuer_id == trace.issuerId; });
+    if (issuer == data.issuers.end()) {
+      hkIssuer_t added;
+      added.issuer_id = trace.issuerId;
+      added.issuer_pk.assign(32, 6);
+      added.issuer_pk_x.assign(32, 7);
+      issuer = data.issuers.insert(data.issuers.end(), added);
+    }
+    if (std::none_of(issuer->endpoints.begin(), issuer->endpoints.end(), [&](const hkEndpoint_t& e) { return e.endpoint_id == trace.endpointId; })) {
+      hkEndpoint_t endpoint;
+      endpoint.endpoint_id = trace.endpointId;
+      endpoint.endpoint_pk.assign(65, 8);
+      endpoint.endpoint_pk_x.assign(32, 9);
+      issuer->endpoints.push_back(endpoint);
+    }
+  }
+  return data;
+}
+
+// The recorded APDUs after SELECT, sent the way HKAuthenticationContext would
+static tapPipeline::authResult_t replay(const trace_t& trace, hostAuth::nfc_t& nfc, readerData_t& data) {
+  for (size_t i = 1; i < trace.apdus.size(); i++) {
+    std::vector<uint8_t> command = trace.apdus[i].command;
+    uint8_t res[1024];
+    uint16_t resLen = sizeof(res);
+    if (!nfc(command.data(), command.size(), res, &resLen, trace.apdus[i].response.size() > 255)) return { {}, {}, kFlowFailed };
+    if (resLen < 2 || res[resLen - 2] != 0x90 || res[resLen - 1] != 0x00) return { {}, {}, kFlowFailed };
+  }
+  if (trace.flow == kFlowFailed) return { {}, {}, kFlowFailed };
+  for (auto&& issuer : data.issuers) {
+    for (auto&& endpoint : issuer.endpoints) {
+      if (issuer.issuer_id != trace.issuerId || endpoint.endpoint_id != trace.endpointId) continue;
+      endpoint.counter++;
+      if (trace.flow != kFlowFAST) endpoint.endpoint_prst_k.assign(32, uint8_t(endpoint.counter));
+      return { trace.issuerId, trace.endpointId, trace.flow };
+    }
+  }
+  return { {}, {}, kFlowFailed };
+}
+
+static void usage() {
+  fprintf(stderr, "usage: tap_replay --trace <file> [--trace <file>...] [--taps N] [--check] [--drop-every N] [--drop-rate P] [--seed S]\n"
+                  "                  [--latency-scale X] [--extra-latency-us N] [--fail-from N] [--dwell-ms N] [--expect OUTCOME]\n"
+                  "                  [--max-p95-ms N] [--momentary-ms N] [--max-handoff-ms N]\n");
+  exit(2);
+}
+
+int main(int argc, char** argv) {
+  std::vector<trace_t> traces;
+  virtualPn532::faults_t faults;
+  long taps = 10;
+  bool check = false;
+  std::string expect;
+  uint32_t maxP95Ms = 0;
+  uint16_t momentaryMs = 0;
+  uint32_t maxHandoffMs = 0;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--check") {
+      check = true;
+      continue;
+    }
+    if (i + 1 >= argc) usage();
+    const char* value = argv[++i];
+    if (arg == "--trace") {
+      trace_t trace;
+      std::string error;
+      if (!virtualPn532::loadTrace(value, trace, error)) {
+        fprintf(stderr, "%s\n", error.c_str());
+        return 2;
+      }
+      traces.push_back(trace);
+    } else if (arg == "--taps") taps = atol(value);
+    else if (arg == "--drop-every") faults.dropEvery = atoi(value);
+    else if (arg == "--drop-rate") faults.dropRate = atof(value);
+    else if (arg == "--seed") faults.seed = atoi(value);
+    else if (arg == "--latency-scale") faults.latencyScale = atof(value);
+    else if (arg == "--extra-latency-us") faults.extraUs = atoi(value);
+    else if (arg == "--fail-from") faults.failFrom = atoi(value);
+    else if (arg == "--dwell-ms") faults.dwellMs = atoi(value);
+    else if (arg == "--expect") expect = value;
+    else if (arg == "--max-p95-ms") maxP95Ms = atoi(value);
+    else if (arg == "--momentary-ms") momentaryMs = atoi(value);
+    else if (arg == "--max-handoff-ms") maxHandoffMs = atoi(value);
+    else usage();
+  }
+  if (traces.empty() || taps <= 0) usage();
+  if (!expect.empty()) {
+    for (auto&& trace : traces) trace.expect = expect;
+  }
+
+  nvs_handle handle;
+  readerState::ReaderState state;
+  state.replace(readerDataFor(traces));
+  ReaderStore store(handle);
+  ReaderFlusher flusher(store);
+  flusher.begin(READER_FLUSH_DELAY);
+  AuthContextPool<AUTH_POOL_DEPTH> contexts(state, handle);
+  contexts.begin(AUTH_POOL_CORE);
+  flowPolicy::FlowPolicy policy;
+  tapRecovery::Recovery recovery(NFC_RETRY_BUDGET, NFC_FRAME_RETRIES);
+  tapTrace::TapTracer<TAP_TRACE_DEPTH> tracer;
+  virtualPn532::VirtualPN532 nfc(faults);
+
+  // the lock output as main.cpp's actuatorLock drives it, the GPIO write is where the handoff ends
+  actuator::Engine actuators;
+  std::mutex actuatorMutex;
+  std::vector<uint32_t> handoff;
+  uint32_t sent = 0, preempted = 0, relocked = 0;
+  actuators.begin({
+    [&](const actuator::cmd_t& cmd) {
+      bool running = actuators.pulseCancel(actuator::P_MOMENTARY);
+      uint32_t edgeUs = tapTrace::now() - cmd.queuedAt;
+      if (momentaryMs) actuators.pulseStart(actuator::P_MOMENTARY, momentaryMs);
+      std::lock_guard<std::mutex> lock(actuatorMutex);
+      handoff.push_back(edgeUs);
+      preempted += running;
+    },
+    [&](actuator::pulse_t) {
+      std::lock_guard<std::mutex> lock(actuatorMutex);
+      relocked++;
+    } });
+  actuators.start(4096, 2);
+
+  tapOutcome_t current;
+  auto done = [&](const std::string& outcome) {
+    current.outcome = outcome;
+    current.latencyUs = tapTrace::now() - tracer.startedAt();
+  };
+  tapPipeline::Pipeline<virtualPn532::VirtualPN532, AUTH_POOL_DEPTH, TAP_TRACE_DEPTH> pipeline(nfc, state, flusher, contexts, policy, recovery, tracer, {
+    [&](const tapPipeline::authResult_t& result) {
+      done(virtualPn532::flowName(std::get<2>(result)));
+      sent += actuators.send(actuator::cmd_t::LOCK, 2 /* gpioLockAction::HOMEKEY */);
+    },
+    [&] { done("failed"); },
+    [&](const tapPipeline::target_t&) { done("tag"); } });
+  pipeline.idleRetries(0);
+  hostAuth::script = [&](KeyFlow, hostAuth::nfc_t& exchange, readerData_t& data) { return replay(nfc.trace(), exchange, data); };
+
+  nfcFrame::EcpFrame ecp;
+  ecp.update(state.pin()->data.reader_gid);
+  std::vector<std::vector<tapOutcome_t>> results(traces.size());
+  for (long i = 0; i < taps; i++) {
+    size_t t = i % traces.size();
+    if (traces[t].flow != kFlowFailed) policy.pin(traces[t].flow);
+    nfc.arrive(traces[t]);
+    current = {};
+    uint32_t cpuStart = threadCpuUs();
+    bool detected = pipeline.poll(ecp, 500);
+    current.cpuUs = threadCpuUs() - cpuStart;
+    if (detected) {
+      std::array<tapTrace::tapRecord_t, TAP_TRACE_DEPTH> records;
+      if (tracer.snapshot(records)) {
+        current.rounds = records[0].rounds;
+        current.attempts = records[0].attempts;
+      }
+    }
+    results[t].push_back(current);
+  }
+
+  bool ok = true;
+  for (size_t t = 0; t < traces.size(); t++) {
+    std::vector<uint32_t> latency, cpu;
+    uint32_t rounds = 0, restarts = 0, unexpected = 0;
+    std::map<std::string, uint32_t> outcomes;
+    for (auto&& r : results[t]) {
+      outcomes[r.outcome]++;
+      if (r.outcome != traces[t].expect) unexpected++;
+      if (r.outcome != "missed") latency.push_back(r.latencyUs);
+      cpu.push_back(r.cpuUs);
+      rounds += r.rounds;
+      restarts += r.attempts > 1 ? r.attempts - 1 : 0;
+    }
+    printf("{\"trace\":\"%s\",\"taps\":%zu,\"outcomes\":{", traces[t].name.c_str(), results[t].size());
+    const char* sep = "";
+    for (auto&& o : outcomes) {
+      printf("%s\"%s\":%u", sep, o.first.c_str(), o.second);
+      sep = ",";
+    }
+    printf("},\"expected\":\"%s\",\"latency_us\":{\"p50\":%u,\"p95\":%u},\"cpu_us\":{\"p50\":%u,\"p95\":%u},\"rounds_per_tap\":%.1f,\"restarts\":%u}\n",
+      traces[t].expect.c_str(), percentile(latency, 50), percentile(latency, 95), percentile(cpu, 50), percentile(cpu, 95), double(rounds) / results[t].size(), restarts);
+    if (maxP95Ms && percentile(latency, 95) > maxP95Ms * 1000) {
+      fprintf(stderr, "%s: p95 latency over %u ms\n", traces[t].name.c_str(), maxP95Ms);
+      ok = false;
+    }
+    if (unexpected) {
+      fprintf(stderr, "%s: %u of %zu taps didn't end as %s\n", traces[t].name.c_str(), unexpected, results[t].size(), traces[t].expect.c_str());
+      ok = false;
+    }
+  }
+  // let the last command and pulse run out
+  for (int i = 0; i < 1000; i++) {
+    {
+      std::lock_guard<std::mutex> lock(actuatorMutex);
+      if (handoff.size() == sent && (!momentaryMs || preempted + relocked == sent)) break;
+    }
+    vTaskDelay(1);
+  }
+  {
+    std::lock_guard<std::mutex> lock(actuatorMutex);
+    printf("{\"actuator\":{\"commands\":%u,\"handled\":%zu,\"handoff_us\":{\"p50\":%u,\"p95\":%u,\"max\":%u},\"preempted\":%u,\"relocked\":%u}}\n",
+      sent, handoff.size(), percentile(handoff, 50), percentile(handoff, 95), percentile(handoff, 100), preempted, relocked);
+    if (handoff.size() != sent || (momentaryMs && preempted + relocked != sent)) {
+      fprintf(stderr, "actuator: %zu of %u lock commands handled, %u pulses preempted, %u relocked\n", handoff.size(), sent, preempted, relocked);
+      ok = false;
+    }
+    if (maxHandoffMs && percentile(handoff, 95) > maxHandoffMs * 1000) {
+      fprintf(stderr, "actuator: p95 handoff over %u ms\n", maxHandoffMs);
+      ok = false;
+    }
+  }
+  virtualPn532::stats_t stats = nfc.stats();
+  tapRecovery::stats_t recovered = recovery.stats();
+  printf("{\"exchanges\":%u,\"injected\":%u,\"silent\":%u,\"mismatches\":%u,\"ecp_mismatches\":%u,\"frame_errors\":%u,\"recovered_by_retry\":%u,\"recovered_by_restart\":%u}\n",
+    stats.exchanges, stats.injected, stats.silent, stats.mismatches, stats.ecpMismatches, recovered.frameErrors, recovered.recoveredByRetry, recovered.recoveredByRestart);
+  ok &= !stats.mismatches && !stats.ecpMismatches;
+  flusher.flushPending();
+  fflush(stdout);
+  // the flusher and pool tasks never return, as on the device, leave without tearing down what they use
+  _exit(check && !ok ? 1 : 0);
+}
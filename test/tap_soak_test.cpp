@@ -0,0 +1,84 @@
+// Soak of the per-tap allocations: pooled context, working copy, published readerData version and
+// the merge, repeated for many taps. Allocations are counted through operator new, and the live
+// block count and heap must not grow once the pool and the spare versions are warm.
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include "auth_context_pool.h"
+#include "reader_state.h"
+
+static std::atomic<size_t> allocs{ 0 }, frees{ 0 };
+static size_t liveBlocks() { return allocs - frees; }
+
+void* operator new(size_t n) {
+  allocs++;
+  void* p = malloc(n);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+void operator delete(void* p) noexcept {
+  if (!p) return;
+  frees++;
+  free(p);
+}
+void operator delete(void* p, size_t) noexcept { operator delete(p); }
+
+static nvs_handle handle;
+
+static hkIssuer_t makeIssuer(uint8_t id) {
+  hkIssuer_t issuer;
+  issuer.issuer_id = { id, 1, 2, 3, 4, 5, 6, 7 };
+  issuer.issuer_pk.assign(32, id);
+  issuer.issuer_pk_x.assign(32, id);
+  for (uint8_t j = 0; j < 3; j++) {
+    hkEndpoint_t e;
+    e.endpoint_id = { id, j, 0, 0, 0, 0 };
+    e.endpoint_pk.assign(65, id);
+    e.endpoint_pk_x.assign(32, id);
+    e.endpoint_prst_k.assign(32, j);
+    issuer.endpoints.push_back(e);
+  }
+  return issuer;
+}
+
+int main(int argc, char** argv) {
+  long taps = argc > 1 ? atol(argv[1]) : 20000;
+  hostHeap::liveBlocks = liveBlocks;
+  readerState::ReaderState state;
+  {
+    readerData_t d;
+    d.reader_sk.assign(32, 1);
+    d.reader_pk.assign(65, 2);
+    d.reader_pk_x.assign(32, 3);
+    d.reader_gid.assign(8, 4);
+    d.reader_id.assign(8, 5);
+    for (uint8_t i = 0; i < 3; i++) d.issuers.push_back(makeIssuer(i));
+    state.replace(std::move(d));
+  }
+  AuthContextPool<2> pool(state, handle);
+  nfcExchange_t exchange = [](uint8_t*, uint8_t, uint8_t*, uint16_t*, bool) { return true; };
+  // the tap path of nfc_thread_entry without the radio, the pool is refilled inline
+  auto tap = [&] {
+    readerState::pin_t snapshot = state.pin();
+    auto lease = pool.take(exchange, snapshot);
+    auto result = lease.ctx->authenticate(kFlowFAST);
+    state.update([&](readerData_t& d, const hkIndex::IssuerIndex& index) { readerState::mergeEndpoint(d, index, *lease.data, snapshot->index, std::get<0>(result), std::get<1>(result)); });
+    pool.recycle(std::move(lease));
+  };
+  for (int i = 0; i < 100; i++) tap();
+  size_t allocs0 = allocs, live0 = liveBlocks();
+  tapArena::heap_t heap0 = tapArena::heapNow();
+  for (long i = 0; i < taps; i++) tap();
+  size_t allocs1 = allocs, live1 = liveBlocks();
+  tapArena::heap_t heap1 = tapArena::heapNow();
+  double perTap = double(allocs1 - allocs0) / taps;
+  printf("%ld taps: %.2f allocations per tap, live blocks %zu -> %zu, free in heap %u -> %u bytes\n", taps, perTap, live0, live1, heap0.free, heap1.free);
+  assert(live1 <= live0);
+  // what's left is the two id vectors of the result and the update's closure, versions and
+  // working copies reuse their buffers
+  assert(perTap <= 4);
+  puts("ok");
+  return 0;
+}
@@ -0,0 +1,254 @@
+#pragma once
+// A PN532 for the host: the methods of the PN532 class that tap_pipeline.h uses, answering from a
+// recorded tap instead of the radio. A trace file holds one tap:
+//
+//   # comment
+//   name    fast-iphone
+//   target  <uid hex> <atqa hex> <sak hex>
+//   ecp     <frame hex>                       optional, checked against what the reader sends
+//   flow    fast | standard | attestation     what the device completes, none for plain tags
+//   expect  fast | standard | attestation | failed | tag   outcome, defaults to the flow or tag
+//   issuer  <issuer id hex>
+//   endpoint <endpoint id hex>
+//   apdu    <command hex> <response hex | -> <device time us>
+//
+// The first apdu line is the SELECT sent by the pipeline, the rest are sent in order by the
+// scripted HKAuthenticationContext. A response of "-" is a target that doesn't answer, like a
+// MIFARE Classic on an ISO-DEP frame. Every command the reader sends is compared with the recorded
+// one, a mismatch is a failed exchange and counted.
+// On top of the recording, faults can be injected: frame errors every n exchanges or at random,
+// every exchange of a tap failing from the nth on (a target drifting out of range), latency scaled
+// or added per frame, and a dwell time after which the target leaves the field.
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "HomeKey.h"
+
+namespace virtualPn532 {
+  struct apdu_t {
+    std::vector<uint8_t> command;
+    std::vector<uint8_t> response;
+    bool answers = true;
+    uint32_t deviceUs = 0;
+  };
+
+  struct trace_t {
+    std::string name;
+    std::vector<uint8_t> uid;
+    uint8_t atqa[2] = {};
+    uint8_t sak = 0;
+    std::vector<uint8_t> ecp;
+    KeyFlow flow = kFlowFailed; // kFlowFailed: not a HomeKey
+    std::string expect;
+    std::vector<uint8_t> issuerId;
+    std::vector<uint8_t> endpointId;
+    std::vector<apdu_t> apdus;
+  };
+
+  inline bool parseHex(const std::string& hex, std::vector<uint8_t>& out) {
+    if (hex.size() % 2) return false;
+    out.clear();
+    for (size_t i = 0; i < hex.size(); i += 2) {
+      char* end;
+      std::string byte = hex.substr(i, 2);
+      out.push_back(uint8_t(strtoul(byte.c_str(), &end, 16)));
+      if (*end) return false;
+    }
+    return true;
+  }
+
+  inline const char* flowName(KeyFlow flow) {
+    switch (flow) {
+    case kFlowFAST:
+      return "fast";
+    case kFlowSTANDARD:
+      return "standard";
+    case kFlowATTESTATION:
+      return "attestation";
+    default:
+      return "failed";
+    }
+  }
+
+  inline bool loadTrace(const std::string& path, trace_t& trace, std::string& error) {
+    std::ifstream in(path);
+    if (!in) {
+      error = "can't open " + path;
+      return false;
+    }
+    std::string line;
+    int lineNo = 0;
+    while (std::getline(in, line)) {
+      lineNo++;
+      std::istringstream words(line);
+      std::string key;
+      if (!(words >> key) || key[0] == '#') continue;
+      bool ok = true;
+      std::vector<uint8_t> bytes;
+      if (key == "name") {
+        ok = bool(words >> trace.name);
+      } else if (key == "target") {
+        std::string uid, atqa, sak;
+        ok = words >> uid >> atqa >> sak && parseHex(uid, trace.uid) && parseHex(atqa, bytes) && bytes.size() == 2;
+        if (ok) memcpy(trace.atqa, bytes.data(), 2);
+        ok = ok && parseHex(sak, bytes) && bytes.size() == 1;
+        if (ok) trace.sak = bytes[0];
+      } else if (key == "ecp") {
+        std::string hex;
+        ok = words >> hex && parseHex(hex, trace.ecp);
+      } else if (key == "flow" || key == "expect") {
+        std::string value;
+        ok = bool(words >> value);
+        if (key == "expect") trace.expect = value;
+        else if (value == "fast") trace.flow = kFlowFAST;
+        else if (value == "standard") trace.flow = kFlowSTANDARD;
+        else if (value == "attestation") trace.flow = kFlowATTESTATION;
+        else ok = value == "none";
+      } else if (key == "issuer" || key == "endpoint") {
+        std::string hex;
+        ok = words >> hex && parseHex(hex, key == "issuer" ? trace.issuerId : trace.endpointId);
+      } else if (key == "apdu") {
+        apdu_t apdu;
+        std::string command, response;
+        ok = words >> command >> response >> apdu.deviceUs && parseHex(command, apdu.command);
+        apdu.answers = response != "-";
+        ok = ok && (!apdu.answers || parseHex(response, apdu.response));
+        if (ok) trace.apdus.push_back(apdu);
+      } else {
+        ok = false;
+      }
+      if (!ok) {
+        error = path + ":" + std::to_string(lineNo) + ": can't parse \"" + line + "\"";
+        return false;
+      }
+    }
+    if (trace.expect.empty()) trace.expect = trace.flow == kFlowFailed ? "tag" : flowName(trace.flow);
+    if (trace.name.empty() || trace.uid.empty() || trace.apdus.empty()) {
+      error = path + ": needs name, target and at least the SELECT apdu";
+      return false;
+    }
+    return true;
+  }
+
+  struct faults_t {
+    uint32_t dropEvery = 0;   // every nth exchange is a frame error, 0 for none
+    double dropRate = 0;      // probability of a frame error per exchange
+    uint32_t failFrom = 0;    // every exchange of a tap from the nth on is a frame error, 0 for none
+    double latencyScale = 1;  // applied to the recorded device time
+    uint32_t extraUs = 0;     // added to every exchange, the PN532 and SPI overhead
+    uint32_t dwellMs = 200;   // the target leaves this long after it arrived
+    uint32_t seed = 1;
+  };
+
+  struct stats_t {
+    uint32_t exchanges = 0;
+    uint32_t injected = 0;   // frame errors from faults_t
+    uint32_t silent = 0;     // recorded "-" responses
+    uint32_t mismatches = 0; // commands that differ from the recording
+    uint32_t ecpMismatches = 0;
+    uint32_t activations = 0;
+  };
+
+  class VirtualPN532
+  {
+  public:
+    explicit VirtualPN532(const faults_t& faults) : faults(faults), rng(faults.seed) {}
+
+    /// Puts the device of `trace` in the field from now on, for faults_t::dwellMs
+    void arrive(const trace_t& trace) {
+      current = &trace;
+      arrivedAt = std::chrono::steady_clock::now();
+      cursor = 0;
+      tapExchanges = 0;
+    }
+    const trace_t& trace() const { return *current; }
+    stats_t stats() const { return total; }
+
+    bool inCommunicateThru(uint8_t* send, uint8_t sendLen, uint8_t* response, uint16_t* responseLength, uint16_t timeout = 1000, bool ignoreLog = false) {
+      if (current && !current->ecp.empty() && (current->ecp.size() != sendLen || memcmp(current->ecp.data(), send, sendLen))) {
+        total.ecpMismatches++;
+      }
+      // nothing answers an ECP frame
+      *responseLength = 0;
+      return false;
+    }
+
+    bool readPassiveTargetID(uint8_t cardbaudrate, uint8_t* uid, uint8_t* uidLength, uint8_t* atqa = nullptr, uint8_t* sak = nullptr, uint16_t timeout = 1000, bool inlist = false, bool ignoreLog = false) {
+      if (!inField()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        return false;
+      }
+      total.activations++;
+      memcpy(uid, current->uid.data(), current->uid.size());
+      *uidLength = current->uid.size();
+      if (atqa) memcpy(atqa, current->atqa, 2);
+      if (sak) *sak = current->sak;
+      // a fresh activation, the device starts over at SELECT
+      cursor = 0;
+      return true;
+    }
+
+    bool inDataExchange(uint8_t* send, uint8_t sendLength, uint8_t* response, uint16_t* responseLength, bool ignoreLog = false) {
+      total.exchanges++;
+      tapExchanges++;
+      if (!inField() || cursor >= current->apdus.size()) {
+        *responseLength = 0;
+        return false;
+      }
+      const apdu_t& apdu = current->apdus[cursor];
+      wait(apdu.deviceUs);
+      if (apdu.command.size() != sendLength || memcmp(apdu.command.data(), send, sendLength)) {
+        total.mismatches++;
+        fprintf(stderr, "%s: APDU %zu differs from the recording\n", current->name.c_str(), cursor);
+        *responseLength = 0;
+        return false;
+      }
+      if ((faults.dropEvery && total.exchanges % faults.dropEvery == 0) || (faults.failFrom && tapExchanges >= faults.failFrom) || (faults.dropRate > 0 && std::uniform_real_distribution<double>(0, 1)(rng) < faults.dropRate)) {
+        total.injected++;
+        *responseLength = 0;
+        return false;
+      }
+      if (!apdu.answers) {
+        total.silent++;
+        *responseLength = 0;
+        return false;
+      }
+      if (apdu.response.size() > *responseLength) {
+        fprintf(stderr, "%s: response %zu doesn't fit the %u byte buffer\n", current->name.c_str(), cursor, *responseLength);
+        return false;
+      }
+      memcpy(response, apdu.response.data(), apdu.response.size());
+      *responseLength = apdu.response.size();
+      cursor++;
+      return true;
+    }
+
+    bool inRelease(uint8_t relevantTarget = 0) { return true; }
+    bool setPassiveActivationRetries(uint8_t maxRetries) { return true; }
+    bool setRFField(uint8_t autoRFCA, uint8_t rFOnOff) { return true; }
+    bool writeRegister(uint16_t reg, uint8_t val, bool ignoreLog = false) { return true; }
+
+  private:
+    bool inField() const { return current && std::chrono::steady_clock::now() - arrivedAt < std::chrono::milliseconds(faults.dwellMs); }
+
+    void wait(uint32_t deviceUs) {
+      uint32_t us = uint32_t(deviceUs * faults.latencyScale) + faults.extraUs;
+      if (us) std::this_thread::sleep_for(std::chrono::microseconds(us));
+    }
+
+    faults_t faults;
+    std::mt19937 rng;
+    const trace_t* current = nullptr;
+    std::chrono::steady_clock::time_point arrivedAt;
+    size_t cursor = 0;
+    uint32_t tapExchanges = 0;
+    stats_t total;
+  };
+}
@@ -0,0 +1,21 @@
+// Host build of the C command's crypto benchmark, the crypto_bench target of test/CMakeLists.txt,
+// built when mbedtls and libsodium are found:
+//   cmake -S test -B build-test && cmake --build build-test --target crypto_bench
+//   build-test/crypto_bench [fast iterations] [slow iterations] > results.jsonl
+#include <cstdlib>
+#include "crypto_bench.h"
+
+int main(int argc, char** argv) {
+  uint32_t fast = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000;
+  uint32_t slow = argc > 2 ? strtoul(argv[2], NULL, 10) : 20;
+  cryptoBench::run([](const cryptoBench::result_t& r) {
+    char line[192];
+    cryptoBench::toJson(line, sizeof(line), r);
+    puts(line);
+  }, fast, slow);
+  cryptoBench::check_t sha = cryptoBench::checkSha256();
+  char line[128];
+  cryptoBench::toJson(line, sizeof(line), sha);
+  puts(line);
+  return sha.knownAnswer && sha.parity ? 0 : 1;
+}
@@ -0,0 +1,83 @@
+#!/usr/bin/env python3
+"""Packs data/ into the LittleFS image directory.
+
+Text files are minified and gzipped, every file gets a content hash that ends up in
+manifest.json as its ETag, and references to files under assets/ are rewritten to carry
+that hash as ?v=, so the server can mark those URLs immutable. index.html goes through the
+web server's template processor at runtime and is therefore only minified, not gzipped.
+
+usage: pack_web.py <data dir> <output dir>
+"""
+import gzip
+import hashlib
+import json
+import os
+import re
+import shutil
+import sys
+
+TEXT_TYPES = (".html", ".css", ".js", ".json", ".svg")
+NO_GZIP = ("index.html",)
+ASSET_REF = re.compile(r"\bassets/([\w.-]+)")
+
+
+def minify(name, text):
+    if name.endswith(".html"):
+        text = re.sub(r"<!--(?!\[).*?-->", "", text, flags=re.S)
+    if name.endswith(".css"):
+        text = re.sub(r"/\*.*?\*/", "", text, flags=re.S)
+    # leading indentation and blank lines only, line breaks stay so inline scripts keep working
+    lines = (line.strip() for line in text.splitlines())
+    return "\n".join(line for line in lines if line) + "\n"
+
+
+def etag(data):
+    return hashlib.sha256(data).hexdigest()[:16]
+
+
+def main(src, out):
+    if os.path.isdir(out):
+        shutil.rmtree(out)
+    files = []
+    for root, _, names in os.walk(src):
+        for name in sorted(names):
+            path = os.path.join(root, name)
+            files.append(os.path.relpath(path, src).replace(os.sep, "/"))
+    # assets first so pages can reference their final hashes
+    files.sort(key=lambda f: (not f.startswith("assets/"), f))
+    manifest = {}
+    raw_total = packed_total = 0
+    for rel in files:
+        with open(os.path.join(src, rel), "rb") as f:
+            data = f.read()
+        raw_total += len(data)
+        name = os.path.basename(rel)
+        gz = False
+        if name.endswith(TEXT_TYPES):
+            text = minify(name, data.decode("utf-8"))
+
+            def versioned(m):
+                entry = manifest.get("/assets/" + m.group(1))
+                return m.group(0) + "?v=" + entry["etag"] if entry else m.group(0)
+
+            data = ASSET_REF.sub(versioned, text).encode("utf-8")
+            gz = name not in NO_GZIP
+        tag = etag(data)
+        target = os.path.join(out, rel + (".gz" if gz else ""))
+        os.makedirs(os.path.dirname(target), exist_ok=True)
+        if gz:
+            # mtime=0 keeps the image reproducible
+            data = gzip.compress(data, 9, mtime=0)
+        with open(target, "wb") as f:
+            f.write(data)
+        packed_total += len(data)
+        manifest["/" + rel] = {"etag": tag, "gz": gz}
+    with open(os.path.join(out, "manifest.json"), "w") as f:
+        json.dump(manifest, f, separators=(",", ":"), sort_keys=True)
+    print("web assets: %d files, %d -> %d bytes" % (len(files), raw_total, packed_total))
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 3:
+        sys.exit(__doc__)
+    main(sys.argv[1], sys.argv[2])